@@ -0,0 +1,330 @@
+#include "aggregatedatasource.h"
+#include "requester.h"
+#include "utils.h"
+
+#include <algorithm>
+
+#include <QTimer>
+#include <QVector>
+
+RawDataSource::RawDataSource(QObject* parent) : QObject(parent)
+{
+}
+
+/* Reduces a run of N > 0 raw points, all in the same window, into a single
+ * statistical point. Uses two independent accumulators so that the loop
+ * pipelines (and vectorizes) well, since this is the inner loop when
+ * aggregating high-resolution data.
+ */
+static inline void reduceWindow(const struct rawpt* pts, int n, int64_t wstart, struct statpt* output)
+{
+    double min0 = pts[0].value;
+    double min1 = min0;
+    double max0 = min0;
+    double max1 = min0;
+    double sum0 = 0.0;
+    double sum1 = 0.0;
+
+    int k;
+    for (k = 0; k + 1 < n; k += 2)
+    {
+        double a = pts[k].value;
+        double b = pts[k + 1].value;
+        min0 = a < min0 ? a : min0;
+        min1 = b < min1 ? b : min1;
+        max0 = a > max0 ? a : max0;
+        max1 = b > max1 ? b : max1;
+        sum0 += a;
+        sum1 += b;
+    }
+    if (k < n)
+    {
+        double a = pts[k].value;
+        min0 = a < min0 ? a : min0;
+        max0 = a > max0 ? a : max0;
+        sum0 += a;
+    }
+
+    output->time = wstart;
+    output->min = qMin(min0, min1);
+    output->max = qMax(max0, max1);
+    output->mean = (sum0 + sum1) / n;
+    output->count = (uint64_t) n;
+}
+
+/* Aggregates sorted raw points into the nonempty windows at PWE. */
+static void aggregateRaw(const struct rawpt* pts, int len, uint8_t pwe, QVector<struct statpt>& result)
+{
+    int64_t pw = Q_INT64_C(1) << pwe;
+    int64_t pwmask = ~(pw - 1);
+
+    /* The result is memoized, so don't leave room for a window per point
+     * when the points are much denser than the windows.
+     */
+    if (len != 0)
+    {
+        uint64_t span = (uint64_t) pts[len - 1].time - (uint64_t) pts[0].time;
+        result.reserve((int) qMin((uint64_t) len, (span >> pwe) + 1));
+    }
+
+    int i = 0;
+    while (i < len)
+    {
+        int64_t wstart = pts[i].time & pwmask;
+
+        /* Find the end of the run of points in this window. */
+        int j = i + 1;
+        if (wstart <= INT64_MAX - pw)
+        {
+            int64_t wend = wstart + pw;
+            while (j < len && pts[j].time < wend)
+            {
+                j++;
+            }
+        }
+        else
+        {
+            j = len;
+        }
+
+        struct statpt window;
+        reduceWindow(&pts[i], j - i, wstart, &window);
+        result.append(window);
+
+        i = j;
+    }
+}
+
+/* Merges sorted windows at a finer pointwidth into windows at PWE. */
+static void mergeWindows(const struct statpt* pts, int len, uint8_t pwe, QVector<struct statpt>& result)
+{
+    int64_t pwmask = ~((Q_INT64_C(1) << pwe) - 1);
+
+    int i = 0;
+    while (i < len)
+    {
+        struct statpt window = pts[i];
+        window.time &= pwmask;
+
+        double weighted = pts[i].mean * pts[i].count;
+
+        int j;
+        for (j = i + 1; j < len && (pts[j].time & pwmask) == window.time; j++)
+        {
+            window.min = qMin(window.min, pts[j].min);
+            window.max = qMax(window.max, pts[j].max);
+            window.count += pts[j].count;
+            weighted += pts[j].mean * pts[j].count;
+        }
+
+        window.mean = weighted / window.count;
+        result.append(window);
+
+        i = j;
+    }
+}
+
+static bool statptTimeLess(const struct statpt& pt, int64_t time)
+{
+    return pt.time < time;
+}
+
+AggregateDataSource::AggregateDataSource(QObject* parent) : DataSource(parent),
+    source(nullptr), memoized(0)
+{
+}
+
+RawDataSource* AggregateDataSource::getSource() const
+{
+    return this->source;
+}
+
+void AggregateDataSource::setSource(RawDataSource* raw)
+{
+    this->source = raw;
+    this->memo.clear();
+    this->memoized = 0;
+}
+
+bool AggregateDataSource::fromMemo(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe,
+                                   QVector<struct statpt>& result, uint64_t* gen)
+{
+    /* Prefer the coarsest level that is still at least as fine as PWE,
+     * since it has the fewest windows to merge.
+     */
+    int best = -1;
+    for (int i = 0; i != this->memo.size(); i++)
+    {
+        const struct memolevel& level = this->memo.at(i);
+        if (level.uuid == uuid && level.pwe <= pwe && level.start <= start && level.end >= end
+                && (best == -1 || level.pwe > this->memo.at(best).pwe))
+        {
+            best = i;
+        }
+    }
+
+    if (best == -1)
+    {
+        return false;
+    }
+
+    /* Mark the level as most recently used. */
+    this->memo.move(best, this->memo.size() - 1);
+    const struct memolevel& level = this->memo.last();
+
+    const struct statpt* first = std::lower_bound(level.windows.constBegin(), level.windows.constEnd(), start, statptTimeLess);
+    const struct statpt* last = std::lower_bound(first, level.windows.constEnd(), end, statptTimeLess);
+    if (last != level.windows.constEnd() && last->time <= end)
+    {
+        last++;
+    }
+
+    if (level.pwe == pwe)
+    {
+        result.reserve(last - first);
+        for (const struct statpt* pt = first; pt != last; pt++)
+        {
+            result.append(*pt);
+        }
+    }
+    else
+    {
+        mergeWindows(first, last - first, pwe, result);
+    }
+
+    *gen = level.gen;
+    return true;
+}
+
+void AggregateDataSource::memoize(struct memolevel& level)
+{
+    this->memoized += level.windows.size();
+    this->memo.append(level);
+
+    while (this->memoized > AGGREGATE_MEMO_MAX_WINDOWS && this->memo.size() > 1)
+    {
+        this->memoized -= this->memo.first().windows.size();
+        this->memo.removeFirst();
+    }
+}
+
+void AggregateDataSource::dropMemo(const QUuid& uuid, const struct timerange* ranges, int len)
+{
+    auto i = this->memo.begin();
+    while (i != this->memo.end())
+    {
+        bool overlaps = false;
+        if (i->uuid == uuid)
+        {
+            for (int j = 0; j != len && !overlaps; j++)
+            {
+                overlaps = itvlOverlap(ranges[j].start, ranges[j].end, i->start, i->end);
+            }
+        }
+
+        if (overlaps)
+        {
+            this->memoized -= i->windows.size();
+            i = this->memo.erase(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void AggregateDataSource::alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback)
+{
+    /* Like BTrDB, round the start and end down to the nearest window
+     * boundary, and return every window that starts in the resulting
+     * (closed) interval.
+     */
+    int64_t pw = Q_INT64_C(1) << pwe;
+    int64_t pwmask = ~(pw - 1);
+
+    int64_t rawstart = start & pwmask;
+    int64_t rawend = end & pwmask;
+    if (rawend <= INT64_MAX - (pw - 1))
+    {
+        rawend += (pw - 1);
+    }
+    else
+    {
+        rawend = INT64_MAX;
+    }
+
+    QVector<struct statpt> windows;
+    uint64_t gen;
+    if (this->fromMemo(uuid, rawstart, rawend, pwe, windows, &gen))
+    {
+        QTimer::singleShot(0, [callback, windows, gen]()
+        {
+            QVector<struct statpt> result = windows;
+            callback(result.data(), result.size(), gen);
+        });
+        return;
+    }
+
+    if (this->source == nullptr)
+    {
+        qWarning("Aggregate data source has no raw source");
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(nullptr, 0, GENERATION_MAX);
+        });
+        return;
+    }
+
+    this->source->rawValues(uuid, rawstart, rawend, [this, uuid, rawstart, rawend, pwe, callback](struct rawpt* points, int len, uint64_t gen)
+    {
+        struct memolevel level;
+        level.uuid = uuid;
+        level.pwe = pwe;
+        level.start = rawstart;
+        level.end = rawend;
+        level.gen = gen;
+
+        aggregateRaw(points, len, pwe, level.windows);
+
+        callback(level.windows.data(), level.windows.size(), gen);
+
+        this->memoize(level);
+    });
+}
+
+void AggregateDataSource::brackets(const QList<QUuid> uuids, BracketCallback callback)
+{
+    if (this->source == nullptr)
+    {
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(QHash<QUuid, struct brackets>());
+        });
+        return;
+    }
+
+    this->source->brackets(uuids, callback);
+}
+
+void AggregateDataSource::changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback)
+{
+    Q_UNUSED(pwe);
+
+    if (this->source == nullptr)
+    {
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(nullptr, 0, GENERATION_MAX);
+        });
+        return;
+    }
+
+    this->source->changedRanges(uuid, fromGen, toGen, [this, uuid, callback](struct timerange* changed, int len, uint64_t gen)
+    {
+        /* Memoized windows overlapping a changed range are stale. */
+        this->dropMemo(uuid, changed, len);
+
+        callback(changed, len, gen);
+    });
+}
@@ -0,0 +1,98 @@
+#ifndef AGGREGATEDATASOURCE_H
+#define AGGREGATEDATASOURCE_H
+
+#include <cstdint>
+#include <functional>
+
+#include <QList>
+#include <QObject>
+#include <QUuid>
+#include <QVector>
+
+#include "datasource.h"
+#include "requester.h"
+
+/* The maximum number of aggregated windows that are memoized, across all
+ * streams and pointwidths. Each window takes sizeof(struct statpt) bytes.
+ */
+#define AGGREGATE_MEMO_MAX_WINDOWS (1 << 21)
+
+typedef std::function<void(struct rawpt*, int len, uint64_t gen)> RawReqCallback;
+
+/* A backend that stores raw points only, and cannot compute statistical
+ * windows on the server (e.g. a CSV file or an SQL table).
+ */
+class RawDataSource : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RawDataSource(QObject* parent = nullptr);
+
+    /* Returns, via the CALLBACK, all raw points whose times are in the
+     * closed interval [start, end], sorted by time.
+     */
+    virtual void rawValues(const QUuid& uuid, int64_t start, int64_t end, RawReqCallback callback) = 0;
+    virtual void brackets(const QList<QUuid> uuids, BracketCallback callback) = 0;
+    virtual void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, ChangedRangesCallback callback) = 0;
+};
+
+/* A level of aggregated windows that has already been computed. */
+struct memolevel
+{
+    QUuid uuid;
+    uint8_t pwe;
+
+    /* The (inclusive) range of raw time covered by this level. Both are
+     * aligned to the pointwidth.
+     */
+    int64_t start;
+    int64_t end;
+
+    uint64_t gen;
+
+    /* The nonempty windows in [start, end], sorted by time. */
+    QVector<struct statpt> windows;
+};
+
+/* Adapts a Raw Data Source into a Data Source, by computing the aligned
+ * statistical windows on the client. Computed windows are memoized, so
+ * that coarser pointwidths over the same range can be derived from them
+ * without fetching the raw points again.
+ */
+class AggregateDataSource : public DataSource
+{
+    Q_OBJECT
+    Q_PROPERTY(RawDataSource* source READ getSource WRITE setSource)
+
+public:
+    explicit AggregateDataSource(QObject* parent = nullptr);
+
+    RawDataSource* getSource() const;
+    void setSource(RawDataSource* raw);
+
+    void alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback) override;
+    void brackets(const QList<QUuid> uuids, BracketCallback callback) override;
+    void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback) override;
+
+signals:
+
+public slots:
+
+private:
+    /* Tries to compute the windows in [start, end] at PWE from a memoized
+     * level at the same or a finer pointwidth. Returns true on success.
+     */
+    bool fromMemo(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe,
+                  QVector<struct statpt>& result, uint64_t* gen);
+
+    void memoize(struct memolevel& level);
+    void dropMemo(const QUuid& uuid, const struct timerange* ranges, int len);
+
+    RawDataSource* source;
+
+    /* Memoized levels, from least to most recently used. */
+    QList<struct memolevel> memo;
+    int64_t memoized;
+};
+
+#endif // AGGREGATEDATASOURCE_H
@@ -29,6 +29,7 @@ YAxis::YAxis(float domainLow, float domainHigh, QObject* parent):
 {
     this->domainLo = domainLow;
     this->domainHi = domainHigh;
+    this->version = nextVersion();
     this->dynamicAutoscale = false;
     this->minticks = DEFAULT_MINTICKS;
 }
@@ -125,6 +126,7 @@ bool YAxis::setDomain(float low, float high)
 
     this->domainLo = low;
     this->domainHi = high;
+    this->version = nextVersion();
 
     for (auto j = this->axisareas.begin(); j != this->axisareas.end(); j++)
     {
@@ -153,6 +155,11 @@ void YAxis::getDomain(float* low, float* high) const
     *high = this->domainHi;
 }
 
+uint64_t YAxis::getVersion() const
+{
+    return this->version;
+}
+
 bool YAxis::setDomainArr(QList<qreal> domain)
 {
     return this->setDomain(domain.value(0), domain.value(1));
@@ -437,6 +444,7 @@ TimeAxis::TimeAxis(): tz(QTimeZone::systemTimeZone())
 {
     this->domainLo = 1451606400000000000LL;
     this->domainHi = 1483228799999999999LL;
+    this->version = nextVersion();
     this->setTimeZone(this->tz);
     this->promoteTicks = true;
 }
@@ -450,6 +458,7 @@ bool TimeAxis::setDomain(int64_t low, int64_t high)
 
     this->domainLo = low;
     this->domainHi = high;
+    this->version = nextVersion();
     return true;
 }
 
@@ -459,6 +468,11 @@ void TimeAxis::getDomain(int64_t* low, int64_t* high) const
     *high = this->domainHi;
 }
 
+uint64_t TimeAxis::getVersion() const
+{
+    return this->version;
+}
+
 void TimeAxis::setPromoteTicks(bool enable)
 {
     this->promoteTicks = enable;
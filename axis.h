@@ -74,6 +74,9 @@ public:
      */
     void getDomain(float* low, float* high) const;
 
+    /* Returns a number that changes whenever the domain changes. */
+    uint64_t getVersion() const;
+
     Q_INVOKABLE bool setDomainArr(QList<qreal> domain);
     Q_INVOKABLE QList<qreal> getDomainArr() const;
 
@@ -125,6 +128,7 @@ private:
 
     float domainLo;
     float domainHi;
+    uint64_t version;
 
     QList<Stream*> streams;
 };
@@ -214,6 +218,9 @@ public:
      */
     void getDomain(int64_t* low, int64_t* high) const;
 
+    /* Returns a number that changes whenever the domain changes. */
+    uint64_t getVersion() const;
+
     void setTimeZone(QTimeZone& newtz);
     QTimeZone& getTimeZone();
 
@@ -229,6 +236,7 @@ public:
 private:
     int64_t domainLo;
     int64_t domainHi;
+    uint64_t version;
     QTimeZone tz;
     QStaticText label;
     bool promoteTicks;
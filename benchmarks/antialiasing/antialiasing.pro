@@ -0,0 +1,12 @@
+# Measures the time per frame of a Plot Area at each antialiasing setting.
+
+TEMPLATE = app
+TARGET = antialiasing
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+include(../common/common.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,82 @@
+#include "benchscene.h"
+#include "syntheticdatasource.h"
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QGuiApplication>
+#include <QVariantMap>
+
+/* How long to wait for the data to be drawn, in milliseconds. */
+#define ANTIALIASING_TIMEOUT 60000
+
+/* Frames drawn after changing the setting, before measuring, so that the
+ * new framebuffer has been made.
+ */
+#define ANTIALIASING_WARMUP_FRAMES 10
+
+struct aasetting
+{
+    const char* name;
+    int samples;
+    bool analytic;
+};
+
+static const struct aasetting settings[] = {
+    { "none", 0, false },
+    { "msaa 2x", 2, false },
+    { "msaa 4x", 4, false },
+    { "msaa 8x", 8, false },
+    { "analytic", 0, true }
+};
+
+int main(int argc, char* argv[])
+{
+    BenchScene::setUpFormat();
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the time per frame of a Plot Area at each antialiasing setting. "
+                                      "Times are in milliseconds; the GPU time is -1 where it can't be measured.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("log", "Log of the data to replay, recorded first if it doesn't exist.", "file", "antialiasing.log"));
+    parser.addOption(QCommandLineOption("streams", "Number of streams to draw.", "count", "8"));
+    parser.addOption(QCommandLineOption("frames", "Number of frames to average over, at most 256.", "count", "200"));
+    parser.addOption(QCommandLineOption("width", "Width of the plot, in pixels.", "pixels", "3840"));
+    parser.addOption(QCommandLineOption("height", "Height of the plot, in pixels.", "pixels", "2160"));
+    parser.process(app);
+
+    QSize size(parser.value("width").toInt(), parser.value("height").toInt());
+    BenchScene scene(parser.value("log"), parser.value("streams").toInt(), size);
+    if (scene.isRecording())
+    {
+        printf("Recording %s\n", qPrintable(parser.value("log")));
+    }
+
+    if (!scene.show(SYNTHETIC_START, SYNTHETIC_START + Q_INT64_C(3600000000000), ANTIALIASING_TIMEOUT))
+    {
+        qWarning("The plot was not drawn in time");
+        return 1;
+    }
+
+    PlotArea* plotarea = scene.getPlotArea();
+    int frames = parser.value("frames").toInt();
+
+    printf("%-10s %10s %10s %10s %10s\n", "setting", "frame", "sync", "render", "gpu");
+    for (const struct aasetting& setting : settings)
+    {
+        plotarea->setMsaaSamples(setting.samples);
+        plotarea->setAnalyticAntialiasing(setting.analytic);
+        for (int i = 0; i != ANTIALIASING_WARMUP_FRAMES; i++)
+        {
+            scene.drawFrame();
+        }
+
+        QVariantMap result = scene.measureFrames(frames);
+        printf("%-10s %10.3f %10.3f %10.3f %10.3f\n", setting.name,
+               result.value("frameTime").toDouble(), result.value("syncTime").toDouble(),
+               result.value("renderTime").toDouble(), result.value("gpuTime").toDouble());
+    }
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+# Build with "qmake benchmarks && make". Each benchmark records the data it
+# draws into a log file the first time it runs, and replays it after that;
+# run one with --help for its options.
+
+TEMPLATE = subdirs
+SUBDIRS += \
+    firstframe \
+    antialiasing \
+    heatmap \
+    decimation \
+    rawpath \
+    snapshots
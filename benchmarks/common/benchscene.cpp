@@ -0,0 +1,193 @@
+#include "benchscene.h"
+
+#include <QColor>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QQuickWindow>
+#include <QSurfaceFormat>
+#include <QTimer>
+#include <QUuid>
+#include <QVariant>
+
+#include "axis.h"
+#include "renderstats.h"
+
+/* The UUIDs of the synthetic streams are derived from this one, so that
+ * they are the same in every run.
+ */
+#define BENCH_UUID_NAMESPACE "{c5a6f8a2-4f7e-4b0a-9d3e-2b1c7e0f5a11}"
+
+BenchScene::BenchScene(const QString& logfile, int streams, const QSize& size, QObject* parent) :
+    QObject(parent), recording(!QFile::exists(logfile))
+{
+    this->recorder.setLogFile(logfile);
+    this->recorder.setProperty("timeScale", 0.0);
+    if (this->recording)
+    {
+        this->recorder.setSource(&this->synthetic);
+        this->recorder.setMode(RecorderDataSource::Record);
+    }
+    else
+    {
+        this->recorder.setMode(RecorderDataSource::Replay);
+    }
+
+    this->window = new QQuickWindow;
+    this->window->resize(size);
+
+    this->plotarea = new PlotArea;
+    this->plotarea->setParentItem(this->window->contentItem());
+    this->plotarea->setSize(size);
+    this->plotarea->getRenderStats()->setEnabled(true);
+
+    QList<QVariant> plotlist;
+    plotlist.append(QVariant::fromValue(this->plotarea));
+    this->plotter.setPlotList(plotlist);
+
+    this->axis = this->plotter.newYAxis(100.0f, 140.0f);
+
+    QUuid ns(BENCH_UUID_NAMESPACE);
+    QList<QVariant> streamlist;
+    for (int i = 0; i != streams; i++)
+    {
+        QUuid uuid = QUuid::createUuidV5(ns, QString::number(i));
+        Stream* s = this->plotter.newStream(uuid.toString(), &this->recorder);
+        s->setColor(QColor::fromHsvF((qreal) i / streams, 0.8, 0.8));
+        this->axis->addStream(s);
+        this->streams.append(s);
+        streamlist.append(QVariant::fromValue(s));
+    }
+    this->plotarea->setStreamList(streamlist);
+}
+
+BenchScene::~BenchScene()
+{
+    /* The streams and the axis belong to the plotter. */
+    delete this->plotarea;
+    delete this->window;
+}
+
+void BenchScene::setUpFormat()
+{
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setSwapInterval(0);
+    QSurfaceFormat::setDefaultFormat(format);
+}
+
+bool BenchScene::isRecording() const
+{
+    return this->recording;
+}
+
+PlotArea* BenchScene::getPlotArea()
+{
+    return this->plotarea;
+}
+
+const QList<Stream*>& BenchScene::getStreams() const
+{
+    return this->streams;
+}
+
+QQuickWindow* BenchScene::getWindow()
+{
+    return this->window;
+}
+
+void BenchScene::setDomain(int64_t start, int64_t end)
+{
+    this->plotter.timeaxis.setDomain(start, end);
+}
+
+bool BenchScene::show(int64_t start, int64_t end, int timeout)
+{
+    this->setDomain(start, end);
+    this->window->show();
+    this->plotter.updateDataAsync();
+
+    QElapsedTimer total;
+    total.start();
+    QElapsedTimer steady;
+    steady.start();
+
+    RenderStats* stats = this->plotarea->getRenderStats();
+    qreal vertices = -1.0;
+    while (total.elapsed() < timeout)
+    {
+        if (!this->drawFrame())
+        {
+            return false;
+        }
+
+        qreal latest = stats->latest().value("vertices").toReal();
+        if (latest != vertices)
+        {
+            vertices = latest;
+            steady.restart();
+        }
+        else if (vertices > 0.0 && steady.elapsed() >= BENCH_SETTLE_MSEC)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool BenchScene::drawFrame()
+{
+    QEventLoop loop;
+    bool swapped = false;
+    QMetaObject::Connection c = QObject::connect(this->window, &QQuickWindow::frameSwapped, &loop, [&loop, &swapped]()
+    {
+        swapped = true;
+        loop.quit();
+    }, Qt::QueuedConnection);
+    QTimer::singleShot(BENCH_FRAME_TIMEOUT, &loop, SLOT(quit()));
+
+    this->plotarea->update();
+    loop.exec();
+
+    QObject::disconnect(c);
+    if (!swapped)
+    {
+        qWarning("Timed out waiting for a frame");
+    }
+    return swapped;
+}
+
+QVariantMap BenchScene::measureFrames(int frames)
+{
+    frames = qBound(1, frames, RENDER_STATS_FRAMES);
+
+    RenderStats* stats = this->plotarea->getRenderStats();
+    stats->clear();
+
+    /* Changing the colour of a stream changes what the plot looks like,
+     * so every frame is drawn in full rather than reused.
+     */
+    Stream* toggled = this->streams.first();
+    QColor color = toggled->getColor();
+    QColor other = color.lighter(110);
+
+    QElapsedTimer timer;
+    timer.start();
+    int drawn = 0;
+    while (drawn != frames)
+    {
+        toggled->setColor(drawn % 2 == 0 ? other : color);
+        if (!this->drawFrame())
+        {
+            break;
+        }
+        drawn++;
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    toggled->setColor(color);
+
+    QVariantMap result = stats->average();
+    result.insert("frames", drawn);
+    result.insert("frameTime", drawn == 0 ? -1.0 : elapsed / 1000000.0 / drawn);
+    return result;
+}
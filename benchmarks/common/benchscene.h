@@ -0,0 +1,89 @@
+#ifndef BENCHSCENE_H
+#define BENCHSCENE_H
+
+#include <cstdint>
+
+#include <QList>
+#include <QObject>
+#include <QSize>
+#include <QString>
+#include <QVariantMap>
+
+#include "mrplotter.h"
+#include "plotarea.h"
+#include "recorderdatasource.h"
+#include "stream.h"
+#include "syntheticdatasource.h"
+
+/* How long the number of vertices drawn must stay the same before the
+ * data is taken to have arrived, in milliseconds. This is longer than
+ * THROTTLE_MSEC, so that throttled requests have been made by then.
+ */
+#define BENCH_SETTLE_MSEC 1000
+
+/* How long to wait for a single frame, in milliseconds. */
+#define BENCH_FRAME_TIMEOUT 5000
+
+class QQuickWindow;
+
+/* A window with a single Plot Area that shows synthetic streams, for the
+ * benchmarks. The data goes through a Recorder Data Source: if the log
+ * file doesn't exist yet, the queries made to the Synthetic Data Source
+ * are recorded into it, and every later run replays them as fast as
+ * possible. That way, runs of the same benchmark draw the same data, and
+ * the time spent making it up isn't measured.
+ */
+class BenchScene : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchScene(const QString& logfile, int streams, const QSize& size, QObject* parent = nullptr);
+    ~BenchScene();
+
+    /* Turns vsync off, so that frames aren't held back by the display.
+     * Must be called before the application is created.
+     */
+    static void setUpFormat();
+
+    /* True if this run records the log, rather than replaying it. */
+    bool isRecording() const;
+
+    PlotArea* getPlotArea();
+    const QList<Stream*>& getStreams() const;
+    QQuickWindow* getWindow();
+
+    /* Changes the time domain to START to END, without requesting the data
+     * for it.
+     */
+    void setDomain(int64_t start, int64_t end);
+
+    /* Shows the window, with the time domain from START to END, and waits
+     * until the data for it has been drawn. Returns false if it doesn't
+     * settle within TIMEOUT milliseconds.
+     */
+    bool show(int64_t start, int64_t end, int timeout);
+
+    /* Requests a frame and waits until it is on the screen. */
+    bool drawFrame();
+
+    /* Draws FRAMES frames in full, one after the other, and returns the
+     * averages reported by the Render Stats of the Plot Area, with the
+     * wall-clock time per frame, in milliseconds, as "frameTime". At most
+     * RENDER_STATS_FRAMES frames are drawn.
+     */
+    QVariantMap measureFrames(int frames);
+
+private:
+    SyntheticDataSource synthetic;
+    RecorderDataSource recorder;
+    bool recording;
+
+    MrPlotter plotter;
+    QQuickWindow* window;
+    PlotArea* plotarea;
+    YAxis* axis;
+    QList<Stream*> streams;
+};
+
+#endif // BENCHSCENE_H
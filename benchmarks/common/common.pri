@@ -0,0 +1,11 @@
+# The synthetic data and the scene that every benchmark draws.
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/benchscene.cpp \
+    $$PWD/syntheticdatasource.cpp
+
+HEADERS += \
+    $$PWD/benchscene.h \
+    $$PWD/syntheticdatasource.h
@@ -0,0 +1,137 @@
+#include "syntheticdatasource.h"
+
+#include <cmath>
+
+#include <QHash>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVector>
+
+/* The generation that every synthetic stream is at. It never changes. */
+#define SYNTHETIC_GENERATION 1
+
+/* The index of the last raw point at or before TIME, which may be -1 or
+ * past the last point.
+ */
+static int64_t pointAtOrBefore(int64_t time)
+{
+    int64_t offset = time - SYNTHETIC_START;
+    int64_t index = offset / SYNTHETIC_SPACING;
+    if (offset < 0 && index * SYNTHETIC_SPACING != offset)
+    {
+        index--;
+    }
+    return index;
+}
+
+static int64_t pointTime(int64_t index)
+{
+    return SYNTHETIC_START + index * SYNTHETIC_SPACING;
+}
+
+SyntheticDataSource::SyntheticDataSource(QObject* parent) : DataSource(parent)
+{
+}
+
+double SyntheticDataSource::value(const QUuid& uuid, int64_t time)
+{
+    uint seed = qHash(uuid);
+    double period = 60.0 + (seed % 600); // seconds
+    double phase = (seed >> 10) % 628 / 100.0;
+    double t = (time - SYNTHETIC_START) / 1e9;
+
+    /* Noise that depends only on the time and the stream. */
+    uint noise = qHash(time, seed);
+
+    return 120.0 + 10.0 * std::sin(2.0 * M_PI * t / period + phase) +
+            2.0 * std::sin(2.0 * M_PI * t / 0.5 + phase) +
+            (noise % 1000) / 1000.0 - 0.5;
+}
+
+void SyntheticDataSource::alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback)
+{
+    QSharedPointer<QVector<struct statpt>> windows(new QVector<struct statpt>);
+
+    int64_t pw = Q_INT64_C(1) << qMin((int) pwe, 62);
+    int64_t lastindex = pointAtOrBefore(SYNTHETIC_END - 1);
+    start = qMax(start, SYNTHETIC_START) & ~(pw - 1);
+    end = qMin(end, SYNTHETIC_END);
+
+    if (pw <= SYNTHETIC_SPACING)
+    {
+        /* No window holds more than one point, so go point by point. */
+        for (int64_t k = qMax(pointAtOrBefore(start - 1) + 1, Q_INT64_C(0)); k <= lastindex && pointTime(k) < end; k++)
+        {
+            int64_t time = pointTime(k);
+            double v = SyntheticDataSource::value(uuid, time);
+            windows->append({ time & ~(pw - 1), v, v, v, 1 });
+        }
+    }
+    else
+    {
+        for (int64_t w = start; w < end; w += pw)
+        {
+            int64_t first = qMax(pointAtOrBefore(w - 1) + 1, Q_INT64_C(0));
+            int64_t last = qMin(pointAtOrBefore(w + pw - 1), lastindex);
+            if (last < first)
+            {
+                continue;
+            }
+
+            struct statpt window;
+            window.time = w;
+            window.min = INFINITY;
+            window.max = -INFINITY;
+            window.count = (uint64_t) (last - first + 1);
+
+            double sum = 0.0;
+            int64_t step = qMax((last - first) / SYNTHETIC_SAMPLES, Q_INT64_C(1));
+            int samples = 0;
+            for (int64_t k = first; k <= last; k += step)
+            {
+                double v = SyntheticDataSource::value(uuid, pointTime(k));
+                window.min = qMin(window.min, v);
+                window.max = qMax(window.max, v);
+                sum += v;
+                samples++;
+            }
+            window.mean = sum / samples;
+            windows->append(window);
+        }
+    }
+
+    QTimer::singleShot(0, this, [windows, callback]()
+    {
+        callback(windows->data(), windows->size(), SYNTHETIC_GENERATION);
+    });
+}
+
+void SyntheticDataSource::brackets(const QList<QUuid> uuids, BracketCallback callback)
+{
+    QHash<QUuid, struct brackets> result;
+    for (auto i = uuids.begin(); i != uuids.end(); i++)
+    {
+        struct brackets& b = result[*i];
+        b.lowerbound = SYNTHETIC_START;
+        b.upperbound = pointTime(pointAtOrBefore(SYNTHETIC_END - 1));
+    }
+
+    QTimer::singleShot(0, this, [result, callback]()
+    {
+        callback(result);
+    });
+}
+
+void SyntheticDataSource::changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback)
+{
+    Q_UNUSED(uuid);
+    Q_UNUSED(toGen);
+    Q_UNUSED(pwe);
+
+    /* Nothing ever changes. */
+    uint64_t gen = qMax(fromGen, (uint64_t) SYNTHETIC_GENERATION);
+    QTimer::singleShot(0, this, [gen, callback]()
+    {
+        callback(nullptr, 0, gen);
+    });
+}
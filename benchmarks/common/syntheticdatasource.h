@@ -0,0 +1,50 @@
+#ifndef SYNTHETICDATASOURCE_H
+#define SYNTHETICDATASOURCE_H
+
+#include <cstdint>
+
+#include <QList>
+#include <QObject>
+#include <QUuid>
+
+#include "datasource.h"
+#include "requester.h"
+
+/* The time between consecutive raw points of a synthetic stream, in
+ * nanoseconds (120 Hz, like a micro-PMU).
+ */
+#define SYNTHETIC_SPACING Q_INT64_C(8333333)
+
+/* The range of time in which synthetic streams have data: one day,
+ * starting on 1 January 2017 (UTC).
+ */
+#define SYNTHETIC_START Q_INT64_C(1483228800000000000)
+#define SYNTHETIC_END (SYNTHETIC_START + Q_INT64_C(86400000000000))
+
+/* The number of raw points sampled to compute the statistics of a window
+ * that holds more than this many of them.
+ */
+#define SYNTHETIC_SAMPLES 32
+
+/* A Data Source that makes up its data, for the benchmarks to record. The
+ * value of every stream is a sum of sinusoids with a little noise, whose
+ * frequencies and phases depend on the UUID, so the same stream always
+ * has the same data. Responses are delivered from the event loop, as a
+ * real source would deliver them.
+ */
+class SyntheticDataSource : public DataSource
+{
+    Q_OBJECT
+
+public:
+    explicit SyntheticDataSource(QObject* parent = nullptr);
+
+    void alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback) override;
+    void brackets(const QList<QUuid> uuids, BracketCallback callback) override;
+    void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback) override;
+
+    /* The value of the stream with the given UUID at TIME. */
+    static double value(const QUuid& uuid, int64_t time);
+};
+
+#endif // SYNTHETICDATASOURCE_H
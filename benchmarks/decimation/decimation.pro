@@ -0,0 +1,13 @@
+# Measures the time per frame of raw points drawn at several scales, with
+# the decimations made, and while they are being made.
+
+TEMPLATE = app
+TARGET = decimation
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+include(../common/common.pri)
+
+SOURCES += main.cpp
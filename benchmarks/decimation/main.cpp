@@ -0,0 +1,113 @@
+#include "benchscene.h"
+#include "renderstats.h"
+#include "syntheticdatasource.h"
+
+#include <cstdio>
+
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QVariantMap>
+
+/* How long to wait for the data to be drawn, in milliseconds. */
+#define DECIMATION_TIMEOUT 120000
+
+/* Frames drawn after changing the scale, before measuring, so that the
+ * decimations for it have been made.
+ */
+#define DECIMATION_WARMUP_FRAMES 10
+
+/* The widths of the time domain drawn, in minutes. Each is drawn with a
+ * decimation of its own, and there are more of them than the decimations
+ * that an entry keeps, so switching between them every frame means making
+ * a decimation every frame.
+ */
+static const int spans[] = { 40, 20, 10, 5 };
+
+static int64_t spanEnd(int minutes)
+{
+    return SYNTHETIC_START + minutes * Q_INT64_C(60000000000);
+}
+
+static void printRow(const char* name, const QVariantMap& result)
+{
+    printf("%-10s %10.3f %10.3f %10.3f %10.3f %12.0f %12.0f\n", name,
+           result.value("frameTime").toDouble(), result.value("syncTime").toDouble(),
+           result.value("renderTime").toDouble(), result.value("gpuTime").toDouble(),
+           result.value("vertices").toDouble(), result.value("uploadedBytes").toDouble());
+}
+
+int main(int argc, char* argv[])
+{
+    BenchScene::setUpFormat();
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the time per frame of streams drawn from their raw points, which are "
+                                      "decimated, at several scales and while switching between them every frame. "
+                                      "Times are in milliseconds; the GPU time is -1 where it can't be measured.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("log", "Log of the data to replay, recorded first if it doesn't exist.", "file", "decimation.log"));
+    parser.addOption(QCommandLineOption("streams", "Number of streams to draw.", "count", "8"));
+    parser.addOption(QCommandLineOption("frames", "Number of frames to average over, at most 256.", "count", "200"));
+    parser.addOption(QCommandLineOption("width", "Width of the plot, in pixels.", "pixels", "1920"));
+    parser.addOption(QCommandLineOption("height", "Height of the plot, in pixels.", "pixels", "1080"));
+    parser.process(app);
+
+    QSize size(parser.value("width").toInt(), parser.value("height").toInt());
+    BenchScene scene(parser.value("log"), parser.value("streams").toInt(), size);
+    if (scene.isRecording())
+    {
+        printf("Recording %s\n", qPrintable(parser.value("log")));
+    }
+
+    /* Fetch the raw points of the widest span, which holds the others. */
+    PlotArea* plotarea = scene.getPlotArea();
+    plotarea->setProperty("donotaggregate", true);
+    if (!scene.show(SYNTHETIC_START, spanEnd(spans[0]), DECIMATION_TIMEOUT))
+    {
+        qWarning("The plot was not drawn in time");
+        return 1;
+    }
+
+    int frames = qBound(1, parser.value("frames").toInt(), RENDER_STATS_FRAMES);
+
+    printf("%-10s %10s %10s %10s %10s %12s %12s\n", "span", "frame", "sync", "render", "gpu", "vertices", "uploaded");
+    for (int minutes : spans)
+    {
+        scene.setDomain(SYNTHETIC_START, spanEnd(minutes));
+        for (int i = 0; i != DECIMATION_WARMUP_FRAMES; i++)
+        {
+            scene.drawFrame();
+        }
+
+        QByteArray name = QByteArray::number(minutes) + " min";
+        printRow(name.constData(), scene.measureFrames(frames));
+    }
+
+    /* Every frame is at a new scale, so each is drawn in full. */
+    RenderStats* stats = plotarea->getRenderStats();
+    stats->clear();
+
+    QElapsedTimer timer;
+    timer.start();
+    int drawn = 0;
+    int nspans = sizeof(spans) / sizeof(spans[0]);
+    while (drawn != frames)
+    {
+        scene.setDomain(SYNTHETIC_START, spanEnd(spans[drawn % nspans]));
+        if (!scene.drawFrame())
+        {
+            break;
+        }
+        drawn++;
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+
+    QVariantMap result = stats->average();
+    result.insert("frameTime", drawn == 0 ? -1.0 : elapsed / 1000000.0 / drawn);
+    printRow("switching", result);
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+# Measures the time from a Plot Area's renderer being created to its first
+# frame, with the shader program cache empty (cold) and filled (warm).
+
+TEMPLATE = app
+TARGET = firstframe
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+include(../common/common.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,161 @@
+#include "benchscene.h"
+#include "renderstats.h"
+#include "syntheticdatasource.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QGuiApplication>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QStringList>
+#include <QVector>
+
+/* How long a single run may take, in milliseconds. */
+#define FIRSTFRAME_TIMEOUT 60000
+
+struct startup
+{
+    double shadertime;
+    double firstframetime;
+};
+
+/* Shows the plot, and prints how long the renderer took to start up. */
+static int measure(const QCommandLineParser& parser)
+{
+    BenchScene scene(parser.value("log"), parser.value("streams").toInt(), QSize(1280, 720));
+    if (!scene.show(SYNTHETIC_START, SYNTHETIC_START + Q_INT64_C(3600000000000), FIRSTFRAME_TIMEOUT))
+    {
+        qWarning("The plot was not drawn in time");
+        return 1;
+    }
+
+    RenderStats* stats = scene.getPlotArea()->getRenderStats();
+    if (stats->getFirstFrameTime() < 0.0)
+    {
+        qWarning("The renderer did not report its startup time");
+        return 1;
+    }
+
+    printf("%f %f\n", stats->getShaderTime(), stats->getFirstFrameTime());
+    return 0;
+}
+
+/* Runs this program again to measure one startup, with the caches of Qt
+ * and the driver in CACHEDIR.
+ */
+static bool runOnce(const QCommandLineParser& parser, const QString& cachedir, struct startup* result)
+{
+    /* Qt's shader program cache and Mesa's shader cache are both kept
+     * under XDG_CACHE_HOME, so a fresh one makes a cold start.
+     */
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("XDG_CACHE_HOME", cachedir);
+
+    QProcess child;
+    child.setProcessEnvironment(env);
+    child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    child.start(QCoreApplication::applicationFilePath(), QStringList()
+                << "--measure" << "--log" << parser.value("log")
+                << "--streams" << parser.value("streams"));
+
+    if (!child.waitForFinished(FIRSTFRAME_TIMEOUT) || child.exitCode() != 0)
+    {
+        return false;
+    }
+
+    QStringList times = QString::fromLatin1(child.readAllStandardOutput()).split(' ');
+    if (times.size() != 2)
+    {
+        return false;
+    }
+    result->shadertime = times[0].toDouble();
+    result->firstframetime = times[1].toDouble();
+    return true;
+}
+
+static double median(QVector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+    BenchScene::setUpFormat();
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the time to the first frame of a Plot Area, with the shader "
+                                      "program cache empty (cold) and filled (warm). Times are in milliseconds.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("log", "Log of the data to replay, recorded first if it doesn't exist.", "file", "firstframe.log"));
+    parser.addOption(QCommandLineOption("streams", "Number of streams to draw.", "count", "8"));
+    parser.addOption(QCommandLineOption("runs", "Number of cold and warm starts.", "count", "5"));
+    parser.addOption(QCommandLineOption("cache-dir", "Where the runs keep their caches. It is emptied before every cold start.",
+                                        "dir", QDir::temp().filePath("mrplotter-firstframe-cache")));
+    parser.addOption(QCommandLineOption("measure", "Measure a single start in this process."));
+    parser.process(app);
+
+    if (parser.isSet("measure"))
+    {
+        return measure(parser);
+    }
+
+    QString cachedir = parser.value("cache-dir");
+    struct startup result;
+
+    if (!QFile::exists(parser.value("log")))
+    {
+        printf("Recording %s\n", qPrintable(parser.value("log")));
+        if (!runOnce(parser, cachedir, &result))
+        {
+            qWarning("Could not record the data");
+            return 1;
+        }
+    }
+
+    QVector<double> coldshader, coldframe, warmshader, warmframe;
+    int runs = parser.value("runs").toInt();
+
+    printf("%-6s %14s %14s %14s %14s\n", "run", "cold shaders", "cold frame", "warm shaders", "warm frame");
+    for (int i = 0; i != runs; i++)
+    {
+        QDir(cachedir).removeRecursively();
+        if (!runOnce(parser, cachedir, &result))
+        {
+            qWarning("Cold start %d failed", i);
+            return 1;
+        }
+        coldshader.append(result.shadertime);
+        coldframe.append(result.firstframetime);
+
+        if (!runOnce(parser, cachedir, &result))
+        {
+            qWarning("Warm start %d failed", i);
+            return 1;
+        }
+        warmshader.append(result.shadertime);
+        warmframe.append(result.firstframetime);
+
+        printf("%-6d %14.2f %14.2f %14.2f %14.2f\n", i, coldshader.last(), coldframe.last(),
+               warmshader.last(), warmframe.last());
+    }
+
+    if (runs > 0)
+    {
+        printf("%-6s %14.2f %14.2f %14.2f %14.2f\n", "median", median(coldshader), median(coldframe),
+               median(warmshader), median(warmframe));
+    }
+
+    if (QDir(cachedir).isEmpty())
+    {
+        printf("Nothing was cached in %s, so the warm starts were cold as well. On this platform, "
+               "Qt keeps its shader cache elsewhere.\n", qPrintable(cachedir));
+    }
+
+    return 0;
+}
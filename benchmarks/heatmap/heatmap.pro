@@ -0,0 +1,13 @@
+# Measures the time per frame of many streams drawn as a density heatmap,
+# and as lines.
+
+TEMPLATE = app
+TARGET = heatmap
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+include(../common/common.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,74 @@
+#include "benchscene.h"
+#include "syntheticdatasource.h"
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QGuiApplication>
+#include <QVariantMap>
+
+/* How long to wait for the data to be drawn, in milliseconds. */
+#define HEATMAP_TIMEOUT 120000
+
+/* Frames drawn after switching between lines and the heatmap, before
+ * measuring.
+ */
+#define HEATMAP_WARMUP_FRAMES 10
+
+static void setHeatmap(BenchScene& scene, bool enable)
+{
+    const QList<Stream*>& streams = scene.getStreams();
+    for (auto i = streams.begin(); i != streams.end(); i++)
+    {
+        (*i)->setHeatmap(enable);
+    }
+    for (int i = 0; i != HEATMAP_WARMUP_FRAMES; i++)
+    {
+        scene.drawFrame();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchScene::setUpFormat();
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the time per frame of many streams drawn as lines, and as a density "
+                                      "heatmap. Times are in milliseconds; the GPU time is -1 where it can't be measured.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("log", "Log of the data to replay, recorded first if it doesn't exist.", "file", "heatmap.log"));
+    parser.addOption(QCommandLineOption("streams", "Number of streams to draw.", "count", "256"));
+    parser.addOption(QCommandLineOption("frames", "Number of frames to average over, at most 256.", "count", "200"));
+    parser.addOption(QCommandLineOption("width", "Width of the plot, in pixels.", "pixels", "1920"));
+    parser.addOption(QCommandLineOption("height", "Height of the plot, in pixels.", "pixels", "1080"));
+    parser.process(app);
+
+    QSize size(parser.value("width").toInt(), parser.value("height").toInt());
+    BenchScene scene(parser.value("log"), parser.value("streams").toInt(), size);
+    if (scene.isRecording())
+    {
+        printf("Recording %s\n", qPrintable(parser.value("log")));
+    }
+
+    if (!scene.show(SYNTHETIC_START, SYNTHETIC_START + Q_INT64_C(3600000000000), HEATMAP_TIMEOUT))
+    {
+        qWarning("The plot was not drawn in time");
+        return 1;
+    }
+
+    int frames = parser.value("frames").toInt();
+
+    printf("%-8s %10s %10s %10s %10s %10s\n", "mode", "frame", "sync", "render", "gpu", "draws");
+    for (int heatmap = 0; heatmap != 2; heatmap++)
+    {
+        setHeatmap(scene, heatmap != 0);
+        QVariantMap result = scene.measureFrames(frames);
+        printf("%-8s %10.3f %10.3f %10.3f %10.3f %10.1f\n", heatmap ? "heatmap" : "lines",
+               result.value("frameTime").toDouble(), result.value("syncTime").toDouble(),
+               result.value("renderTime").toDouble(), result.value("gpuTime").toDouble(),
+               result.value("drawCalls").toDouble());
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "benchscene.h"
+#include "cache.h"
+#include "stream.h"
+#include "syntheticdatasource.h"
+
+#include <cstdio>
+
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QGuiApplication>
+#include <QSet>
+#include <QVariantMap>
+
+/* How long to wait for the data to be drawn, in milliseconds. */
+#define RAWPATH_TIMEOUT 60000
+
+/* Frames drawn after the data arrives, before measuring. */
+#define RAWPATH_WARMUP_FRAMES 10
+
+/* The widths of the time domain drawn, in seconds. At the default width,
+ * both have fewer raw points per pixel than it takes for them to be
+ * decimated.
+ */
+static const int spans[] = { 10, 60 };
+
+/* The bytes of host memory held by the cache entries that the streams
+ * are drawn from, counting entries shared between streams once.
+ */
+static double hostBytes(const QList<Stream*>& streams)
+{
+    QSet<CacheEntry*> counted;
+    double total = 0.0;
+    for (auto i = streams.begin(); i != streams.end(); i++)
+    {
+        const QList<QSharedPointer<CacheEntry>>& entries = (*i)->data;
+        for (auto j = entries.begin(); j != entries.end(); j++)
+        {
+            if (!counted.contains(j->data()))
+            {
+                counted.insert(j->data());
+                total += (*j)->getHostCost();
+            }
+        }
+    }
+    return total;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchScene::setUpFormat();
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the time per frame of streams zoomed in far enough to draw their raw "
+                                      "points, and of the same views drawn from aggregated windows, along with the "
+                                      "host memory held by the cache entries drawn. Times are in milliseconds; the "
+                                      "GPU time is -1 where it can't be measured.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("log", "Log of the data to replay, recorded first if it doesn't exist.", "file", "rawpath.log"));
+    parser.addOption(QCommandLineOption("streams", "Number of streams to draw.", "count", "64"));
+    parser.addOption(QCommandLineOption("frames", "Number of frames to average over, at most 256.", "count", "200"));
+    parser.addOption(QCommandLineOption("width", "Width of the plot, in pixels.", "pixels", "1920"));
+    parser.addOption(QCommandLineOption("height", "Height of the plot, in pixels.", "pixels", "1080"));
+    parser.process(app);
+
+    QSize size(parser.value("width").toInt(), parser.value("height").toInt());
+    BenchScene scene(parser.value("log"), parser.value("streams").toInt(), size);
+    if (scene.isRecording())
+    {
+        printf("Recording %s\n", qPrintable(parser.value("log")));
+    }
+
+    PlotArea* plotarea = scene.getPlotArea();
+    int frames = parser.value("frames").toInt();
+
+    printf("%-14s %10s %10s %10s %10s %12s %12s %12s\n", "view", "frame", "sync", "render", "gpu", "vertices", "uploaded",
+           "host");
+    for (int raw = 0; raw != 2; raw++)
+    {
+        plotarea->setProperty("donotaggregate", raw != 0);
+        for (int seconds : spans)
+        {
+            if (!scene.show(SYNTHETIC_START, SYNTHETIC_START + seconds * Q_INT64_C(1000000000), RAWPATH_TIMEOUT))
+            {
+                qWarning("The plot was not drawn in time");
+                return 1;
+            }
+            for (int i = 0; i != RAWPATH_WARMUP_FRAMES; i++)
+            {
+                scene.drawFrame();
+            }
+
+            QByteArray name = QByteArray::number(seconds) + (raw ? " s raw" : " s aggregate");
+            QVariantMap result = scene.measureFrames(frames);
+            printf("%-14s %10.3f %10.3f %10.3f %10.3f %12.0f %12.0f %12.0f\n", name.constData(),
+                   result.value("frameTime").toDouble(), result.value("syncTime").toDouble(),
+                   result.value("renderTime").toDouble(), result.value("gpuTime").toDouble(),
+                   result.value("vertices").toDouble(), result.value("uploadedBytes").toDouble(),
+                   hostBytes(scene.getStreams()));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+# Measures the time per frame of streams zoomed in far enough that their
+# raw points are drawn, against the same view drawn from aggregates.
+
+TEMPLATE = app
+TARGET = rawpath
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+include(../common/common.pri)
+
+SOURCES += main.cpp
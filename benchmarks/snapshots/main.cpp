@@ -0,0 +1,111 @@
+#include "benchscene.h"
+#include "snapshotrenderer.h"
+#include "syntheticdatasource.h"
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QGuiApplication>
+#include <QImage>
+#include <QObject>
+#include <QTimer>
+
+/* How long to wait for the data to be drawn, and for the snapshots, in
+ * milliseconds.
+ */
+#define SNAPSHOTS_TIMEOUT 60000
+
+struct snapshotsetting
+{
+    const char* name;
+    int samples;
+};
+
+static const struct snapshotsetting settings[] = {
+    { "none", 0 },
+    { "msaa 4x", 4 }
+};
+
+int main(int argc, char* argv[])
+{
+    /* Snapshots draw from the same VBOs as the Plot Area, so their
+     * contexts must share, and both must draw on the GUI thread.
+     */
+    BenchScene::setUpFormat();
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+    qputenv("QSG_RENDER_LOOP", "basic");
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures how many snapshots of the streams shown in a Plot Area are drawn per "
+                                      "second, at each antialiasing setting, once their data has been fetched.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("log", "Log of the data to replay, recorded first if it doesn't exist.", "file", "snapshots.log"));
+    parser.addOption(QCommandLineOption("streams", "Number of streams to draw.", "count", "8"));
+    parser.addOption(QCommandLineOption("snapshots", "Number of snapshots to queue for each setting.", "count", "200"));
+    parser.addOption(QCommandLineOption("width", "Width of the snapshots, in pixels.", "pixels", "1920"));
+    parser.addOption(QCommandLineOption("height", "Height of the snapshots, in pixels.", "pixels", "1080"));
+    parser.process(app);
+
+    QSize size(parser.value("width").toInt(), parser.value("height").toInt());
+    BenchScene scene(parser.value("log"), parser.value("streams").toInt(), size);
+    if (scene.isRecording())
+    {
+        printf("Recording %s\n", qPrintable(parser.value("log")));
+    }
+
+    /* Showing the plot first fetches the data, so that the snapshots find
+     * it in the cache.
+     */
+    int64_t start = SYNTHETIC_START;
+    int64_t end = SYNTHETIC_START + Q_INT64_C(3600000000000);
+    if (!scene.show(start, end, SNAPSHOTS_TIMEOUT))
+    {
+        qWarning("The plot was not drawn in time");
+        return 1;
+    }
+
+    int count = qMax(parser.value("snapshots").toInt(), 1);
+
+    printf("%-10s %10s %10s %12s\n", "setting", "drawn", "failed", "renders/s");
+    for (const struct snapshotsetting& setting : settings)
+    {
+        SnapshotRenderer snapshots;
+        snapshots.setMsaaSamples(setting.samples);
+
+        int ready = 0;
+        int failed = 0;
+        QEventLoop loop;
+        QObject::connect(&snapshots, &SnapshotRenderer::snapshotReady, &loop,
+                         [&loop, &ready, &failed, count](int id, QImage image)
+        {
+            Q_UNUSED(id);
+            if (image.isNull())
+            {
+                failed++;
+            }
+            if (++ready == count)
+            {
+                loop.quit();
+            }
+        });
+        QTimer::singleShot(SNAPSHOTS_TIMEOUT, &loop, &QEventLoop::quit);
+
+        for (int i = 0; i != count; i++)
+        {
+            snapshots.enqueue(scene.getStreams(), start, end, size);
+        }
+        loop.exec();
+
+        if (ready != count)
+        {
+            qWarning("The snapshots were not drawn in time");
+            return 1;
+        }
+        printf("%-10s %10d %10d %12.1f\n", setting.name, snapshots.getRendered(), failed,
+               snapshots.getRendersPerSecond());
+    }
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+# Measures how many snapshots of the streams of a Plot Area are drawn per
+# second, once their data is in the cache.
+
+TEMPLATE = app
+TARGET = snapshots
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+include(../common/common.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,40 @@
+#ifndef BTRDBAPI_H
+#define BTRDBAPI_H
+
+#include <btrdb.grpc.pb.h>
+#include <btrdb.pb.h>
+#include <btrdbv5.grpc.pb.h>
+#include <btrdbv5.pb.h>
+
+/* The generated types of each version of the BTrDB gRPC API. The messages
+ * are the same in both, but they are in different packages, and a server
+ * only answers to the one it implements, so the code that makes the calls
+ * is written once against these.
+ */
+struct btrdbv4
+{
+    typedef v4::BTrDB BTrDB;
+    typedef v4::AlignedWindowsParams AlignedWindowsParams;
+    typedef v4::AlignedWindowsResponse AlignedWindowsResponse;
+    typedef v4::NearestParams NearestParams;
+    typedef v4::NearestResponse NearestResponse;
+    typedef v4::ChangesParams ChangesParams;
+    typedef v4::ChangesResponse ChangesResponse;
+    typedef v4::StatPoint StatPoint;
+    typedef v4::ChangedRange ChangedRange;
+};
+
+struct btrdbv5
+{
+    typedef v5api::BTrDB BTrDB;
+    typedef v5api::AlignedWindowsParams AlignedWindowsParams;
+    typedef v5api::AlignedWindowsResponse AlignedWindowsResponse;
+    typedef v5api::NearestParams NearestParams;
+    typedef v5api::NearestResponse NearestResponse;
+    typedef v5api::ChangesParams ChangesParams;
+    typedef v5api::ChangesResponse ChangesResponse;
+    typedef v5api::StatPoint StatPoint;
+    typedef v5api::ChangedRange ChangedRange;
+};
+
+#endif // BTRDBAPI_H
@@ -0,0 +1,456 @@
+#include "btrdbapi.h"
+#include "btrdbdatasource.h"
+#include "requester.h"
+
+#include <grpc++/grpc++.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUuid>
+
+/* The range of valid timestamps in BTrDB. */
+#define BTRDB_MIN_TIME ((int64_t) -(Q_INT64_C(16) << 56))
+#define BTRDB_MAX_TIME ((int64_t) (Q_INT64_C(48) << 56))
+
+/* Upper bound on the number of windows we reserve space for up front. */
+#define BTRDB_MAX_RESERVE (1 << 20)
+
+QHash<QString, struct btrdbpool> BTrDBDataSource::pools;
+QMutex BTrDBDataSource::poolsLock;
+QThreadPool* BTrDBDataSource::workers = nullptr;
+
+class GrpcCall : public QRunnable
+{
+public:
+    GrpcCall(std::function<void()> work) : work(work) {}
+
+    void run() override
+    {
+        this->work();
+    }
+
+private:
+    std::function<void()> work;
+};
+
+std::string uuidToBytes(const QUuid& uuid)
+{
+    QByteArray bytes = uuid.toRfc4122();
+    return std::string(bytes.constData(), bytes.size());
+}
+
+/* Gives CONTEXT a deadline TIMEOUT milliseconds from now. */
+void setDeadline(grpc::ClientContext& context, int timeout)
+{
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(timeout));
+}
+
+BTrDBDataSource::BTrDBDataSource(QObject* parent) : DataSource(parent),
+    poolsize(BTRDB_DEFAULT_POOL_SIZE), apiversion(BTRDB_DEFAULT_API_VERSION),
+    timeout(BTRDB_DEFAULT_TIMEOUT)
+{
+}
+
+QString BTrDBDataSource::getEndpoint() const
+{
+    return this->endpoint;
+}
+
+void BTrDBDataSource::setEndpoint(QString newendpoint)
+{
+    this->endpoint = newendpoint;
+}
+
+int BTrDBDataSource::getApiVersion() const
+{
+    return this->apiversion;
+}
+
+void BTrDBDataSource::setApiVersion(int version)
+{
+    if (version != 4 && version != 5)
+    {
+        qWarning("Invalid BTrDB API version %d: must be 4 or 5", version);
+        return;
+    }
+    this->apiversion = version;
+}
+
+int BTrDBDataSource::getTimeout() const
+{
+    return this->timeout;
+}
+
+void BTrDBDataSource::setTimeout(int milliseconds)
+{
+    if (milliseconds <= 0)
+    {
+        qWarning("Invalid BTrDB timeout %d: must be positive", milliseconds);
+        return;
+    }
+    this->timeout = milliseconds;
+}
+
+std::shared_ptr<grpc::Channel> BTrDBDataSource::getChannel()
+{
+    QMutexLocker locker(&BTrDBDataSource::poolsLock);
+
+    struct btrdbpool& pool = BTrDBDataSource::pools[this->endpoint];
+    if (pool.channels.isEmpty())
+    {
+        pool.next = 0;
+    }
+
+    /* Open connections lazily, up to the size of the pool. */
+    if (pool.channels.size() < qMax(this->poolsize, 1))
+    {
+        pool.channels.append(grpc::CreateChannel(this->endpoint.toStdString(), grpc::InsecureChannelCredentials()));
+        return pool.channels.last();
+    }
+
+    return pool.channels.at(pool.next++ % pool.channels.size());
+}
+
+void BTrDBDataSource::runAsync(std::function<void()> work)
+{
+    if (BTrDBDataSource::workers == nullptr)
+    {
+        BTrDBDataSource::workers = new QThreadPool(QCoreApplication::instance());
+        BTrDBDataSource::workers->setMaxThreadCount(BTRDB_MAX_THREADS);
+    }
+    BTrDBDataSource::workers->start(new GrpcCall(work));
+}
+
+void BTrDBDataSource::runOnMainThread(std::function<void()> work)
+{
+    QMetaObject::invokeMethod(QCoreApplication::instance(), work, Qt::QueuedConnection);
+}
+
+/* Makes an AlignedWindows call, and passes the windows to CALLBACK on the
+ * main thread. Runs on a worker thread.
+ */
+template <typename API>
+void callAlignedWindows(std::shared_ptr<grpc::Channel> channel, const std::string& uuidbytes, int64_t start, int64_t end,
+                        uint8_t pwe, uint64_t expected, int timeout, ReqCallback callback)
+{
+    std::unique_ptr<typename API::BTrDB::Stub> stub = API::BTrDB::NewStub(channel);
+
+    typename API::AlignedWindowsParams params;
+    params.set_uuid(uuidbytes);
+    params.set_start(start);
+    params.set_end(end);
+    params.set_versionmajor(0);
+    params.set_pointwidth(pwe);
+
+    grpc::ClientContext context;
+    setDeadline(context, timeout);
+    std::unique_ptr<grpc::ClientReader<typename API::AlignedWindowsResponse>> reader(stub->AlignedWindows(&context, params));
+
+    /* Decode each chunk into the result as soon as it arrives, rather
+     * than buffering the whole response.
+     */
+    QSharedPointer<std::vector<struct statpt>> points(new std::vector<struct statpt>);
+    points->reserve(expected);
+    uint64_t generation = GENERATION_MAX;
+    bool error = false;
+
+    typename API::AlignedWindowsResponse response;
+    while (reader->Read(&response))
+    {
+        if (response.stat().code() != 0)
+        {
+            qDebug("Got an error: %s", response.stat().msg().c_str());
+            error = true;
+            break;
+        }
+        generation = response.versionmajor();
+
+        int numvalues = response.values_size();
+        for (int i = 0; i != numvalues; i++)
+        {
+            const typename API::StatPoint& value = response.values(i);
+            struct statpt pt;
+            pt.time = value.time();
+            pt.min = value.min();
+            pt.mean = value.mean();
+            pt.max = value.max();
+            pt.count = value.count();
+            points->push_back(pt);
+        }
+    }
+
+    if (error)
+    {
+        /* Stop the server from sending the rest. */
+        context.TryCancel();
+    }
+
+    grpc::Status status = reader->Finish();
+    if (!error && !status.ok())
+    {
+        qDebug("AlignedWindows failed: %s", status.error_message().c_str());
+        error = true;
+    }
+
+    if (error || points->empty())
+    {
+        points->clear();
+        generation = GENERATION_MAX;
+    }
+
+    BTrDBDataSource::runOnMainThread([points, generation, callback]()
+    {
+        callback(points->data(), (int) points->size(), generation);
+    });
+}
+
+void BTrDBDataSource::alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback)
+{
+    if (start >= BTRDB_MAX_TIME || end < BTRDB_MIN_TIME)
+    {
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(nullptr, 0, GENERATION_MAX);
+        });
+        return;
+    }
+
+    /* The gRPC API treats the end as exclusive, but our interface treats it
+     * as inclusive (after rounding down to the pointwidth), so we move the
+     * end to the start of the following window.
+     */
+    int64_t pw = Q_INT64_C(1) << pwe;
+    int64_t pwmask = ~(pw - 1);
+    start = qMax(start, BTRDB_MIN_TIME);
+    end = qMin(end & pwmask, BTRDB_MAX_TIME - pw) + pw;
+
+    std::shared_ptr<grpc::Channel> channel = this->getChannel();
+    std::string uuidbytes = uuidToBytes(uuid);
+    uint64_t expected = qMin(((uint64_t) (end - start)) >> pwe, (uint64_t) BTRDB_MAX_RESERVE);
+    int timeout = this->timeout;
+
+    if (this->apiversion == 5)
+    {
+        BTrDBDataSource::runAsync([channel, uuidbytes, start, end, pwe, expected, timeout, callback]()
+        {
+            callAlignedWindows<btrdbv5>(channel, uuidbytes, start, end, pwe, expected, timeout, callback);
+        });
+    }
+    else
+    {
+        BTrDBDataSource::runAsync([channel, uuidbytes, start, end, pwe, expected, timeout, callback]()
+        {
+            callAlignedWindows<btrdbv4>(channel, uuidbytes, start, end, pwe, expected, timeout, callback);
+        });
+    }
+}
+
+struct nearestate
+{
+    BracketCallback callback;
+    QHash<QUuid, struct brackets> brackets;
+    int reqsleft;
+};
+
+/* Finds the time of the point nearest to TIME, in the direction given by
+ * BACKWARD. Returns false if there is no such point, or the call failed.
+ */
+template <typename API>
+bool callNearest(typename API::BTrDB::Stub* stub, const std::string& uuidbytes, int64_t time, bool backward,
+                 int timeout, int64_t* result)
+{
+    typename API::NearestParams params;
+    params.set_uuid(uuidbytes);
+    params.set_time(time);
+    params.set_versionmajor(0);
+    params.set_backward(backward);
+
+    grpc::ClientContext context;
+    setDeadline(context, timeout);
+    typename API::NearestResponse response;
+    grpc::Status status = stub->Nearest(&context, params, &response);
+    if (!status.ok() || response.stat().code() != 0)
+    {
+        return false;
+    }
+
+    *result = response.value().time();
+    return true;
+}
+
+/* Finds the brackets of the stream, and passes them to STATE on the main
+ * thread. Runs on a worker thread.
+ */
+template <typename API>
+void callBrackets(std::shared_ptr<grpc::Channel> channel, const QUuid& uuid, const std::string& uuidbytes, int timeout,
+                  QSharedPointer<struct nearestate> state)
+{
+    std::unique_ptr<typename API::BTrDB::Stub> stub = API::BTrDB::NewStub(channel);
+
+    struct brackets brkts;
+    bool haslower = callNearest<API>(stub.get(), uuidbytes, BTRDB_MIN_TIME, false, timeout, &brkts.lowerbound);
+    bool hasupper = haslower && callNearest<API>(stub.get(), uuidbytes, BTRDB_MAX_TIME, true, timeout, &brkts.upperbound);
+
+    BTrDBDataSource::runOnMainThread([uuid, brkts, haslower, hasupper, state]()
+    {
+        /* Streams with no data are left out, as the BOSSWAVE source does. */
+        if (haslower && hasupper)
+        {
+            state->brackets.insert(uuid, brkts);
+        }
+        if (--state->reqsleft == 0)
+        {
+            state->callback(state->brackets);
+        }
+    });
+}
+
+void BTrDBDataSource::brackets(const QList<QUuid> uuids, BracketCallback callback)
+{
+    if (uuids.isEmpty())
+    {
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(QHash<QUuid, struct brackets>());
+        });
+        return;
+    }
+
+    /* Only touched on the main thread. */
+    QSharedPointer<struct nearestate> state(new struct nearestate);
+    state->callback = callback;
+    state->reqsleft = uuids.size();
+
+    int timeout = this->timeout;
+    for (auto i = uuids.begin(); i != uuids.end(); i++)
+    {
+        QUuid uuid = *i;
+        std::shared_ptr<grpc::Channel> channel = this->getChannel();
+        std::string uuidbytes = uuidToBytes(uuid);
+
+        if (this->apiversion == 5)
+        {
+            BTrDBDataSource::runAsync([channel, uuid, uuidbytes, timeout, state]()
+            {
+                callBrackets<btrdbv5>(channel, uuid, uuidbytes, timeout, state);
+            });
+        }
+        else
+        {
+            BTrDBDataSource::runAsync([channel, uuid, uuidbytes, timeout, state]()
+            {
+                callBrackets<btrdbv4>(channel, uuid, uuidbytes, timeout, state);
+            });
+        }
+    }
+}
+
+/* Makes a Changes call, and passes the changed ranges to CALLBACK on the
+ * main thread. Runs on a worker thread.
+ */
+template <typename API>
+void callChanges(std::shared_ptr<grpc::Channel> channel, const std::string& uuidbytes, uint64_t fromGen, uint64_t toGen,
+                 uint8_t pwe, int timeout, ChangedRangesCallback callback)
+{
+    std::unique_ptr<typename API::BTrDB::Stub> stub = API::BTrDB::NewStub(channel);
+
+    /* A "to" generation of zero means the latest version, in both
+     * our interface and the gRPC API.
+     */
+    typename API::ChangesParams params;
+    params.set_uuid(uuidbytes);
+    params.set_frommajor(fromGen);
+    params.set_tomajor(toGen);
+    params.set_resolution(pwe);
+
+    grpc::ClientContext context;
+    setDeadline(context, timeout);
+    std::unique_ptr<grpc::ClientReader<typename API::ChangesResponse>> reader(stub->Changes(&context, params));
+
+    QSharedPointer<std::vector<struct timerange>> changed(new std::vector<struct timerange>);
+    uint64_t generation = GENERATION_MAX;
+    bool error = false;
+
+    typename API::ChangesResponse response;
+    while (reader->Read(&response))
+    {
+        if (response.stat().code() != 0)
+        {
+            qDebug("Got an error: %s", response.stat().msg().c_str());
+            error = true;
+            break;
+        }
+        generation = response.versionmajor();
+
+        int numranges = response.ranges_size();
+        for (int i = 0; i != numranges; i++)
+        {
+            const typename API::ChangedRange& range = response.ranges(i);
+
+            /* The gRPC API gives exclusive ends; ours are inclusive. */
+            struct timerange rng;
+            rng.start = range.start();
+            rng.end = range.end() - 1;
+            changed->push_back(rng);
+        }
+    }
+
+    if (error)
+    {
+        context.TryCancel();
+    }
+
+    grpc::Status status = reader->Finish();
+    if (!error && !status.ok())
+    {
+        qDebug("Changes failed: %s", status.error_message().c_str());
+        error = true;
+    }
+
+    if (error)
+    {
+        changed->clear();
+        generation = GENERATION_MAX;
+    }
+    else if (generation == GENERATION_MAX)
+    {
+        /* The server sent nothing, so nothing has changed since FROMGEN. */
+        generation = fromGen;
+    }
+
+    BTrDBDataSource::runOnMainThread([changed, generation, callback]()
+    {
+        callback(changed->data(), (int) changed->size(), generation);
+    });
+}
+
+void BTrDBDataSource::changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback)
+{
+    std::shared_ptr<grpc::Channel> channel = this->getChannel();
+    std::string uuidbytes = uuidToBytes(uuid);
+    int timeout = this->timeout;
+
+    if (this->apiversion == 5)
+    {
+        BTrDBDataSource::runAsync([channel, uuidbytes, fromGen, toGen, pwe, timeout, callback]()
+        {
+            callChanges<btrdbv5>(channel, uuidbytes, fromGen, toGen, pwe, timeout, callback);
+        });
+    }
+    else
+    {
+        BTrDBDataSource::runAsync([channel, uuidbytes, fromGen, toGen, pwe, timeout, callback]()
+        {
+            callChanges<btrdbv4>(channel, uuidbytes, fromGen, toGen, pwe, timeout, callback);
+        });
+    }
+}
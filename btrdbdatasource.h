@@ -0,0 +1,108 @@
+#ifndef BTRDBDATASOURCE_H
+#define BTRDBDATASOURCE_H
+
+#include <functional>
+#include <memory>
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include "datasource.h"
+
+/* Number of gRPC channels opened to each BTrDB endpoint. */
+#define BTRDB_DEFAULT_POOL_SIZE 4
+
+/* The version of the BTrDB API spoken, unless set otherwise. */
+#define BTRDB_DEFAULT_API_VERSION 4
+
+/* How long, in milliseconds, each call may take before it is abandoned,
+ * unless set otherwise.
+ */
+#define BTRDB_DEFAULT_TIMEOUT 30000
+
+/* The number of worker threads that make the calls, shared by all BTrDB
+ * data sources. The calls block, so they get threads of their own rather
+ * than the global thread pool.
+ */
+#define BTRDB_MAX_THREADS 8
+
+class QThreadPool;
+
+namespace grpc
+{
+    class Channel;
+}
+
+/* The connections to one BTrDB endpoint. Shared by all data sources that
+ * talk to that endpoint.
+ */
+struct btrdbpool
+{
+    QVector<std::shared_ptr<grpc::Channel>> channels;
+    unsigned int next;
+};
+
+/* A Data Source that talks to BTrDB directly over gRPC, rather than going
+ * through a BOSSWAVE archiver. Each query runs on a worker thread, and the
+ * callback is invoked on the main thread once the response is complete.
+ * If a call fails or times out, the callback gets no data, as it would if
+ * the stream had none.
+ */
+class BTrDBDataSource : public DataSource
+{
+    Q_OBJECT
+    Q_PROPERTY(QString endpoint READ getEndpoint WRITE setEndpoint)
+    Q_PROPERTY(int poolSize MEMBER poolsize)
+    Q_PROPERTY(int apiVersion READ getApiVersion WRITE setApiVersion)
+    Q_PROPERTY(int timeout READ getTimeout WRITE setTimeout)
+
+public:
+    explicit BTrDBDataSource(QObject* parent = nullptr);
+
+    QString getEndpoint() const;
+    void setEndpoint(QString newendpoint);
+
+    /* The major version of BTrDB running at the endpoint. Must be 4 or 5. */
+    int getApiVersion() const;
+    void setApiVersion(int version);
+
+    /* The deadline of each call, in milliseconds. Must be positive. */
+    int getTimeout() const;
+    void setTimeout(int milliseconds);
+
+    void alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback) override;
+    void brackets(const QList<QUuid> uuids, BracketCallback callback) override;
+    void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback) override;
+
+    /* Runs WORK on the main thread. Used by the worker threads to hand
+     * back their results.
+     */
+    static void runOnMainThread(std::function<void()> work);
+
+signals:
+
+public slots:
+
+private:
+    /* Returns a channel to the endpoint, chosen round-robin from the pool. */
+    std::shared_ptr<grpc::Channel> getChannel();
+
+    /* Runs WORK on one of the worker threads. */
+    static void runAsync(std::function<void()> work);
+
+    QString endpoint;
+    int poolsize;
+    int apiversion;
+    int timeout;
+
+    static QHash<QString, struct btrdbpool> pools;
+    static QMutex poolsLock;
+
+    /* Created on first use, and only touched on the main thread. */
+    static QThreadPool* workers;
+};
+
+#endif // BTRDBDATASOURCE_H
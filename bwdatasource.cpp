@@ -10,6 +10,7 @@ const QString URI_TEMPLATE = QStringLiteral("%1/%2");
 #define BTRDB_MAX ((int64_t) ((Q_INT64_C(48) << 56) - Q_INT64_C(1)))
 
 #define QUERY_TEMPLATE QStringLiteral("select statistical(%1) data in (%2ns, %3ns) as ns where uuid = \"%4\";")
+#define TAIL_TEMPLATE QStringLiteral("select data after now as ns where uuid = \"%1\" subscribe;")
 #define CHANGED_RANGES_TEMPLATE QStringLiteral("select changed(%2, %1, %3) data where uuid = \"%4\";")
 
 BWDataSource::BWDataSource(QObject *parent) : DataSource(parent)
@@ -136,8 +137,86 @@ void BWDataSource::changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t t
     QString uuidstr = uuid.toString();
     query = query.arg(fromGen).arg(toGen).arg(pwe).arg(uuidstr.mid(1, uuidstr.size() - 2));
 
+    struct crqstate crqs;
+    crqs.callback = callback;
+    crqs.fromGen = fromGen;
+
     uint32_t nonce = this->publishQuery(query);
-    this->outstandingChangedRangesReqs.insert(nonce, callback);
+    this->outstandingChangedRangesReqs.insert(nonce, crqs);
+}
+
+bool BWDataSource::tail(const QUuid& uuid, TailCallback callback)
+{
+    if (this->uri.isEmpty())
+    {
+        return false;
+    }
+
+    this->untail(uuid);
+
+    /* New data arrives over the existing subscription to the signal
+     * URI, tagged with the nonce of this query.
+     */
+    QString query = TAIL_TEMPLATE;
+    QString uuidstr = uuid.toString();
+    query = query.arg(uuidstr.mid(1, uuidstr.size() - 2));
+
+    struct bwtail tail;
+    tail.uuid = uuid;
+    tail.callback = callback;
+    this->tailing.insert(this->publishQuery(query), tail);
+    return true;
+}
+
+void BWDataSource::untail(const QUuid& uuid)
+{
+    for (auto i = this->tailing.begin(); i != this->tailing.end(); i++)
+    {
+        if (i->uuid == uuid)
+        {
+            this->tailing.erase(i);
+            return;
+        }
+    }
+}
+
+struct crbstate
+{
+    BatchChangedRangesCallback callback;
+    QHash<QUuid, uint64_t> fromGens;
+};
+
+void BWDataSource::changedRangesBatch(const QHash<QUuid, uint64_t> fromGens, uint64_t toGen, uint8_t pwe, BatchChangedRangesCallback callback)
+{
+    if (fromGens.size() <= 1)
+    {
+        DataSource::changedRangesBatch(fromGens, toGen, pwe, callback);
+        return;
+    }
+
+    /* A single query has a single starting generation, so use the oldest.
+     * Streams that are more up to date may get back some ranges that they
+     * have already seen, which is harmless.
+     */
+    uint64_t fromGen = GENERATION_MAX;
+    QStringList uuidstrs;
+    for (auto i = fromGens.begin(); i != fromGens.end(); i++)
+    {
+        QString uuidstr = i.key().toString();
+        uuidstrs.append(uuidstr.mid(1, uuidstr.length() - 2));
+        fromGen = qMin(fromGen, i.value());
+    }
+    QString uuidliststr = uuidstrs.join(QStringLiteral("\" or uuid = \""));
+
+    QString query = CHANGED_RANGES_TEMPLATE;
+    query = query.arg(fromGen).arg(toGen).arg(pwe).arg(uuidliststr);
+
+    uint32_t nonce = this->publishQuery(query);
+
+    struct crbstate* crbs = new struct crbstate;
+    crbs->callback = callback;
+    crbs->fromGens = fromGens;
+    this->outstandingChangedRangesBatches.insert(nonce, crbs);
 }
 
 uint32_t BWDataSource::publishQuery(QString query) {
@@ -289,6 +368,12 @@ void BWDataSource::handleResponse(PMessage message)
                 numremoved = this->outstandingChangedRangesReqs.remove(nonce);
                 Q_ASSERT(numremoved == 1);
             }
+            else if (this->outstandingChangedRangesBatches.contains(nonce))
+            {
+                this->handleChangedRangesBatchResponse(this->outstandingChangedRangesBatches[nonce], response, error);
+                numremoved = this->outstandingChangedRangesBatches.remove(nonce);
+                Q_ASSERT(numremoved == 1);
+            }
         }
         else if (type == ResponseType::DATA_RESPONSE)
         {
@@ -310,6 +395,12 @@ void BWDataSource::handleResponse(PMessage message)
                 numremoved = this->outstandingBracketRight.remove(nonce);
                 Q_ASSERT(numremoved == 1);
             }
+            else if (!error && this->tailing.contains(nonce))
+            {
+                /* Copy the tail, in case the callback untails the stream. */
+                struct bwtail tail = this->tailing[nonce];
+                this->handleTailResponse(tail, response);
+            }
         }
     }
 }
@@ -446,7 +537,7 @@ void BWDataSource::handleBracketResponse(struct brqstate* brqs, QVariantMap resp
     }
 }
 
-void BWDataSource::handleChangedRangesResponse(ChangedRangesCallback callback, QVariantMap response, bool error)
+void BWDataSource::handleChangedRangesResponse(const struct crqstate& crqs, QVariantMap response, bool error)
 {
     QVariantList changedRangesList;
 
@@ -464,8 +555,11 @@ void BWDataSource::handleChangedRangesResponse(ChangedRangesCallback callback, Q
     len = changedRangesList.length();
     if (len == 0)
     {
-        /* No data to return. */
-        goto nodata;
+        /* Nothing has changed, so the stream is still as of the
+         * generation we asked from.
+         */
+        crqs.callback(nullptr, 0, crqs.fromGen);
+        return;
     }
 
     generation = changedRangesList.at(0).toMap()["Generation"].toULongLong();
@@ -479,12 +573,88 @@ void BWDataSource::handleChangedRangesResponse(ChangedRangesCallback callback, Q
         rng->end = changedRange["EndTime"].toLongLong();
     }
 
-    callback(changed, len, generation);
+    crqs.callback(changed, len, generation);
     delete[] changed;
 
     return;
 
 nodata:
     /* Return no data. */
-    callback(nullptr, 0, GENERATION_MAX);
+    crqs.callback(nullptr, 0, GENERATION_MAX);
+}
+
+void BWDataSource::handleChangedRangesBatchResponse(struct crbstate* crbs, QVariantMap response, bool error)
+{
+    /* Streams that come back without changed ranges haven't changed, so
+     * they are still as of the generation they asked from.
+     */
+    QHash<QUuid, struct changedranges> result;
+    for (auto i = crbs->fromGens.begin(); i != crbs->fromGens.end(); i++)
+    {
+        result[i.key()].gen = error ? GENERATION_MAX : i.value();
+    }
+
+    if (!error)
+    {
+        QVariantList changedRangesList = response["Changed"].toList();
+        for (auto i = changedRangesList.begin(); i != changedRangesList.end(); i++)
+        {
+            const QVariantMap& changedRange = i->toMap();
+            QUuid uuid(changedRange["UUID"].toString());
+            if (!result.contains(uuid))
+            {
+                qDebug("Changed range is for an unexpected stream");
+                continue;
+            }
+
+            struct timerange rng;
+            rng.start = changedRange["StartTime"].toLongLong();
+            rng.end = changedRange["EndTime"].toLongLong();
+
+            struct changedranges& cr = result[uuid];
+            cr.ranges.append(rng);
+            cr.gen = changedRange["Generation"].toULongLong();
+        }
+    }
+
+    crbs->callback(result);
+    delete crbs;
+}
+
+void BWDataSource::handleTailResponse(const struct bwtail& tail, QVariantMap response)
+{
+    QVariantList dataList = response["Data"].toList();
+    for (auto i = dataList.begin(); i != dataList.end(); i++)
+    {
+        QVariantMap data = i->toMap();
+        QUuid uuid(data["UUID"].toString());
+        if (uuid != tail.uuid)
+        {
+            continue;
+        }
+
+        QVariantList times = data["Times"].toList();
+        QVariantList values = data["Values"].toList();
+        if (times.size() != values.size())
+        {
+            qDebug("Pushed data has mismatched times and values");
+            continue;
+        }
+
+        int len = times.size();
+        if (len == 0)
+        {
+            continue;
+        }
+
+        struct rawpt* points = new struct rawpt[len];
+        for (int j = 0; j < len; j++)
+        {
+            points[j].time = times.at(j).toLongLong();
+            points[j].value = values.at(j).toDouble();
+        }
+
+        tail.callback(points, len);
+        delete[] points;
+    }
 }
@@ -3,10 +3,26 @@
 
 #include <bosswave.h>
 
+#include <QHash>
 #include <QObject>
+#include <QUuid>
 
 #include "datasource.h"
 
+/* A changed ranges query for a single stream. */
+struct crqstate
+{
+    ChangedRangesCallback callback;
+    uint64_t fromGen;
+};
+
+/* A stream for which the archiver pushes live data. */
+struct bwtail
+{
+    QUuid uuid;
+    TailCallback callback;
+};
+
 class BWDataSource : public DataSource
 {
     Q_OBJECT
@@ -21,6 +37,11 @@ public:
     void brackets(const QList<QUuid> uuids, BracketCallback callback) override;
     void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback) override;
 
+    void changedRangesBatch(const QHash<QUuid, uint64_t> fromGens, uint64_t toGen, uint8_t pwe, BatchChangedRangesCallback callback) override;
+
+    bool tail(const QUuid& uuid, TailCallback callback) override;
+    void untail(const QUuid& uuid) override;
+
 signals:
 
 public slots:
@@ -30,7 +51,9 @@ private:
 
     void handleDataResponse(ReqCallback callback, QVariantMap response, bool error);
     void handleBracketResponse(struct brqstate* brqs, QVariantMap response, bool error, bool right);
-    void handleChangedRangesResponse(ChangedRangesCallback callback, QVariantMap response, bool error);
+    void handleChangedRangesResponse(const struct crqstate& crqs, QVariantMap response, bool error);
+    void handleChangedRangesBatchResponse(struct crbstate* crbs, QVariantMap response, bool error);
+    void handleTailResponse(const struct bwtail& tail, QVariantMap response);
 
     uint32_t publishQuery(QString query);
 
@@ -41,7 +64,14 @@ private:
     QHash<uint32_t, ReqCallback> outstandingDataReqs;
     QHash<uint32_t, struct brqstate*> outstandingBracketLeft;
     QHash<uint32_t, struct brqstate*> outstandingBracketRight;
-    QHash<uint32_t, ChangedRangesCallback> outstandingChangedRangesReqs;
+    QHash<uint32_t, struct crqstate> outstandingChangedRangesReqs;
+    QHash<uint32_t, struct crbstate*> outstandingChangedRangesBatches;
+
+    /* Streams for which data pushed over the subscription is forwarded,
+     * keyed by the nonce of the query that asked for it. Pushed data
+     * under any other nonce is dropped.
+     */
+    QHash<uint32_t, struct bwtail> tailing;
 
     BW* bw;
 };
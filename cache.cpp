@@ -1,13 +1,21 @@
 #include "cache.h"
+#include "datasource.h"
 #include "plotrenderer.h"
 #include "requester.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 
+#include <QDateTime>
 #include <QHash>
 #include <QList>
+#include <QPair>
 #include <QSharedPointer>
 #include <QTimer>
 
@@ -55,6 +63,52 @@ struct cachedpt
     float flags2;
 };
 
+/* The parts of a cached point drawn in the data density plot: two
+ * vertices, like the first and second halves of a cachedpt. Size is 16
+ * bytes.
+ */
+struct ddpt
+{
+    float reltime;
+    float prevcount;
+
+    float reltime2;
+    float count;
+};
+
+/* A point at pointwidth exponent 0, where the minimum, mean and maximum are
+ * all the same, and there is no min-max background to draw. Size is 12
+ * bytes.
+ */
+struct rawcachedpt
+{
+    float reltime;
+    float value;
+    float flags;
+};
+
+/* A decimation of a cache entry, along with what is needed to extend it
+ * when live points are appended to the entry.
+ */
+struct decimation
+{
+    QSharedPointer<CacheEntry> entry;
+
+    /* For each of the last few buckets, the index of its first point in
+     * the entry and of its first point in the decimation. Each bucket is
+     * decimated on its own, so decimating the points of the entry from
+     * one of these on gives the rest of the decimation.
+     */
+    QVector<QPair<int, int>> resume;
+
+    /* The decimated points from index CARRIEDFROM on, which is the start
+     * of the summary block of the first bucket in RESUME, so that the
+     * summary can be made again from there.
+     */
+    int carriedfrom;
+    QVector<struct rawcachedpt> carried;
+};
+
 /* The overhead cost, in cached points, of the data stored in a
  * Cache Entry.
  *
@@ -79,7 +133,26 @@ CacheEntry::CacheEntry(Cache* c, const StreamKey& sk, int64_t startRange, int64_
 
     this->cached = nullptr;
     this->cachedlen = 0;
-    this->vbo = 0;
+    this->cachedcap = 0;
+    this->summary = nullptr;
+    this->summarylen = 0;
+    this->raw = nullptr;
+    this->rawvbo = false;
+    this->lastidx = -1;
+    this->tailtime = INT64_MIN;
+    this->generation = GENERATION_MAX;
+    this->stale = false;
+    this->keephostcopy = false;
+    this->vbooffset = 0;
+    this->ddvbooffset = 0;
+    this->ddcap = 0;
+    this->sharesvbo = false;
+    this->gpulen = 0;
+    this->gpucap = 0;
+    this->dirtyfrom = 0;
+    this->vramcost = 0;
+    this->decimationcost = 0;
+    this->isdecimation = false;
 
     this->firstpt = nullptr;
     this->lastpt = nullptr;
@@ -87,6 +160,7 @@ CacheEntry::CacheEntry(Cache* c, const StreamKey& sk, int64_t startRange, int64_
     this->joinsPrev = false;
     this->joinsNext = false;
     this->prepared = false;
+    this->ddprepared = false;
 
     this->connectsToBefore = false;
     this->connectsToAfter = false;
@@ -101,9 +175,11 @@ CacheEntry::~CacheEntry()
      * the response comes back. So we can't free this memory just
      * yet.
      */
-    Q_ASSERT(this->cached != nullptr || this->evicted);
+    Q_ASSERT(this->cached != nullptr || this->summary != nullptr || this->raw != nullptr || this->evicted);
 
     delete[] this->cached;
+    delete[] this->summary;
+    delete[] this->raw;
 
     if (this->firstpt != nullptr)
     {
@@ -114,11 +190,9 @@ CacheEntry::~CacheEntry()
         delete this->lastpt;
     }
 
-    if (this->vbo != 0)
-    {
-        /* Mark the VBO for deletion. */
-        this->maincache->todelete.push_back(this->vbo);
-    }
+    /* The range in the VBO arena is freed along with the last reference
+     * to VBOREF.
+     */
 }
 
 #define FLAGS_NONE 0.0f
@@ -185,6 +259,21 @@ void fillpt(struct cachedpt* output, struct statpt* input, int64_t epoch, float
     output->flags2 = flags;
 }
 
+/* Rounds EPOCH to the nearest multiple of 2^(PWE + CACHE_EPOCH_GRID_SHIFT).
+ * Since cached times are then multiples of the pointwidth relative to the
+ * epoch, they are represented exactly as floats.
+ */
+static int64_t snapEpoch(int64_t epoch, uint8_t pwe)
+{
+    int64_t grid = Q_INT64_C(1) << qMin(pwe + CACHE_EPOCH_GRID_SHIFT, 62);
+    int64_t snapped = epoch & ~(grid - 1);
+    if (epoch - snapped >= (grid >> 1) && snapped <= INT64_MAX - grid)
+    {
+        snapped += grid;
+    }
+    return snapped;
+}
+
 /* SPOINTS should contain all statistical points where the MIDPOINT is
  * in the (closed) interval [start, end] of this cache entry.
  * If there is a point immediately to the left of and adjacent to the
@@ -224,7 +313,7 @@ void CacheEntry::cacheData(struct statpt* spoints, int len,
     if (len == 0)
     {
         /* Edge case: no data. Just draw 0 data density plot. */
-        this->epoch = (this->start >> 1) + (this->end >> 1);
+        this->epoch = snapEpoch((this->start >> 1) + (this->end >> 1), this->pwe);
         if (this->connectsToBefore && this->connectsToAfter)
         {
             /* Bridge the gap. */
@@ -258,13 +347,14 @@ void CacheEntry::cacheData(struct statpt* spoints, int len,
             this->connectsToBefore = false;
             this->connectsToAfter = false;
         }
+        this->cachedcap = this->cachedlen;
         return;
     }
 
     this->joinsPrev = (prev != nullptr && !prev->joinsNext && prev->cachedlen != 0);
     this->joinsNext = (next != nullptr && !next->joinsPrev && next->cachedlen != 0);
 
-    this->epoch = (spoints[len - 1].time >> 1) + (spoints[0].time >> 1);
+    this->epoch = snapEpoch((spoints[len - 1].time >> 1) + (spoints[0].time >> 1), this->pwe);
 
     /* NUMINPUTS is the number of inputs that we look at in the main iteration over
      * the array.
@@ -339,6 +429,9 @@ void CacheEntry::cacheData(struct statpt* spoints, int len,
     int i, j;
     int64_t exptime;
 
+    /* Index into OUTPUTS of the last point filled from the inputs. */
+    int lastfilled = -1;
+
     j = 0;
 
     if (ddstartatzero)
@@ -397,6 +490,7 @@ void CacheEntry::cacheData(struct statpt* spoints, int len,
         output = &outputs[j];
 
         fillpt(output, input, this->epoch, prevcount, (float) input->count, FLAGS_NONE);
+        lastfilled = j;
 
         prevtime = input->time;
         prevcount = output->count;
@@ -494,266 +588,2040 @@ void CacheEntry::cacheData(struct statpt* spoints, int len,
 
     Q_ASSERT(j + ddstartatzero + this->connectsToBefore <= this->cachedlen + this->connectsToBefore + ddstartatzero + this->connectsToAfter + (2 * ddendatzero));
     this->cachedlen = j + ddstartatzero + this->connectsToBefore; // The remaining were extra...
-}
+    this->cachedcap = this->cachedlen;
 
-bool CacheEntry::isPlaceholder()
-{
-    return this->cached == nullptr;
+    /* Live data can only be appended if this entry ends with its own
+     * points, followed by the padding that pulls the plot to zero.
+     */
+    if (lastfilled != -1 && !nextlast && !this->joinsNext && !this->connectsToAfter)
+    {
+        this->lastidx = lastfilled + ddstartatzero + this->connectsToBefore;
+        Q_ASSERT(this->lastidx + 4 == this->cachedlen);
+
+        /* Raw points in the last window may have arrived after it was
+         * computed, and there's no telling which, so live points are only
+         * merged from the next window on.
+         */
+        this->tailtime = this->lastpt->time + pw - 1;
+    }
 }
 
-void CacheEntry::prepare(QOpenGLFunctions* funcs)
+void CacheEntry::reserve(int needed)
 {
-    Q_ASSERT(!this->prepared);
-
-    if (this->cachedlen != 0)
+    if (needed <= this->cachedcap)
     {
-        funcs->glGenBuffers(1, &this->vbo);
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
-        funcs->glBufferData(GL_ARRAY_BUFFER, this->cachedlen * sizeof(struct cachedpt), this->cached, GL_STATIC_DRAW);
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
     }
 
-    this->prepared = true;
-}
+    int newcap = needed + CACHE_TAIL_HEADROOM;
+    struct cachedpt* newcached = new struct cachedpt[newcap];
+    memcpy(newcached, this->cached, this->cachedlen * sizeof(struct cachedpt));
 
-bool CacheEntry::isPrepared() const
-{
-    return this->prepared;
+    delete[] this->cached;
+    this->cached = newcached;
+    this->cachedcap = newcap;
 }
 
-void CacheEntry::renderPlot(QOpenGLFunctions* funcs, float yStart,
-                            float yEnd, int64_t tStart, int64_t tEnd,
-                            int64_t timeOffset,
-                            GLint axisMatUniform, GLint axisVecUniform,
-                            GLint tstripUniform, GLint opacityUniform)
+int64_t CacheEntry::appendPoints(const struct rawpt* points, int len, int64_t* skipped)
 {
-    Q_ASSERT(this->prepared);
-
-    if (this->vbo != 0)
+    *skipped = INT64_MIN;
+    if (this->lastidx == -1 || this->lastpt == nullptr)
     {
-        float matrix[9];
-        float vector[2];
-
-        /* Fill in the matrix in column-major order. */
-        matrix[0] = 2.0f / (tEnd - tStart);
-        matrix[1] = 0.0f;
-        matrix[2] = 0.0f;
-        matrix[3] = 0.0f;
-        matrix[4] = -2.0f / (yEnd - yStart);
-        matrix[5] = 0.0f;
-        matrix[6] = -1.0f;
-        matrix[7] = 1.0f;
-        matrix[8] = 1.0f;
-
-        /* Fill in the offset vector. */
-        vector[0] = (float) (tStart - epoch - timeOffset - ((Q_INT64_C(1) << pwe) >> 1));
-        vector[1] = yStart;
-
-        /* Now, given a vector <time, value>, where time is relative to
-         * epoch, first subtract the offset vector, then pad the result
-         * with a 1 and multiply by the transform matrix. The result is
-         * the screen coordinates for that point.
-         */
-        funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
-        funcs->glUniform2fv(axisVecUniform, 1, vector);
-
-        /* First, draw the min-max background. */
+        return -1;
+    }
 
-        funcs->glUniform1f(opacityUniform, 0.5);
+    int64_t pw = Q_INT64_C(1) << this->pwe;
+    int64_t pwmask = ~(pw - 1);
 
-        funcs->glUniform1i(tstripUniform, 1);
+    int oldcap = this->cachedcap;
+    int firstchanged = this->lastidx;
+    bool changed = false;
 
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
-        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) 0);
-        funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) sizeof(float));
-        funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (4 * sizeof(float)));
-        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
-        funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
-        funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    for (int i = 0; i < len; i++)
+    {
+        const struct rawpt* input = &points[i];
+        if (input->time <= this->tailtime)
+        {
+            *skipped = input->time;
+            continue;
+        }
+        if (input->time > this->end)
+        {
+            /* Later points belong to a cache entry that doesn't exist yet. */
+            break;
+        }
 
-        funcs->glDrawArrays(GL_TRIANGLE_STRIP, 0, this->cachedlen << 1);
+        int64_t wtime = input->time & pwmask;
+        struct cachedpt* last = &this->cached[this->lastidx];
 
-        /* Second, draw vertical lines for disconnected points. */
+        if (wtime == this->lastpt->time)
+        {
+            /* Fold the point into the newest window. */
+            struct statpt* window = this->lastpt;
+            window->mean = (window->mean * window->count + input->value) / (window->count + 1);
+            window->min = qMin(window->min, input->value);
+            window->max = qMax(window->max, input->value);
+            window->count++;
+
+            fillpt(last, window, this->epoch, last->prevcount, (float) window->count, last->flags);
+        }
+        else if (wtime > this->lastpt->time)
+        {
+            struct statpt window;
+            window.time = wtime;
+            window.min = input->value;
+            window.mean = input->value;
+            window.max = input->value;
+            window.count = 1;
 
-        funcs->glUniform1i(tstripUniform, 0);
+            bool gap = (wtime > this->lastpt->time + pw);
 
-        funcs->glDrawArrays(GL_LINES, 0, this->cachedlen << 1);
+            /* Room for the gap, the new point, and the padding after it. */
+            this->reserve(this->lastidx + 6);
+            last = &this->cached[this->lastidx];
 
+            float prevcount;
+            if (gap)
+            {
+                pullToZero(&this->cached[this->lastidx + 1], this->lastpt->time + pw, this->epoch, (float) this->lastpt->count, this->lastpt, &window);
+                this->lastidx++;
+                prevcount = 0.0f;
+            }
+            else
+            {
+                /* The previous point is no longer followed by a gap. */
+                if (last->flags == FLAGS_LONEPT)
+                {
+                    last->flags = FLAGS_NONE;
+                    last->flags2 = FLAGS_NONE;
+                }
+                prevcount = (float) this->lastpt->count;
+            }
 
-        /* Third, draw the mean line. */
+            this->lastidx++;
+            fillpt(&this->cached[this->lastidx], &window, this->epoch, prevcount, 1.0f, FLAGS_NONE);
+            *this->lastpt = window;
+        }
+        else
+        {
+            /* Out of order; the changed ranges query will pick it up. */
+            *skipped = input->time;
+            continue;
+        }
 
-        funcs->glUniform1f(opacityUniform, 1.0);
+        this->tailtime = input->time;
+        changed = true;
+    }
 
-        funcs->glUniform1i(tstripUniform, 1);
+    if (!changed)
+    {
+        return 0;
+    }
 
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
-        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, sizeof(struct cachedpt), (const void*) 0);
-        funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, sizeof(struct cachedpt), (const void*) (3 * sizeof(float)));
-        funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, sizeof(struct cachedpt), (const void*) (4 * sizeof(float)));
-        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
-        funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
-        funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    /* Rewrite the padding after the last point, as cacheData does. */
+    struct cachedpt* last = &this->cached[this->lastidx];
+    float prevflags = (this->lastidx == 0) ? FLAGS_NONE : this->cached[this->lastidx - 1].flags;
+    if (last->flags == FLAGS_NONE && (prevflags == FLAGS_GAP || prevflags == FLAGS_ALWAYS_HIDE))
+    {
+        last->flags = FLAGS_LONEPT;
+        last->flags2 = FLAGS_LONEPT;
+    }
 
-        funcs->glDrawArrays(GL_LINE_STRIP, 0, this->cachedlen);
+    int64_t pw2 = this->lastpt->time + pw;
+    pullToZeroNoInterp(&this->cached[this->lastidx + 1], pw2, this->epoch, (float) this->lastpt->count);
+    pullToZeroNoInterp(&this->cached[this->lastidx + 2], pw2 + pw, this->epoch, 0.0f);
+    pullToZeroNoInterp(&this->cached[this->lastidx + 3], this->end + 1, this->epoch, 0.0f);
 
+    this->cachedlen = this->lastidx + 4;
+    this->dirtyfrom = qMin(this->dirtyfrom, firstchanged);
 
-        /* Fourth, draw the points. */
+    int64_t grown = ((int64_t) (this->cachedcap - oldcap)) * CACHED_POINT_SIZE;
+    this->cost += grown;
+    return grown;
+}
 
-        funcs->glUniform1i(tstripUniform, 0);
+/* The time of the window that PT was drawn for, where PW is the width of
+ * the windows. The position of PT is a float relative to the epoch, so it
+ * is rounded to the nearest window; an entry spans far fewer than 2^23
+ * windows, so the float is always within half a window of the true time.
+ */
+static int64_t cachedptTime(const struct cachedpt& pt, int64_t epoch, int64_t pw)
+{
+    int64_t approx = epoch + (int64_t) std::llround(pt.reltime);
+    return (approx + (pw >> 1)) & ~(pw - 1);
+}
 
-        funcs->glDrawArrays(GL_POINTS, 0, this->cachedlen);
-    }
+/* Recovers a statistical point from the point drawn for it. */
+static void unfillpt(struct statpt* output, const struct cachedpt* input, int64_t epoch, int64_t pw)
+{
+    output->time = cachedptTime(*input, epoch, pw);
+    output->min = input->min;
+    output->mean = input->mean;
+    output->max = input->max;
+    output->count = (uint64_t) input->truecount;
 }
 
-void CacheEntry::renderDDPlot(QOpenGLFunctions* funcs, float yStart,
-                              float yEnd, int64_t tStart, int64_t tEnd,
-                              int64_t timeOffset,
-                              GLint axisMatUniform, GLint axisVecUniform)
+static bool isRealPoint(const struct cachedpt& pt)
 {
-    Q_ASSERT(this->prepared);
+    return pt.flags == FLAGS_NONE || pt.flags == FLAGS_LONEPT;
+}
 
-    if (this->vbo != 0)
-    {
-        float matrix[9];
-        float vector[2];
+static bool isRealPoint(const struct rawcachedpt& pt)
+{
+    return pt.flags == FLAGS_NONE || pt.flags == FLAGS_LONEPT;
+}
 
-        /* Fill in the matrix in column-major order. */
-        matrix[0] = 2.0f / (tEnd - tStart);
-        matrix[1] = 0.0f;
-        matrix[2] = 0.0f;
-        matrix[3] = 0.0f;
-        matrix[4] = -2.0f / (yEnd - yStart);
-        matrix[5] = 0.0f;
-        matrix[6] = -1.0f;
-        matrix[7] = 1.0f;
-        matrix[8] = 1.0f;
+static void toRaw(struct rawcachedpt* output, const struct cachedpt* input)
+{
+    output->reltime = input->reltime;
+    output->value = input->mean;
+    output->flags = input->flags;
+}
 
-        /* Fill in the offset vector. */
-        vector[0] = (float) (tStart - epoch - timeOffset) + (Q_INT64_C(1) << pwe) / 2.0f;
-        vector[1] = yStart;
+/* The counts are only approximate, since raw points don't keep them. */
+static void fromRaw(struct cachedpt* output, const struct rawcachedpt* input)
+{
+    output->reltime = input->reltime;
+    output->min = input->value;
+    output->prevcount = 0.0f;
+    output->mean = input->value;
 
-        /* Now, given a vector <time, value>, where time is relative to
-         * epoch, first subtract the offset vector, then pad the result
-         * with a 1 and multiply by the transform matrix. The result is
-         * the screen coordinates for that point.
-         */
-        funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
-        funcs->glUniform2fv(axisVecUniform, 1, vector);
+    output->flags = input->flags;
 
-        /* Draw the data density plot. */
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
-        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (0 + this->connectsToBefore * sizeof(struct cachedpt)));
-        funcs->glVertexAttribPointer(COUNT_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (2 * sizeof(float) + this->connectsToBefore * sizeof(struct cachedpt)));
-        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
-        funcs->glEnableVertexAttribArray(COUNT_ATTR_LOC);
-        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    output->reltime2 = input->reltime;
+    output->max = input->value;
+    output->count = isRealPoint(*input) ? 1.0f : 0.0f;
+    output->truecount = output->count;
 
-        funcs->glDrawArrays(GL_LINE_STRIP, 0, (this->cachedlen - this->connectsToBefore - this->connectsToAfter) << 1);
-    }
+    output->flags2 = input->flags;
 }
 
-void CacheEntry::getRange(int64_t starttime, int64_t endtime, bool count, float& minimum, float& maximum)
+static bool cachedptTimeLess(const struct cachedpt& pt, float reltime)
 {
-    float relstart = (float) (starttime - this->epoch);
-    float relend = (float) (endtime - this->epoch);
-    for (int i = 0; i < cachedlen; i++)
-    {
-        struct cachedpt* pt = &this->cached[i];
-        if (pt->flags != FLAGS_GAP && pt->flags != FLAGS_ALWAYS_HIDE && pt->reltime >= relstart && pt->reltime <= relend)
-        {
-            if (count)
-            {
-                maximum = qMax(maximum, pt->truecount);
-            }
-            else
-            {
-                minimum = qMin(minimum, pt->min);
-                maximum = qMax(maximum , pt->max);
-            }
-        }
-    }
+    return pt.reltime < reltime;
 }
 
-uint qHash(const CacheEntry& key, uint seed)
+static bool cachedptTimeGreater(float reltime, const struct cachedpt& pt)
 {
-    return qHash(key.start) ^ qHash(key.end) ^ seed;
+    return reltime < pt.reltime;
 }
 
-uint qHash(const QSharedPointer<CacheEntry>& key, uint seed)
+static bool rawptTimeLess(const struct rawcachedpt& pt, float reltime)
 {
-    return qHash(key.data(), seed);
+    return pt.reltime < reltime;
 }
 
-Cache::Cache() : cache(), outstanding(), loading(), lru()
+static bool rawptTimeGreater(float reltime, const struct rawcachedpt& pt)
 {
-    Q_ASSERT(sizeof(struct cachedpt) == 40);
-    this->curr_queryid = 0;
-    this->cost = 0;
-    this->requester = new Requester;
-
-    this->begunChangedRangesUpdateLoop = false;
+    return reltime < pt.reltime;
 }
 
-Cache::~Cache()
+/* The same as cachedptTime, for a raw point. */
+static int64_t rawptTime(const struct rawcachedpt& pt, int64_t epoch, int64_t pw)
 {
-    for (auto i = this->cache.begin(); i != this->cache.end(); i++)
-    {
-        delete[] i->entries;
-    }
-    delete this->requester;
+    int64_t approx = epoch + (int64_t) std::llround(pt.reltime);
+    return (approx + (pw >> 1)) & ~(pw - 1);
 }
 
-/*
- * There are two ways we could do this.
- * 1) requestData returns a list of entries that were cache hits,
- *    and entries that missed in the cache are returned
- *    asynchronously via a signal.
- * 2) requestData accepts a callbackthat is fired with a list of
- *    all cache entries in the range.
- *
- * The first way allows the plot to update as data becomes
- * available; the second way allows the plot to wait until
- * all data is available before updating the view.
- *
- * I think we'll go with the second way, for now. It requires us
- * to do more bookkeeping since we have to remember the request
- * associated to each chunk of data we get back, but it provides
- * for a cleaner API overall.
- */
-void Cache::requestData(DataSource* source, const QUuid& uuid, int64_t start, int64_t end,
-                        uint8_t pwe, std::function<void(QList<QSharedPointer<CacheEntry>>, bool)> callback,
-                        uint64_t request_hint, bool includemargins)
+QSharedPointer<CacheEntry> CacheEntry::slice(int64_t from, int64_t to)
 {
-    Q_ASSERT(pwe < PWE_MAX);
-    QList<QSharedPointer<CacheEntry>>* result = new QList<QSharedPointer<CacheEntry>>;
-    StreamKey sk(uuid, source);
+    Q_ASSERT(this->cached != nullptr || this->raw != nullptr);
+    Q_ASSERT(from >= this->start && to <= this->end && from <= to);
 
-    bool initscache = !this->cache.contains(sk);
+    /* The padding before the first point and after the last point belongs
+     * with the ends of this entry. The points in between are in order of
+     * time.
+     */
+    int64_t pw = Q_INT64_C(1) << this->pwe;
+    int64_t epoch = this->epoch;
 
-    struct streamcache& scache = this->cache[sk];
-    if (initscache)
+    /* Compare whole timestamps, since FROM and TO may be closer to a point
+     * than a float relative to the epoch can tell apart.
+     */
+    int first = 0;
+    int last = this->cachedlen;
+    if (this->cached != nullptr)
     {
-        scache.cachedbytes = 0;
-        CLEAR_CACHED_BOUNDS(scache);
-        scache.oldestgen = GENERATION_MAX;
-        scache.lrupos = this->lru.end();
-        scache.entries = nullptr;
+        if (from != this->start)
+        {
+            first = std::lower_bound(this->cached, this->cached + this->cachedlen, from,
+                                     [epoch, pw](const struct cachedpt& pt, int64_t time)
+            {
+                return cachedptTime(pt, epoch, pw) < time;
+            }) - this->cached;
+        }
+        if (to != this->end)
+        {
+            last = std::upper_bound(this->cached + first, this->cached + this->cachedlen, to,
+                                    [epoch, pw](int64_t time, const struct cachedpt& pt)
+            {
+                return time < cachedptTime(pt, epoch, pw);
+            }) - this->cached;
+        }
+    }
+    else
+    {
+        if (from != this->start)
+        {
+            first = std::lower_bound(this->raw, this->raw + this->cachedlen, from,
+                                     [epoch, pw](const struct rawcachedpt& pt, int64_t time)
+            {
+                return rawptTime(pt, epoch, pw) < time;
+            }) - this->raw;
+        }
+        if (to != this->end)
+        {
+            last = std::upper_bound(this->raw + first, this->raw + this->cachedlen, to,
+                                    [epoch, pw](int64_t time, const struct rawcachedpt& pt)
+            {
+                return time < rawptTime(pt, epoch, pw);
+            }) - this->raw;
+        }
     }
 
-    if (scache.entries == nullptr)
+    int len = last - first;
+    if (len <= 0)
     {
-        scache.entries = new QMap<int64_t, QSharedPointer<CacheEntry>>[PWE_MAX];
+        return QSharedPointer<CacheEntry>();
     }
 
-    QMap<int64_t, QSharedPointer<CacheEntry>>* pwemap = scache.entries;
+    bool atstart = (from == this->start);
+    bool atend = (to == this->end);
 
-    QMap<int64_t, QSharedPointer<CacheEntry>>* entries = &pwemap[pwe];
-    QMap<int64_t, QSharedPointer<CacheEntry>>::iterator i;
+    QSharedPointer<CacheEntry> piece(new CacheEntry(this->maincache, this->streamKey, from, to, this->pwe));
 
-    uint64_t queryid = this->curr_queryid++;
-    this->outstanding[queryid] = QPair<uint64_t, std::function<void()>>(0, [callback, result]()
+    /* An entry with raw points only keeps those. */
+    if (this->cached != nullptr)
+    {
+        piece->cached = new struct cachedpt[len];
+        memcpy(piece->cached, &this->cached[first], len * sizeof(struct cachedpt));
+        piece->cost = ((uint64_t) len) * CACHED_POINT_SIZE;
+    }
+    else
+    {
+        piece->raw = new struct rawcachedpt[len];
+        memcpy(piece->raw, &this->raw[first], len * sizeof(struct rawcachedpt));
+        piece->cost = ((uint64_t) len) * sizeof(struct rawcachedpt);
+    }
+    piece->cachedlen = len;
+    piece->cachedcap = len;
+    piece->epoch = this->epoch;
+    piece->tailtime = this->tailtime;
+    piece->generation = this->generation;
+    piece->stale = this->stale;
+    piece->keephostcopy = this->keephostcopy;
+
+    /* The entries that fill the cut out ranges connect to the pieces. */
+    piece->joinsPrev = atstart && this->joinsPrev;
+    piece->connectsToBefore = atstart && this->connectsToBefore;
+    piece->joinsNext = atend && this->joinsNext;
+    piece->connectsToAfter = atend && this->connectsToAfter;
+
+    if (atstart && this->firstpt != nullptr)
+    {
+        piece->firstpt = new struct statpt;
+        *piece->firstpt = *this->firstpt;
+    }
+    else if (!atstart)
+    {
+        for (int i = 0; i != len; i++)
+        {
+            if (piece->isRealPointAt(i))
+            {
+                piece->firstpt = new struct statpt;
+                piece->unfillPointAt(piece->firstpt, i);
+                break;
+            }
+        }
+    }
+
+    if (atend && this->lastpt != nullptr)
+    {
+        piece->lastpt = new struct statpt;
+        *piece->lastpt = *this->lastpt;
+        piece->lastidx = (this->lastidx >= first) ? this->lastidx - first : -1;
+    }
+    else if (!atend)
+    {
+        for (int i = len - 1; i != -1; i--)
+        {
+            if (piece->isRealPointAt(i))
+            {
+                piece->lastpt = new struct statpt;
+                piece->unfillPointAt(piece->lastpt, i);
+                break;
+            }
+        }
+    }
+
+    if (this->prepared || this->ddprepared)
+    {
+        piece->prepared = this->prepared;
+        piece->ddprepared = this->ddprepared;
+        if (!this->vboref.isNull() || !this->ddvboref.isNull())
+        {
+            /* The piece draws its share of the VBO the same way, and keeps
+             * the raw points in it, should it be decimated or split again.
+             */
+            Q_ASSERT(this->rawvbo == (this->raw != nullptr));
+            piece->vboref = this->vboref;
+            piece->vbooffset = this->vbooffset + first;
+            piece->rawvbo = this->rawvbo;
+            piece->ddvboref = this->ddvboref;
+            piece->ddvbooffset = this->ddvbooffset + first;
+            piece->sharesvbo = true;
+            piece->gpulen = qBound(0, this->gpulen - first, len);
+            piece->gpucap = len;
+            piece->ddcap = len;
+            piece->dirtyfrom = qMax(0, qMin(this->dirtyfrom - first, piece->gpulen));
+
+            /* Charge the piece for its share of the ranges. The cache is
+             * charged when the piece takes the place of this entry.
+             */
+            uint64_t ptsize = 0;
+            if (!piece->vboref.isNull())
+            {
+                ptsize += this->rawvbo ? sizeof(struct rawcachedpt) : CACHED_POINT_SIZE;
+            }
+            if (!piece->ddvboref.isNull())
+            {
+                ptsize += sizeof(struct ddpt);
+            }
+            piece->vramcost = ((uint64_t) len) * ptsize;
+        }
+        else
+        {
+            piece->dirtyfrom = len;
+        }
+    }
+
+    return piece;
+}
+
+bool CacheEntry::isRealPointAt(int i) const
+{
+    return (this->cached != nullptr) ? isRealPoint(this->cached[i]) : isRealPoint(this->raw[i]);
+}
+
+void CacheEntry::unfillPointAt(struct statpt* output, int i) const
+{
+    int64_t pw = Q_INT64_C(1) << this->pwe;
+    if (this->cached != nullptr)
+    {
+        unfillpt(output, &this->cached[i], this->epoch, pw);
+    }
+    else
+    {
+        struct cachedpt pt;
+        fromRaw(&pt, &this->raw[i]);
+        unfillpt(output, &pt, this->epoch, pw);
+    }
+}
+
+VBOArena* CacheEntry::vboArena() const
+{
+    return this->rawvbo ? &this->maincache->rawvbos : &this->maincache->vbos;
+}
+
+bool CacheEntry::isPlaceholder()
+{
+    return this->cached == nullptr && this->summary == nullptr && this->raw == nullptr;
+}
+
+uint64_t CacheEntry::getHostCost() const
+{
+    return this->cost;
+}
+
+uint64_t CacheEntry::getVRAMCost() const
+{
+    return this->vramcost;
+}
+
+void CacheEntry::prepare(QOpenGLFunctions* funcs, bool dd, struct drawstats& stats)
+{
+    Q_ASSERT(!this->isPrepared(dd));
+
+    /* Bring the other VBO, if there is one, up to date first, so that both
+     * hold the same points.
+     */
+    if (this->needsUpdate())
+    {
+        this->update(funcs, stats);
+    }
+
+    if (dd)
+    {
+        /* Once the host copy is gone, the main VBO is drawn instead. */
+        if ((this->cached != nullptr || this->raw != nullptr) && this->cachedlen != 0)
+        {
+            /* If live data has been appended, this leaves room for more. */
+            this->ddvboref = this->maincache->ddvbos.allocate(funcs, this->cachedcap);
+            this->ddvbooffset = 0;
+            this->ddcap = this->cachedcap;
+            this->uploadDD(funcs, 0, stats);
+        }
+        this->ddprepared = true;
+    }
+    else
+    {
+        Q_ASSERT(this->cached != nullptr || this->cachedlen == 0);
+        if (this->cachedlen != 0 && this->pwe == 0 && this->lastidx == -1)
+        {
+            /* Raw points are kept, on the GPU and off it, without their
+             * min-max background and counts.
+             */
+            this->raw = new struct rawcachedpt[this->cachedlen];
+            for (int i = 0; i != this->cachedlen; i++)
+            {
+                toRaw(&this->raw[i], &this->cached[i]);
+            }
+            this->vboref = this->maincache->rawvbos.allocate(funcs, this->cachedlen);
+            this->vbooffset = 0;
+            this->maincache->rawvbos.upload(funcs, this->vboref.data(), 0, this->raw, this->cachedlen);
+            this->rawvbo = true;
+
+            stats.uploaded += this->cachedlen * sizeof(struct rawcachedpt);
+            this->gpucap = this->cachedlen;
+
+            /* The compact copy replaces the full one in host memory. */
+            delete[] this->cached;
+            this->cached = nullptr;
+            this->cachedcap = this->cachedlen;
+
+            uint64_t newcost = ((uint64_t) this->cachedlen) * sizeof(struct rawcachedpt) + this->decimationcost;
+            if (newcost < this->cost)
+            {
+                if (!this->evicted && !this->isdecimation)
+                {
+                    this->maincache->releaseCost(this->streamKey, this->cost - newcost);
+                }
+                this->cost = newcost;
+            }
+        }
+        else
+        {
+            if (this->cachedlen != 0)
+            {
+                /* If live data has been appended, this leaves room for more. */
+                this->vboref = this->maincache->vbos.allocate(funcs, this->cachedcap);
+                this->vbooffset = 0;
+                this->maincache->vbos.upload(funcs, this->vboref.data(), 0, this->cached, this->cachedlen);
+
+                stats.uploaded += this->cachedlen * sizeof(struct cachedpt);
+            }
+            this->gpucap = this->cachedcap;
+        }
+        this->prepared = true;
+    }
+
+    this->gpulen = this->cachedlen;
+    this->dirtyfrom = this->cachedlen;
+
+    /* The data density plot can draw from the main VBO, but not the other
+     * way around, so the host copy is kept until the main VBO has it.
+     */
+    if (!dd && this->cached != nullptr && this->cachedlen != 0 && this->lastidx == -1 &&
+            this->maincache->releasehostcopies && !this->keephostcopy)
+    {
+        this->releaseHostCopy();
+    }
+
+    this->chargeVRAM();
+}
+
+void CacheEntry::uploadDD(QOpenGLFunctions* funcs, int from, struct drawstats& stats)
+{
+    int len = this->cachedlen - from;
+    QVector<struct ddpt> compact(len);
+    if (this->cached != nullptr)
+    {
+        for (int i = 0; i != len; i++)
+        {
+            const struct cachedpt& pt = this->cached[from + i];
+            compact[i].reltime = pt.reltime;
+            compact[i].prevcount = pt.prevcount;
+            compact[i].reltime2 = pt.reltime2;
+            compact[i].count = pt.count;
+        }
+    }
+    else
+    {
+        /* Each raw point counts as one, and each gap as zero. */
+        for (int i = 0; i != len; i++)
+        {
+            int j = from + i;
+            compact[i].reltime = this->raw[j].reltime;
+            compact[i].prevcount = (j != 0 && isRealPoint(this->raw[j - 1])) ? 1.0f : 0.0f;
+            compact[i].reltime2 = this->raw[j].reltime;
+            compact[i].count = isRealPoint(this->raw[j]) ? 1.0f : 0.0f;
+        }
+    }
+    this->maincache->ddvbos.upload(funcs, this->ddvboref.data(), this->ddvbooffset + from, compact.constData(), len);
+
+    stats.uploaded += len * sizeof(struct ddpt);
+}
+
+void CacheEntry::chargeVRAM()
+{
+    uint64_t newcost = 0;
+    if (!this->vboref.isNull())
+    {
+        newcost += ((uint64_t) this->gpucap) * (this->rawvbo ? sizeof(struct rawcachedpt) : CACHED_POINT_SIZE);
+    }
+    if (!this->ddvboref.isNull())
+    {
+        newcost += ((uint64_t) this->ddcap) * sizeof(struct ddpt);
+    }
+    uint64_t hostcost = 0;
+    for (auto i = this->decimations.begin(); i != this->decimations.end(); i++)
+    {
+        newcost += (*i)->entry->vramcost;
+        hostcost += (*i)->entry->cost;
+    }
+
+    /* An entry that was evicted before being drawn is not counted. */
+    bool counted = !this->evicted && !this->isdecimation;
+    if (counted)
+    {
+        this->maincache->vramcost -= this->vramcost;
+        this->maincache->vramcost += newcost;
+    }
+    uint64_t oldcost = this->vramcost;
+    this->vramcost = newcost;
+
+    uint64_t grown = 0;
+    if (hostcost < this->decimationcost)
+    {
+        if (counted)
+        {
+            this->maincache->releaseCost(this->streamKey, this->decimationcost - hostcost);
+        }
+        this->cost -= this->decimationcost - hostcost;
+    }
+    else
+    {
+        grown = hostcost - this->decimationcost;
+        this->cost += grown;
+    }
+    this->decimationcost = hostcost;
+
+    /* Charge the cache for any growth in host memory, and evict the least
+     * recently used entries if that went over either threshold. This
+     * entry may be one of them.
+     */
+    if (counted && (grown != 0 || (newcost > oldcost && this->maincache->vramcost >= CACHE_VRAM_THRESHOLD)))
+    {
+        this->maincache->addCost(this->streamKey, grown);
+    }
+}
+
+void CacheEntry::releaseHostCopy()
+{
+    Q_ASSERT(this->prepared && this->cached != nullptr && this->lastidx == -1);
+
+    this->summarylen = (this->cachedlen + CACHE_SUMMARY_BLOCK - 1) / CACHE_SUMMARY_BLOCK;
+    this->summary = new struct blocksummary[this->summarylen];
+    for (int b = 0; b != this->summarylen; b++)
+    {
+        struct blocksummary& block = this->summary[b];
+        int first = b * CACHE_SUMMARY_BLOCK;
+        int last = qMin(first + CACHE_SUMMARY_BLOCK, this->cachedlen) - 1;
+
+        block.starttime = this->cached[first].reltime;
+        block.endtime = this->cached[last].reltime;
+        block.min = FLT_MAX;
+        block.max = -FLT_MAX;
+        block.truecount = -FLT_MAX;
+        for (int i = first; i <= last; i++)
+        {
+            const struct cachedpt* pt = &this->cached[i];
+            if (pt->flags != FLAGS_GAP && pt->flags != FLAGS_ALWAYS_HIDE)
+            {
+                block.min = qMin(block.min, pt->min);
+                block.max = qMax(block.max, pt->max);
+                block.truecount = qMax(block.truecount, pt->truecount);
+            }
+        }
+    }
+
+    delete[] this->cached;
+    this->cached = nullptr;
+
+    /* Only the summary and the decimations count against host memory
+     * now.
+     */
+    uint64_t newcost = ((uint64_t) this->summarylen) * sizeof(struct blocksummary) + this->decimationcost;
+    if (newcost < this->cost)
+    {
+        if (!this->evicted && !this->isdecimation)
+        {
+            this->maincache->releaseCost(this->streamKey, this->cost - newcost);
+        }
+        this->cost = newcost;
+    }
+}
+
+bool CacheEntry::isPrepared(bool dd) const
+{
+    return dd ? this->ddprepared : this->prepared;
+}
+
+bool CacheEntry::needsUpdate() const
+{
+    return (this->prepared || this->ddprepared) && this->dirtyfrom < this->cachedlen;
+}
+
+void CacheEntry::update(QOpenGLFunctions* funcs, struct drawstats& stats)
+{
+    Q_ASSERT(!this->vboref.isNull() || !this->ddvboref.isNull());
+
+    int changedfrom = this->dirtyfrom;
+
+    /* Either other entries draw from the current ranges, or they are out
+     * of headroom. Either way, move to new ranges.
+     */
+    if (!this->vboref.isNull() && (this->sharesvbo || this->gpucap < this->cachedcap))
+    {
+        this->vboref = this->maincache->vbos.allocate(funcs, this->cachedcap);
+        this->vbooffset = 0;
+        this->gpucap = this->cachedcap;
+        this->dirtyfrom = 0;
+    }
+    if (!this->ddvboref.isNull() && (this->sharesvbo || this->ddcap < this->cachedcap))
+    {
+        this->ddvboref = this->maincache->ddvbos.allocate(funcs, this->cachedcap);
+        this->ddvbooffset = 0;
+        this->ddcap = this->cachedcap;
+        this->dirtyfrom = 0;
+    }
+    this->sharesvbo = false;
+
+    /* Only upload the points that changed. */
+    if (!this->vboref.isNull())
+    {
+        this->maincache->vbos.upload(funcs, this->vboref.data(), this->vbooffset + this->dirtyfrom,
+                                     &this->cached[this->dirtyfrom], this->cachedlen - this->dirtyfrom);
+
+        stats.uploaded += (this->cachedlen - this->dirtyfrom) * sizeof(struct cachedpt);
+    }
+    if (!this->ddvboref.isNull())
+    {
+        this->uploadDD(funcs, this->dirtyfrom, stats);
+    }
+
+    this->gpulen = this->cachedlen;
+    this->dirtyfrom = this->cachedlen;
+
+    if (!this->decimations.isEmpty())
+    {
+        this->extendDecimations(funcs, changedfrom, stats);
+    }
+    this->chargeVRAM();
+}
+
+/* Appends the points of POINTS at the (up to four) indices in RUN to
+ * KEPT, in order of time, leaving out duplicates.
+ */
+static void keepRun(const struct rawcachedpt* points, int* run, QVector<struct rawcachedpt>& kept)
+{
+    std::sort(run, run + 4);
+    for (int j = 0; j != 4; j++)
+    {
+        if (j == 0 || run[j] != run[j - 1])
+        {
+            kept.append(points[run[j]]);
+        }
+    }
+}
+
+/* Appends the M4 decimation of the LEN points in POINTS to KEPT, in
+ * buckets of 2^EXPONENT nanoseconds. The first of POINTS is at index
+ * POINTSBASE in its entry, whose epoch is EPOCH, and the first of KEPT at
+ * index KEPTBASE in the decimation. POINTS must start at the start of a
+ * bucket. For each bucket, the indices of its first point in the entry and
+ * in the decimation are appended to RESUME, which keeps the last
+ * CACHE_DECIMATION_RESUME of them.
+ */
+static void decimatePoints(const struct rawcachedpt* points, int len, int pointsbase, int64_t epoch, int exponent,
+                           QVector<struct rawcachedpt>& kept, int keptbase, QVector<QPair<int, int>>& resume)
+{
+    /* Runs of connected points end at a gap, or at the end of a bucket.
+     * For each run, RUN holds the indices of its first, minimum, maximum
+     * and last points.
+     */
+    int run[4];
+    int64_t runbucket = 0;
+    int64_t lastbucket = 0;
+    bool inrun = false;
+    for (int i = 0; i != len; i++)
+    {
+        const struct rawcachedpt& pt = points[i];
+        int64_t bucket = (epoch + (int64_t) pt.reltime) >> exponent;
+        bool real = isRealPoint(pt);
+
+        if (inrun && (!real || bucket != runbucket))
+        {
+            keepRun(points, run, kept);
+            inrun = false;
+        }
+
+        if (i == 0 || bucket != lastbucket)
+        {
+            if (resume.size() == CACHE_DECIMATION_RESUME)
+            {
+                resume.removeFirst();
+            }
+            resume.append(qMakePair(pointsbase + i, keptbase + kept.size()));
+            lastbucket = bucket;
+        }
+
+        if (!real)
+        {
+            kept.append(pt);
+        }
+        else if (!inrun)
+        {
+            run[0] = run[1] = run[2] = run[3] = i;
+            runbucket = bucket;
+            inrun = true;
+        }
+        else
+        {
+            if (pt.value < points[run[1]].value)
+            {
+                run[1] = i;
+            }
+            if (pt.value > points[run[2]].value)
+            {
+                run[2] = i;
+            }
+            run[3] = i;
+        }
+    }
+    if (inrun)
+    {
+        keepRun(points, run, kept);
+    }
+}
+
+/* Fills in the summaries of the blocks of the LEN points in POINTS, which
+ * start at the start of the block in BLOCKS.
+ */
+static void summarizeRaw(struct blocksummary* blocks, const struct rawcachedpt* points, int len)
+{
+    for (int first = 0; first < len; first += CACHE_SUMMARY_BLOCK)
+    {
+        struct blocksummary& block = blocks[first / CACHE_SUMMARY_BLOCK];
+        int last = qMin(first + CACHE_SUMMARY_BLOCK, len) - 1;
+
+        block.starttime = points[first].reltime;
+        block.endtime = points[last].reltime;
+        block.min = FLT_MAX;
+        block.max = -FLT_MAX;
+        block.truecount = -FLT_MAX;
+        for (int i = first; i <= last; i++)
+        {
+            if (isRealPoint(points[i]))
+            {
+                block.min = qMin(block.min, points[i].value);
+                block.max = qMax(block.max, points[i].value);
+                block.truecount = 1.0f;
+            }
+        }
+    }
+}
+
+bool CacheEntry::canDecimate(int exponent) const
+{
+    if (!this->prepared || this->pwe != 0 || (this->cached == nullptr && this->raw == nullptr) ||
+            exponent < 0 || exponent > 62)
+    {
+        return false;
+    }
+
+    /* At most four points are kept per bucket, so decimating only helps
+     * if there are more than that on average.
+     */
+    int64_t buckets = ((this->end - this->start) >> exponent) + 1;
+    return this->cachedlen > 4 * buckets;
+}
+
+QSharedPointer<CacheEntry> CacheEntry::getDecimation(int exponent, bool* exact) const
+{
+    auto found = this->decimations.upperBound(exponent);
+    if (found == this->decimations.begin())
+    {
+        *exact = false;
+        return QSharedPointer<CacheEntry>();
+    }
+    found--;
+    *exact = (found.key() == exponent);
+    return (*found)->entry;
+}
+
+const struct rawcachedpt* CacheEntry::rawPoints(int from, QVector<struct rawcachedpt>& converted) const
+{
+    if (this->raw != nullptr)
+    {
+        return &this->raw[from];
+    }
+
+    /* Entries that live points may be appended to keep their full points. */
+    converted.resize(this->cachedlen - from);
+    for (int i = from; i != this->cachedlen; i++)
+    {
+        toRaw(&converted[i - from], &this->cached[i]);
+    }
+    return converted.constData();
+}
+
+QSharedPointer<CacheEntry> CacheEntry::decimate(QOpenGLFunctions* funcs, int exponent, struct drawstats& stats)
+{
+    Q_ASSERT(this->canDecimate(exponent));
+
+    auto found = this->decimations.find(exponent);
+    if (found != this->decimations.end())
+    {
+        return (*found)->entry;
+    }
+
+    QSharedPointer<struct decimation> dec(new struct decimation);
+    dec->carriedfrom = 0;
+
+    QVector<struct rawcachedpt> converted;
+    QVector<struct rawcachedpt> kept;
+    decimatePoints(this->rawPoints(0, converted), this->cachedlen, 0, this->epoch, exponent, kept, 0, dec->resume);
+    stats.decimated += this->cachedlen * sizeof(struct rawcachedpt);
+
+    /* Leave as much room for live points as this entry has, since the
+     * decimation keeps at most as many points as are appended.
+     */
+    int cap = kept.size();
+    if (this->lastidx != -1)
+    {
+        cap += this->cachedcap - this->cachedlen;
+    }
+
+    QSharedPointer<CacheEntry> decimated(new CacheEntry(this->maincache, this->streamKey, this->start, this->end, this->pwe));
+    decimated->isdecimation = true;
+    decimated->epoch = this->epoch;
+    decimated->joinsPrev = this->joinsPrev;
+    decimated->joinsNext = this->joinsNext;
+    decimated->connectsToBefore = this->connectsToBefore;
+    decimated->connectsToAfter = this->connectsToAfter;
+    decimated->summary = new struct blocksummary[(cap + CACHE_SUMMARY_BLOCK - 1) / CACHE_SUMMARY_BLOCK];
+    decimated->vboref = this->maincache->rawvbos.allocate(funcs, cap);
+    decimated->vbooffset = 0;
+    decimated->rawvbo = true;
+    decimated->gpucap = cap;
+    decimated->prepared = true;
+    dec->entry = decimated;
+    this->storeDecimation(funcs, *dec, kept, 0, stats);
+    decimated->chargeVRAM();
+
+    /* Make room by dropping the decimation furthest from this scale. */
+    if (this->decimations.size() == CACHE_DECIMATION_LEVELS)
+    {
+        int furthest = qAbs(this->decimations.firstKey() - exponent) > qAbs(this->decimations.lastKey() - exponent) ?
+                    this->decimations.firstKey() : this->decimations.lastKey();
+        this->decimations.remove(furthest);
+    }
+    this->decimations.insert(exponent, dec);
+    this->chargeVRAM();
+
+    return decimated;
+}
+
+void CacheEntry::extendDecimations(QOpenGLFunctions* funcs, int from, struct drawstats& stats)
+{
+    for (auto i = this->decimations.begin(); i != this->decimations.end();)
+    {
+        struct decimation& dec = **i;
+
+        /* Pick up from the last bucket that starts before the first point
+         * that changed.
+         */
+        int r = dec.resume.size() - 1;
+        while (r >= 0 && dec.resume[r].first > from)
+        {
+            r--;
+        }
+        if (r == -1)
+        {
+            i = this->decimations.erase(i);
+            continue;
+        }
+        int pointsfrom = dec.resume[r].first;
+        int keptfrom = dec.resume[r].second;
+        dec.resume.resize(r);
+
+        QVector<struct rawcachedpt> converted;
+        QVector<struct rawcachedpt> kept = dec.carried.mid(0, keptfrom - dec.carriedfrom);
+        decimatePoints(this->rawPoints(pointsfrom, converted), this->cachedlen - pointsfrom, pointsfrom,
+                       this->epoch, i.key(), kept, dec.carriedfrom, dec.resume);
+        stats.decimated += (this->cachedlen - pointsfrom) * sizeof(struct rawcachedpt);
+
+        /* Once it runs out of room, it is made again from scratch. */
+        if (dec.carriedfrom + kept.size() > dec.entry->gpucap)
+        {
+            i = this->decimations.erase(i);
+            continue;
+        }
+        this->storeDecimation(funcs, dec, kept, keptfrom, stats);
+        dec.entry->chargeVRAM();
+        i++;
+    }
+}
+
+void CacheEntry::storeDecimation(QOpenGLFunctions* funcs, struct decimation& dec,
+                                 const QVector<struct rawcachedpt>& kept, int from, struct drawstats& stats)
+{
+    CacheEntry* decimated = dec.entry.data();
+    int len = dec.carriedfrom + kept.size();
+    Q_ASSERT(len <= decimated->gpucap && from >= dec.carriedfrom && dec.carriedfrom % CACHE_SUMMARY_BLOCK == 0);
+
+    if (len > from)
+    {
+        this->maincache->rawvbos.upload(funcs, decimated->vboref.data(), decimated->vbooffset + from,
+                                        kept.constData() + (from - dec.carriedfrom), len - from);
+        stats.uploaded += (len - from) * sizeof(struct rawcachedpt);
+    }
+
+    summarizeRaw(&decimated->summary[dec.carriedfrom / CACHE_SUMMARY_BLOCK], kept.constData(), kept.size());
+    decimated->summarylen = (len + CACHE_SUMMARY_BLOCK - 1) / CACHE_SUMMARY_BLOCK;
+    decimated->cachedlen = len;
+    decimated->cachedcap = decimated->gpucap;
+    decimated->gpulen = len;
+    decimated->dirtyfrom = len;
+
+    /* Carry the points from the summary block of the first bucket that
+     * may be decimated again.
+     */
+    int carriedfrom = dec.resume.first().second / CACHE_SUMMARY_BLOCK * CACHE_SUMMARY_BLOCK;
+    dec.carried = kept.mid(carriedfrom - dec.carriedfrom);
+    dec.carriedfrom = carriedfrom;
+
+    decimated->cost = ((uint64_t) (decimated->gpucap + CACHE_SUMMARY_BLOCK - 1) / CACHE_SUMMARY_BLOCK) * sizeof(struct blocksummary) +
+            ((uint64_t) dec.carried.size()) * sizeof(struct rawcachedpt);
+}
+
+struct pointrange CacheEntry::visibleRange(int64_t tStart, int64_t tEnd) const
+{
+    struct pointrange range;
+    range.dense = false;
+    int len = this->gpulen;
+
+    if (len == 0 || (tStart <= this->start && tEnd >= this->end))
+    {
+        range.first = 0;
+        range.count = len;
+        return range;
+    }
+
+    if (tEnd < this->start || tStart > this->end)
+    {
+        /* Only the point nearest to the visible interval may be needed. */
+        range.first = (tEnd < this->start) ? 0 : len - 1;
+        range.count = 1;
+        return range;
+    }
+
+    /* Clamp to the entry first, so that the relative times can't overflow. */
+    float relstart = (float) (qMax(tStart, this->start) - this->epoch);
+    float relend = (float) (qMin(tEnd, this->end) - this->epoch);
+
+    if (this->raw != nullptr)
+    {
+        const struct rawcachedpt* first = std::lower_bound(this->raw, this->raw + len, relstart, rawptTimeLess);
+        const struct rawcachedpt* last = std::upper_bound(first, this->raw + len, relend, rawptTimeGreater);
+
+        range.first = qMax((int) (first - this->raw) - 1, 0);
+        range.count = qMin((int) (last - this->raw), len - 1) - range.first + 1;
+        return range;
+    }
+
+    if (this->cached == nullptr)
+    {
+        /* Only the summary is left, so find the blocks that are visible
+         * instead, and draw all of their points.
+         */
+        const struct blocksummary* blocks = this->summary;
+        const struct blocksummary* firstblock = std::lower_bound(blocks, blocks + this->summarylen, relstart,
+                                                                 [](const struct blocksummary& block, float t)
+        {
+            return block.endtime < t;
+        });
+        const struct blocksummary* lastblock = std::upper_bound(firstblock, blocks + this->summarylen, relend,
+                                                                [](float t, const struct blocksummary& block)
+        {
+            return t < block.starttime;
+        });
+
+        int first = (int) (firstblock - blocks) * CACHE_SUMMARY_BLOCK;
+        int last = qMin((int) (lastblock - blocks) * CACHE_SUMMARY_BLOCK, len);
+        range.first = qMax(first - 1, 0);
+        range.count = qMin(last, len - 1) - range.first + 1;
+        return range;
+    }
+
+    /* Points (including the padding at either end) are sorted by time. */
+    const struct cachedpt* first = std::lower_bound(this->cached, this->cached + len, relstart, cachedptTimeLess);
+    const struct cachedpt* last = std::upper_bound(first, this->cached + len, relend, cachedptTimeGreater);
+
+    range.first = qMax((int) (first - this->cached) - 1, 0);
+    range.count = qMin((int) (last - this->cached), len - 1) - range.first + 1;
+    return range;
+}
+
+/* The stride of the points in a VBO of cachedpts, or of raw points if RAW
+ * is true, and the byte offsets in each point of the value and the flags
+ * drawn for the mean line and the points.
+ */
+static void pointLayout(bool raw, GLsizei* stride, uintptr_t* valueoffset, uintptr_t* flagsoffset)
+{
+    *stride = raw ? sizeof(struct rawcachedpt) : sizeof(struct cachedpt);
+    *valueoffset = raw ? offsetof(struct rawcachedpt, value) : offsetof(struct cachedpt, mean);
+    *flagsoffset = raw ? offsetof(struct rawcachedpt, flags) : offsetof(struct cachedpt, flags);
+}
+
+void CacheEntry::renderPlot(QOpenGLFunctions* funcs, const struct pointrange& range, float yStart,
+                            float yEnd, int64_t tStart, int64_t tEnd,
+                            int64_t timeOffset,
+                            GLint axisMatUniform, GLint axisVecUniform,
+                            GLint tstripUniform, GLint opacityUniform,
+                            bool meanLine, struct drawstats& stats)
+{
+    Q_ASSERT(this->prepared);
+
+    if (!this->vboref.isNull() && range.count > 0)
+    {
+        float matrix[9];
+        float vector[2];
+
+        GLsizei stride;
+        uintptr_t valueoffset;
+        uintptr_t flagsoffset;
+        bool raw = this->rawvbo;
+        pointLayout(raw, &stride, &valueoffset, &flagsoffset);
+        Q_ASSERT(this->vboref->getArena() == this->vboArena());
+
+        /* Byte offset of the first point to draw in the VBO. */
+        GLuint vbo = this->vboref->getBuffer();
+        uintptr_t base = (this->vboref->getOffset() + this->vbooffset + range.first) * stride;
+
+        /* Fill in the matrix in column-major order. */
+        matrix[0] = 2.0f / (tEnd - tStart);
+        matrix[1] = 0.0f;
+        matrix[2] = 0.0f;
+        matrix[3] = 0.0f;
+        matrix[4] = -2.0f / (yEnd - yStart);
+        matrix[5] = 0.0f;
+        matrix[6] = -1.0f;
+        matrix[7] = 1.0f;
+        matrix[8] = 1.0f;
+
+        /* Fill in the offset vector. */
+        vector[0] = (float) (tStart - epoch - timeOffset - ((Q_INT64_C(1) << pwe) >> 1));
+        vector[1] = yStart;
+
+        /* Now, given a vector <time, value>, where time is relative to
+         * epoch, first subtract the offset vector, then pad the result
+         * with a 1 and multiply by the transform matrix. The result is
+         * the screen coordinates for that point.
+         */
+        funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
+        funcs->glUniform2fv(axisVecUniform, 1, vector);
+
+        /* Raw points have no min-max background, and their vertical lines
+         * have no length, so the first two passes are skipped for them.
+         */
+        if (!raw)
+        {
+            /* First, draw the min-max background. */
+
+            funcs->glUniform1f(opacityUniform, 0.5);
+
+            funcs->glUniform1i(tstripUniform, 1);
+
+            funcs->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) base);
+            funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (base + sizeof(float)));
+            funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (base + 4 * sizeof(float)));
+            funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+            funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
+            funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
+            funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            funcs->glDrawArrays(GL_TRIANGLE_STRIP, 0, range.count << 1);
+            stats.drawcalls++;
+            stats.vertices += range.count << 1;
+
+            /* Second, draw vertical lines for disconnected points. */
+
+            if (!range.dense)
+            {
+                funcs->glUniform1i(tstripUniform, 0);
+
+                funcs->glDrawArrays(GL_LINES, 0, range.count << 1);
+                stats.drawcalls++;
+                stats.vertices += range.count << 1;
+            }
+        }
+
+
+        /* Third, draw the mean line. */
+
+        funcs->glUniform1f(opacityUniform, 1.0);
+
+        funcs->glUniform1i(tstripUniform, 1);
+
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) base);
+        funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (base + valueoffset));
+        funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (base + flagsoffset));
+        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+        funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
+        funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if (meanLine)
+        {
+            funcs->glDrawArrays(GL_LINE_STRIP, 0, range.count);
+            stats.drawcalls++;
+            stats.vertices += range.count;
+        }
+
+
+        /* Fourth, draw the points. */
+
+        if (!range.dense)
+        {
+            funcs->glUniform1i(tstripUniform, 0);
+
+            funcs->glDrawArrays(GL_POINTS, 0, range.count);
+            stats.drawcalls++;
+            stats.vertices += range.count;
+        }
+    }
+}
+
+struct pointrange CacheEntry::ddRange(const struct pointrange& range) const
+{
+    /* The data density plot skips the points that connect to neighbouring
+     * entries.
+     */
+    struct pointrange ddrange;
+    ddrange.first = qMax(range.first, (int) this->connectsToBefore);
+    int end = qMin(range.first + range.count, this->gpulen - this->connectsToAfter);
+    ddrange.count = end - ddrange.first;
+    ddrange.dense = range.dense;
+    return ddrange;
+}
+
+void CacheEntry::renderDDPlot(QOpenGLFunctions* funcs, const struct pointrange& range, float yStart,
+                              float yEnd, int64_t tStart, int64_t tEnd,
+                              int64_t timeOffset,
+                              GLint axisMatUniform, GLint axisVecUniform,
+                              struct drawstats& stats)
+{
+    Q_ASSERT(this->ddprepared);
+
+    /* Draw the compact copy of the points if there is one, and the main
+     * VBO otherwise. Either way, there are two vertices per point.
+     */
+    bool compact = !this->ddvboref.isNull();
+    const QSharedPointer<VBORange>& ref = compact ? this->ddvboref : this->vboref;
+    GLsizei stride = compact ? sizeof(struct ddpt) / 2 : sizeof(struct cachedpt) / 2;
+    uintptr_t countoffset = compact ? sizeof(float) : 2 * sizeof(float);
+
+    struct pointrange ddrange = this->ddRange(range);
+    if (!ref.isNull() && ddrange.count > 0)
+    {
+        float matrix[9];
+        float vector[2];
+
+        /* Byte offset of the first point to draw in the VBO. */
+        GLuint vbo = ref->getBuffer();
+        uintptr_t base = (ref->getOffset() + (compact ? this->ddvbooffset : this->vbooffset) + ddrange.first) * (stride << 1);
+
+        /* Fill in the matrix in column-major order. */
+        matrix[0] = 2.0f / (tEnd - tStart);
+        matrix[1] = 0.0f;
+        matrix[2] = 0.0f;
+        matrix[3] = 0.0f;
+        matrix[4] = -2.0f / (yEnd - yStart);
+        matrix[5] = 0.0f;
+        matrix[6] = -1.0f;
+        matrix[7] = 1.0f;
+        matrix[8] = 1.0f;
+
+        /* Fill in the offset vector. */
+        vector[0] = (float) (tStart - epoch - timeOffset) + (Q_INT64_C(1) << pwe) / 2.0f;
+        vector[1] = yStart;
+
+        /* Now, given a vector <time, value>, where time is relative to
+         * epoch, first subtract the offset vector, then pad the result
+         * with a 1 and multiply by the transform matrix. The result is
+         * the screen coordinates for that point.
+         */
+        funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
+        funcs->glUniform2fv(axisVecUniform, 1, vector);
+
+        /* Draw the data density plot. */
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) base);
+        funcs->glVertexAttribPointer(COUNT_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (base + countoffset));
+        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+        funcs->glEnableVertexAttribArray(COUNT_ATTR_LOC);
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        funcs->glDrawArrays(GL_LINE_STRIP, 0, ddrange.count << 1);
+
+        stats.drawcalls++;
+        stats.vertices += 2 * ddrange.count;
+    }
+}
+
+void CacheEntry::batchEntries(const QList<QSharedPointer<CacheEntry>>& entries,
+                              const QVector<struct pointrange>& ranges, bool dd,
+                              QVector<struct drawbatch>& batches)
+{
+    Q_ASSERT(entries.size() == ranges.size());
+
+    for (int i = 0; i != entries.size(); i++)
+    {
+        const QSharedPointer<CacheEntry>& ce = entries[i];
+        Q_ASSERT(ce->isPrepared(dd));
+
+        /* The data density plot draws the compact copy if there is one. */
+        bool compact = dd && !ce->ddvboref.isNull();
+        const QSharedPointer<VBORange>& ref = compact ? ce->ddvboref : ce->vboref;
+        if (ref.isNull())
+        {
+            continue;
+        }
+        Q_ASSERT(compact || ref->getArena() == ce->vboArena());
+
+        struct pointrange range = dd ? ce->ddRange(ranges[i]) : ranges[i];
+        GLint first = ref->getOffset() + (compact ? ce->ddvbooffset : ce->vbooffset) + range.first;
+        GLsizei count = range.count;
+        if (count <= 0)
+        {
+            continue;
+        }
+
+        /* The data density plot draws every point the same way. */
+        bool dense = !dd && range.dense;
+
+        /* Entries are sorted by time, so they usually join the most recent
+         * batch. There are only a few batches per stream.
+         */
+        GLuint vbo = ref->getBuffer();
+        int b;
+        for (b = batches.size() - 1; b >= 0; b--)
+        {
+            const struct drawbatch& batch = batches[b];
+            if (batch.vbo == vbo && batch.epoch == ce->epoch && batch.pwe == ce->pwe && batch.dense == dense)
+            {
+                break;
+            }
+        }
+        if (b < 0)
+        {
+            struct drawbatch batch;
+            batch.vbo = vbo;
+            batch.compact = compact;
+            batch.raw = !dd && ce->rawvbo;
+            batch.dense = dense;
+            batch.epoch = ce->epoch;
+            batch.pwe = ce->pwe;
+            batches.append(batch);
+            b = batches.size() - 1;
+        }
+
+        batches[b].first.append(first);
+        batches[b].count.append(count);
+    }
+}
+
+void CacheEntry::renderPlotBatch(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                 const QList<QSharedPointer<CacheEntry>>& entries,
+                                 const QVector<struct pointrange>& ranges,
+                                 float yStart, float yEnd, int64_t tStart, int64_t tEnd,
+                                 int64_t timeOffset,
+                                 GLint axisMatUniform, GLint axisVecUniform,
+                                 GLint tstripUniform, GLint opacityUniform,
+                                 bool meanLine, struct drawstats& stats)
+{
+    QVector<struct drawbatch> batches;
+    CacheEntry::batchEntries(entries, ranges, false, batches);
+
+    float matrix[9];
+    float vector[2];
+
+    /* Fill in the matrix in column-major order. */
+    matrix[0] = 2.0f / (tEnd - tStart);
+    matrix[1] = 0.0f;
+    matrix[2] = 0.0f;
+    matrix[3] = 0.0f;
+    matrix[4] = -2.0f / (yEnd - yStart);
+    matrix[5] = 0.0f;
+    matrix[6] = -1.0f;
+    matrix[7] = 1.0f;
+    matrix[8] = 1.0f;
+
+    funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
+
+    for (auto i = batches.begin(); i != batches.end(); i++)
+    {
+        const struct drawbatch& batch = *i;
+        GLsizei drawcount = batch.first.size();
+
+        /* The offset vector is the same as in renderPlot. */
+        vector[0] = (float) (tStart - batch.epoch - timeOffset - ((Q_INT64_C(1) << batch.pwe) >> 1));
+        vector[1] = yStart;
+        funcs->glUniform2fv(axisVecUniform, 1, vector);
+
+        /* As in renderPlot, raw points skip the first two passes. */
+        if (!batch.raw)
+        {
+            /* The min-max background and the vertical lines use two
+             * vertices per point.
+             */
+            QVector<GLint> first2(drawcount);
+            QVector<GLsizei> count2(drawcount);
+            for (int j = 0; j != drawcount; j++)
+            {
+                first2[j] = batch.first[j] << 1;
+                count2[j] = batch.count[j] << 1;
+            }
+
+            /* First, draw the min-max background. */
+
+            funcs->glUniform1f(opacityUniform, 0.5);
+
+            funcs->glUniform1i(tstripUniform, 1);
+
+            funcs->glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+            funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) 0);
+            funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) sizeof(float));
+            funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (4 * sizeof(float)));
+            funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+            funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
+            funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
+            funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            multiDrawArrays(GL_TRIANGLE_STRIP, first2.constData(), count2.constData(), drawcount);
+
+            /* Second, draw vertical lines for disconnected points. */
+
+            if (!batch.dense)
+            {
+                funcs->glUniform1i(tstripUniform, 0);
+
+                multiDrawArrays(GL_LINES, first2.constData(), count2.constData(), drawcount);
+            }
+        }
+
+
+        /* Third, draw the mean line. */
+
+        funcs->glUniform1f(opacityUniform, 1.0);
+
+        funcs->glUniform1i(tstripUniform, 1);
+
+        GLsizei stride;
+        uintptr_t valueoffset;
+        uintptr_t flagsoffset;
+        pointLayout(batch.raw, &stride, &valueoffset, &flagsoffset);
+
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) 0);
+        funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) valueoffset);
+        funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) flagsoffset);
+        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+        funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
+        funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if (meanLine)
+        {
+            multiDrawArrays(GL_LINE_STRIP, batch.first.constData(), batch.count.constData(), drawcount);
+        }
+
+
+        /* Fourth, draw the points. */
+
+        if (!batch.dense)
+        {
+            funcs->glUniform1i(tstripUniform, 0);
+
+            multiDrawArrays(GL_POINTS, batch.first.constData(), batch.count.constData(), drawcount);
+        }
+
+        /* Two vertices per point for the background and vertical lines,
+         * and one for the mean line and points.
+         */
+        int passes = (meanLine ? 1 : 0) + (batch.dense ? 0 : 1) + (batch.raw ? 0 : 1 + (batch.dense ? 0 : 1));
+        int vertices = (meanLine ? 1 : 0) + (batch.dense ? 0 : 1) + (batch.raw ? 0 : 2 + (batch.dense ? 0 : 2));
+        stats.drawcalls += passes;
+        for (int j = 0; j != drawcount; j++)
+        {
+            stats.vertices += vertices * batch.count[j];
+        }
+    }
+}
+
+void CacheEntry::renderMeanLinesAA(QOpenGLExtraFunctions* funcs, GLuint corners,
+                                   const QList<QSharedPointer<CacheEntry>>& entries,
+                                   const QVector<struct pointrange>& ranges,
+                                   float yStart, float yEnd, int64_t tStart, int64_t tEnd,
+                                   int64_t timeOffset,
+                                   GLint axisMatUniform, GLint axisVecUniform,
+                                   struct drawstats& stats)
+{
+    float matrix[9];
+    float vector[2];
+
+    /* The matrix is the same as in renderPlot. */
+    matrix[0] = 2.0f / (tEnd - tStart);
+    matrix[1] = 0.0f;
+    matrix[2] = 0.0f;
+    matrix[3] = 0.0f;
+    matrix[4] = -2.0f / (yEnd - yStart);
+    matrix[5] = 0.0f;
+    matrix[6] = -1.0f;
+    matrix[7] = 1.0f;
+    matrix[8] = 1.0f;
+
+    funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
+
+    /* Every vertex of an instance is at one corner of the quad... */
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, corners);
+    funcs->glVertexAttribPointer(CORNER_ATTR_LOC, 2, GL_FLOAT, GL_FALSE, 0, (const void*) 0);
+    funcs->glEnableVertexAttribArray(CORNER_ATTR_LOC);
+
+    /* ...of the segment between two consecutive points. */
+    const GLuint perinstance[] = { TIME_ATTR_LOC, VALUE_ATTR_LOC, FLAGS_ATTR_LOC,
+                                   TIME1_ATTR_LOC, VALUE1_ATTR_LOC, FLAGS1_ATTR_LOC };
+    for (GLuint loc : perinstance)
+    {
+        funcs->glEnableVertexAttribArray(loc);
+        funcs->glVertexAttribDivisor(loc, 1);
+    }
+
+    for (int i = 0; i != entries.size(); i++)
+    {
+        const CacheEntry* ce = entries[i].data();
+        const struct pointrange& range = ranges[i];
+        Q_ASSERT(ce->prepared);
+        if (ce->vboref.isNull() || range.count < 2)
+        {
+            continue;
+        }
+
+        /* The offset vector is the same as in renderPlot. */
+        vector[0] = (float) (tStart - ce->epoch - timeOffset - ((Q_INT64_C(1) << ce->pwe) >> 1));
+        vector[1] = yStart;
+        funcs->glUniform2fv(axisVecUniform, 1, vector);
+
+        GLsizei stride;
+        uintptr_t valueoffset;
+        uintptr_t flagsoffset;
+        pointLayout(ce->rawvbo, &stride, &valueoffset, &flagsoffset);
+        Q_ASSERT(ce->vboref->getArena() == ce->vboArena());
+
+        uintptr_t base = (ce->vboref->getOffset() + ce->vbooffset + range.first) * stride;
+        uintptr_t next = base + stride;
+
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, ce->vboref->getBuffer());
+        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) base);
+        funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (base + valueoffset));
+        funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (base + flagsoffset));
+        funcs->glVertexAttribPointer(TIME1_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) next);
+        funcs->glVertexAttribPointer(VALUE1_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (next + valueoffset));
+        funcs->glVertexAttribPointer(FLAGS1_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) (next + flagsoffset));
+
+        funcs->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, range.count - 1);
+
+        stats.drawcalls++;
+        stats.vertices += 4 * (range.count - 1);
+    }
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    /* The other programs use the same locations, one point per vertex. */
+    for (GLuint loc : perinstance)
+    {
+        funcs->glVertexAttribDivisor(loc, 0);
+    }
+    funcs->glDisableVertexAttribArray(TIME1_ATTR_LOC);
+    funcs->glDisableVertexAttribArray(VALUE1_ATTR_LOC);
+    funcs->glDisableVertexAttribArray(FLAGS1_ATTR_LOC);
+    funcs->glDisableVertexAttribArray(CORNER_ATTR_LOC);
+}
+
+void CacheEntry::addMultiRanges(const QList<QSharedPointer<CacheEntry>>& entries,
+                                const QVector<struct pointrange>& ranges,
+                                float yStart, float yEnd, int64_t tStart, int64_t timeOffset,
+                                const float* color, bool alwaysConnect,
+                                QVector<struct multigroup>& groups)
+{
+    Q_ASSERT(entries.size() == ranges.size());
+
+    for (int i = 0; i != entries.size(); i++)
+    {
+        const QSharedPointer<CacheEntry>& ce = entries[i];
+        const struct pointrange& range = ranges[i];
+        Q_ASSERT(ce->prepared);
+        if (ce->vboref.isNull() || range.count <= 0)
+        {
+            continue;
+        }
+
+        struct multirange mr;
+        mr.first = ce->vboref->getOffset() + ce->vbooffset + range.first;
+        mr.count = range.count;
+
+        /* The same transform as the matrix and vector in renderPlot. */
+        mr.axis[0] = (float) (tStart - ce->epoch - timeOffset - ((Q_INT64_C(1) << ce->pwe) >> 1));
+        mr.axis[1] = yStart;
+        mr.axis[2] = -2.0f / (yEnd - yStart);
+        mr.axis[3] = alwaysConnect ? 1.0f : 0.0f;
+        memcpy(mr.color, color, sizeof(mr.color));
+        mr.dense = range.dense;
+        mr.raw = ce->rawvbo;
+        Q_ASSERT(ce->vboref->getArena() == ce->vboArena());
+
+        /* A stream's entries are usually in the group it added to last. */
+        GLuint vbo = ce->vboref->getBuffer();
+        int g = groups.size() - 1;
+        while (g >= 0 && groups[g].vbo != vbo)
+        {
+            g--;
+        }
+        if (g < 0)
+        {
+            struct multigroup group;
+            group.vbo = vbo;
+            groups.append(group);
+            g = groups.size() - 1;
+        }
+        groups[g].ranges.append(mr);
+    }
+}
+
+/* Returns true if R shares any points with one of the LEN ranges in CHUNK. */
+static bool overlapsChunk(const struct multirange* chunk, int len, const struct multirange& r)
+{
+    for (int i = 0; i != len; i++)
+    {
+        if (r.first < chunk[i].first + chunk[i].count && chunk[i].first < r.first + r.count)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Draws MODE for the ranges in CHUNK, with VERTS vertices per point, and
+ * without those that are dense if SKIPDENSE is true.
+ */
+static void drawMultiChunk(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                           const struct multirange* chunk, int len, GLenum mode, int verts,
+                           bool skipdense, struct drawstats& stats)
+{
+    GLint first[MULTI_STREAM_RANGES];
+    GLsizei count[MULTI_STREAM_RANGES];
+    int drawcount = 0;
+    for (int i = 0; i != len; i++)
+    {
+        if (skipdense && chunk[i].dense)
+        {
+            continue;
+        }
+        first[drawcount] = chunk[i].first * verts;
+        count[drawcount] = chunk[i].count * verts;
+        stats.vertices += count[drawcount];
+        drawcount++;
+    }
+
+    if (drawcount == 0)
+    {
+        return;
+    }
+
+    if (multiDrawArrays != nullptr)
+    {
+        multiDrawArrays(mode, first, count, drawcount);
+        stats.drawcalls++;
+    }
+    else
+    {
+        for (int i = 0; i != drawcount; i++)
+        {
+            funcs->glDrawArrays(mode, first[i], count[i]);
+        }
+        stats.drawcalls += drawcount;
+    }
+}
+
+void CacheEntry::renderPlotMulti(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                 const QVector<struct multigroup>& groups,
+                                 int64_t tStart, int64_t tEnd, const struct multiuniforms& uniforms,
+                                 bool meanLine, struct drawstats& stats)
+{
+    funcs->glUniform1f(uniforms.timeScale, 2.0f / (tEnd - tStart));
+    funcs->glUniform1f(uniforms.pointsize, 3.0f);
+
+    GLint starts[MULTI_STREAM_RANGES];
+    float axes[4 * MULTI_STREAM_RANGES];
+    float colors[3 * MULTI_STREAM_RANGES];
+
+    int order[MULTI_STREAM_RANGES];
+
+    for (auto i = groups.begin(); i != groups.end(); i++)
+    {
+        GLuint vbo = i->vbo;
+        const QVector<struct multirange>& ranges = i->ranges;
+
+        /* The ranges are drawn in the order they were added, so a chunk of
+         * them is drawn with one call per pass. Each vertex must find a
+         * single range, so a chunk ends before a range that overlaps one
+         * already in it.
+         */
+        int chunkstart = 0;
+        while (chunkstart != ranges.size())
+        {
+            int chunkend = chunkstart + 1;
+            while (chunkend != ranges.size() && chunkend - chunkstart != MULTI_STREAM_RANGES &&
+                   !overlapsChunk(&ranges.constData()[chunkstart], chunkend - chunkstart, ranges[chunkend]))
+            {
+                chunkend++;
+            }
+
+            const struct multirange* chunk = &ranges.constData()[chunkstart];
+            int len = chunkend - chunkstart;
+
+            /* Each vertex finds its range with a binary search over the
+             * start of each range, so the uniforms are sorted by start.
+             */
+            for (int j = 0; j != len; j++)
+            {
+                order[j] = j;
+            }
+            std::sort(order, order + len, [chunk](int a, int b)
+            {
+                return chunk[a].first < chunk[b].first;
+            });
+            for (int j = 0; j != len; j++)
+            {
+                const struct multirange& mr = chunk[order[j]];
+                starts[j] = mr.first;
+                memcpy(&axes[4 * j], mr.axis, sizeof(mr.axis));
+                memcpy(&colors[3 * j], mr.color, sizeof(mr.color));
+            }
+            funcs->glUniform1i(uniforms.rangeCount, len);
+            funcs->glUniform1iv(uniforms.rangeStart, len, starts);
+            funcs->glUniform4fv(uniforms.rangeAxis, len, axes);
+            funcs->glUniform3fv(uniforms.rangeColor, len, colors);
+
+            /* The same four passes as renderPlot. First, the min-max
+             * background, and the vertical lines for disconnected points,
+             * which raw points don't have. A VBO holds either kind of
+             * point, but not both.
+             */
+            bool raw = chunk[0].raw;
+            if (!raw)
+            {
+                funcs->glUniform1i(uniforms.vertsPerPoint, 2);
+                funcs->glUniform1f(uniforms.opacity, 0.5);
+
+                funcs->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+                funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) 0);
+                funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) sizeof(float));
+                funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void*) (4 * sizeof(float)));
+                funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+                funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
+                funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
+                funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+                funcs->glUniform1i(uniforms.tstrip, 1);
+                drawMultiChunk(funcs, multiDrawArrays, chunk, len, GL_TRIANGLE_STRIP, 2, false, stats);
+
+                funcs->glUniform1i(uniforms.tstrip, 0);
+                drawMultiChunk(funcs, multiDrawArrays, chunk, len, GL_LINES, 2, true, stats);
+            }
+
+            /* Then the mean line and the points. */
+            funcs->glUniform1i(uniforms.vertsPerPoint, 1);
+            funcs->glUniform1f(uniforms.opacity, 1.0);
+
+            GLsizei stride;
+            uintptr_t valueoffset;
+            uintptr_t flagsoffset;
+            pointLayout(raw, &stride, &valueoffset, &flagsoffset);
+
+            funcs->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) 0);
+            funcs->glVertexAttribPointer(VALUE_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) valueoffset);
+            funcs->glVertexAttribPointer(FLAGS_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) flagsoffset);
+            funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+            funcs->glEnableVertexAttribArray(VALUE_ATTR_LOC);
+            funcs->glEnableVertexAttribArray(FLAGS_ATTR_LOC);
+            funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            if (meanLine)
+            {
+                funcs->glUniform1i(uniforms.tstrip, 1);
+                drawMultiChunk(funcs, multiDrawArrays, chunk, len, GL_LINE_STRIP, 1, false, stats);
+            }
+
+            funcs->glUniform1i(uniforms.tstrip, 0);
+            drawMultiChunk(funcs, multiDrawArrays, chunk, len, GL_POINTS, 1, true, stats);
+
+            chunkstart = chunkend;
+        }
+    }
+}
+
+void CacheEntry::renderDDPlotBatch(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                   const QList<QSharedPointer<CacheEntry>>& entries,
+                                   const QVector<struct pointrange>& ranges,
+                                   float yStart, float yEnd, int64_t tStart, int64_t tEnd,
+                                   int64_t timeOffset,
+                                   GLint axisMatUniform, GLint axisVecUniform,
+                                   struct drawstats& stats)
+{
+    QVector<struct drawbatch> batches;
+    CacheEntry::batchEntries(entries, ranges, true, batches);
+
+    float matrix[9];
+    float vector[2];
+
+    /* Fill in the matrix in column-major order. */
+    matrix[0] = 2.0f / (tEnd - tStart);
+    matrix[1] = 0.0f;
+    matrix[2] = 0.0f;
+    matrix[3] = 0.0f;
+    matrix[4] = -2.0f / (yEnd - yStart);
+    matrix[5] = 0.0f;
+    matrix[6] = -1.0f;
+    matrix[7] = 1.0f;
+    matrix[8] = 1.0f;
+
+    funcs->glUniformMatrix3fv(axisMatUniform, 1, GL_FALSE, matrix);
+
+    for (auto i = batches.begin(); i != batches.end(); i++)
+    {
+        const struct drawbatch& batch = *i;
+        GLsizei drawcount = batch.first.size();
+
+        /* The offset vector is the same as in renderDDPlot. */
+        vector[0] = (float) (tStart - batch.epoch - timeOffset) + (Q_INT64_C(1) << batch.pwe) / 2.0f;
+        vector[1] = yStart;
+        funcs->glUniform2fv(axisVecUniform, 1, vector);
+
+        /* The data density plot uses two vertices per point. */
+        QVector<GLint> first2(drawcount);
+        QVector<GLsizei> count2(drawcount);
+        for (int j = 0; j != drawcount; j++)
+        {
+            first2[j] = batch.first[j] << 1;
+            count2[j] = batch.count[j] << 1;
+        }
+
+        /* The layout is the same as in renderDDPlot. */
+        GLsizei stride = batch.compact ? sizeof(struct ddpt) / 2 : sizeof(struct cachedpt) / 2;
+        uintptr_t countoffset = batch.compact ? sizeof(float) : 2 * sizeof(float);
+
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+        funcs->glVertexAttribPointer(TIME_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) 0);
+        funcs->glVertexAttribPointer(COUNT_ATTR_LOC, 1, GL_FLOAT, GL_FALSE, stride, (const void*) countoffset);
+        funcs->glEnableVertexAttribArray(TIME_ATTR_LOC);
+        funcs->glEnableVertexAttribArray(COUNT_ATTR_LOC);
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        multiDrawArrays(GL_LINE_STRIP, first2.constData(), count2.constData(), drawcount);
+
+        stats.drawcalls++;
+        for (int j = 0; j != drawcount; j++)
+        {
+            stats.vertices += count2[j];
+        }
+    }
+}
+
+void CacheEntry::getRange(int64_t starttime, int64_t endtime, bool count, float& minimum, float& maximum)
+{
+    float relstart = (float) (starttime - this->epoch);
+    float relend = (float) (endtime - this->epoch);
+
+    if (this->raw != nullptr)
+    {
+        /* Each raw point counts as one. */
+        for (int i = 0; i < this->cachedlen; i++)
+        {
+            const struct rawcachedpt* pt = &this->raw[i];
+            if (isRealPoint(*pt) && pt->reltime >= relstart && pt->reltime <= relend)
+            {
+                if (count)
+                {
+                    maximum = qMax(maximum, 1.0f);
+                }
+                else
+                {
+                    minimum = qMin(minimum, pt->value);
+                    maximum = qMax(maximum, pt->value);
+                }
+            }
+        }
+        return;
+    }
+
+    if (this->cached == nullptr)
+    {
+        /* Only the summary is left. Blocks that straddle the interval are
+         * counted in full, which may widen the range slightly, so fetch
+         * the points again for next time.
+         */
+        bool straddles = false;
+        for (int b = 0; b < this->summarylen; b++)
+        {
+            const struct blocksummary& block = this->summary[b];
+            if (block.endtime >= relstart && block.starttime <= relend)
+            {
+                straddles = straddles || block.starttime < relstart || block.endtime > relend;
+                if (count)
+                {
+                    maximum = qMax(maximum, block.truecount);
+                }
+                else
+                {
+                    minimum = qMin(minimum, block.min);
+                    maximum = qMax(maximum, block.max);
+                }
+            }
+        }
+        if (straddles && !this->evicted && !this->isdecimation)
+        {
+            Q_ASSERT(this->cachepos->data() == this);
+            this->maincache->restoreHostCopy(*this->cachepos);
+        }
+        return;
+    }
+
+    for (int i = 0; i < cachedlen; i++)
+    {
+        struct cachedpt* pt = &this->cached[i];
+        if (pt->flags != FLAGS_GAP && pt->flags != FLAGS_ALWAYS_HIDE && pt->reltime >= relstart && pt->reltime <= relend)
+        {
+            if (count)
+            {
+                maximum = qMax(maximum, pt->truecount);
+            }
+            else
+            {
+                minimum = qMin(minimum, pt->min);
+                maximum = qMax(maximum , pt->max);
+            }
+        }
+    }
+}
+
+uint qHash(const CacheEntry& key, uint seed)
+{
+    return qHash(key.start) ^ qHash(key.end) ^ seed;
+}
+
+uint qHash(const QSharedPointer<CacheEntry>& key, uint seed)
+{
+    return qHash(key.data(), seed);
+}
+
+Cache::Cache() : vbos(CACHED_POINT_SIZE), ddvbos(sizeof(struct ddpt)), rawvbos(sizeof(struct rawcachedpt)),
+    cache(), outstanding(), loading(), lru()
+{
+    Q_ASSERT(sizeof(struct cachedpt) == 40);
+    Q_ASSERT(sizeof(struct rawcachedpt) == 12);
+    this->curr_queryid = 0;
+    this->cost = 0;
+    this->vramcost = 0;
+    this->releasehostcopies = false;
+    this->requester = new Requester;
+
+    this->begunChangedRangesUpdateLoop = false;
+}
+
+Cache::~Cache()
+{
+    for (auto i = this->cache.begin(); i != this->cache.end(); i++)
+    {
+        delete[] i->entries;
+    }
+    delete this->requester;
+}
+
+/*
+ * There are two ways we could do this.
+ * 1) requestData returns a list of entries that were cache hits,
+ *    and entries that missed in the cache are returned
+ *    asynchronously via a signal.
+ * 2) requestData accepts a callbackthat is fired with a list of
+ *    all cache entries in the range.
+ *
+ * The first way allows the plot to update as data becomes
+ * available; the second way allows the plot to wait until
+ * all data is available before updating the view.
+ *
+ * I think we'll go with the second way, for now. It requires us
+ * to do more bookkeeping since we have to remember the request
+ * associated to each chunk of data we get back, but it provides
+ * for a cleaner API overall.
+ */
+void Cache::requestData(DataSource* source, const QUuid& uuid, int64_t start, int64_t end,
+                        uint8_t pwe, std::function<void(QList<QSharedPointer<CacheEntry>>, bool)> callback,
+                        uint64_t request_hint, bool includemargins)
+{
+    Q_ASSERT(pwe < PWE_MAX);
+    QList<QSharedPointer<CacheEntry>>* result = new QList<QSharedPointer<CacheEntry>>;
+    StreamKey sk(uuid, source);
+
+    bool initscache = !this->cache.contains(sk);
+
+    struct streamcache& scache = this->cache[sk];
+    if (initscache)
+    {
+        scache.cachedbytes = 0;
+        CLEAR_CACHED_BOUNDS(scache);
+        scache.oldestgen = GENERATION_MAX;
+        scache.nextcheck = 0;
+        scache.checkinterval = CHANGED_RANGES_REQUEST_INTERVAL;
+        scache.lrupos = this->lru.end();
+        scache.entries = nullptr;
+    }
+
+    /* Streams that are on screen are checked for changes more often. */
+    int64_t now = QDateTime::currentMSecsSinceEpoch();
+    scache.lastused = now;
+    if (scache.checkinterval > CHANGED_RANGES_REQUEST_INTERVAL)
+    {
+        scache.checkinterval = CHANGED_RANGES_REQUEST_INTERVAL;
+        scache.nextcheck = qMin(scache.nextcheck, now + scache.checkinterval);
+    }
+
+    if (scache.entries == nullptr)
+    {
+        scache.entries = new QMap<int64_t, QSharedPointer<CacheEntry>>[PWE_MAX];
+    }
+
+    QMap<int64_t, QSharedPointer<CacheEntry>>* pwemap = scache.entries;
+
+    QMap<int64_t, QSharedPointer<CacheEntry>>* entries = &pwemap[pwe];
+    QMap<int64_t, QSharedPointer<CacheEntry>>::iterator i;
+
+    uint64_t queryid = this->curr_queryid++;
+    this->outstanding[queryid] = QPair<uint64_t, std::function<void()>>(0, [callback, result]()
     {
         QList<QSharedPointer<CacheEntry>> res = *result;
         delete result;
@@ -903,6 +2771,7 @@ void Cache::requestData(DataSource* source, const QUuid& uuid, int64_t start, in
                          * and therefore no version number. Don't trust the
                          * version number in the callback.
                          */
+                        gapfill->generation = gen;
                         this->updateGeneration(gapfill->streamKey, gen);
                     }
                 }
@@ -939,6 +2808,17 @@ void Cache::requestData(DataSource* source, const QUuid& uuid, int64_t start, in
             this->outstanding[queryid].first++;
             this->loading.insertMulti(entry, queryid);
         }
+        else if (entry->stale)
+        {
+            /* Return the stale data right away, so that there's something
+             * to draw, and fetch fresh data to replace it. The stale entry
+             * stays at the end of the LRU list.
+             */
+            if (entry->replacement.isNull())
+            {
+                this->refetchStale(source, entry, entry->keephostcopy);
+            }
+        }
         else
         {
             this->use(entry, false);
@@ -1030,6 +2910,10 @@ void Cache::requestBrackets(DataSource* source, const QList<QUuid> uuids,
             if (mustinit)
             {
                 scache.cachedbytes = 0;
+                scache.oldestgen = GENERATION_MAX;
+                scache.lastused = 0;
+                scache.nextcheck = 0;
+                scache.checkinterval = CHANGED_RANGES_REQUEST_INTERVAL;
                 scache.lrupos = this->lru.end();
                 scache.entries = new QMap<int64_t, QSharedPointer<CacheEntry>>[PWE_MAX];
             }
@@ -1059,7 +2943,8 @@ void Cache::requestBrackets(DataSource* source, const QList<QUuid> uuids,
     this->beginChangedRangesUpdateLoopIfNotBegun();
 }
 
-void Cache::dropRanges(const StreamKey& sk, const struct timerange* ranges, int len)
+void Cache::dropRanges(const StreamKey& sk, const struct timerange* ranges, int len,
+                       const struct genbucket* bucket)
 {
     if (len == 0 || !this->cache.contains(sk))
     {
@@ -1097,7 +2982,18 @@ void Cache::dropRanges(const StreamKey& sk, const struct timerange* ranges, int
                 }
             }
 
-            if (itvlOverlap(ranges[ridx].start, ranges[ridx].end, ce->start, ce->end))
+            if (!itvlOverlap(ranges[ridx].start, ranges[ridx].end, ce->start, ce->end)
+                    || !Cache::inBucket(ce, bucket))
+            {
+                i++;
+            }
+            else if (!ce->isPlaceholder())
+            {
+                /* Keep drawing the old data until it is fetched again. */
+                this->markStale(ce);
+                i++;
+            }
+            else
             {
                 /* Can't manipulate ce after erasing i, since it becomes a dangling reference. */
                 QSharedPointer<CacheEntry> toevict = ce;
@@ -1110,14 +3006,178 @@ void Cache::dropRanges(const StreamKey& sk, const struct timerange* ranges, int
                     return;
                 }
             }
-            else
+        }
+    continueouterloop:
+        ;
+    }
+}
+
+void Cache::spliceRanges(const StreamKey& sk, const struct timerange* ranges, int len,
+                         const struct genbucket* bucket)
+{
+    if (len == 0 || !this->cache.contains(sk))
+    {
+        return;
+    }
+
+    struct streamcache& scache = this->cache[sk];
+
+    for (uint8_t pwe = 0; pwe < PWE_MAX; pwe++)
+    {
+        QMap<int64_t, QSharedPointer<CacheEntry>>* pentries = &scache.entries[pwe];
+        if (pentries->size() == 0)
+        {
+            continue;
+        }
+
+        int64_t pw = Q_INT64_C(1) << pwe;
+        int64_t pwmask = ~(pw - 1);
+
+        /* Index into ranges array. */
+        int ridx = 0;
+
+        auto i = pentries->begin();
+        while (i != pentries->end())
+        {
+            QSharedPointer<CacheEntry> ce = *i;
+
+            while (ranges[ridx].end < ce->start)
+            {
+                ridx++;
+                if (ridx == len)
+                {
+                    goto continueouterloop;
+                }
+            }
+
+            if (!itvlOverlap(ranges[ridx].start, ranges[ridx].end, ce->start, ce->end)
+                    || !Cache::inBucket(ce, bucket))
             {
                 i++;
+                continue;
+            }
+
+            {
+                /* Find the changed windows at this pointwidth within the
+                 * entry, merging the ones that touch.
+                 */
+                QVector<struct timerange> holes;
+                for (int k = ridx; k != len && ranges[k].start <= ce->end; k++)
+                {
+                    struct timerange hole;
+                    hole.start = qMax(ranges[k].start & pwmask, ce->start);
+                    hole.end = qMin(ranges[k].end | (pw - 1), ce->end);
+                    if (hole.end < hole.start)
+                    {
+                        continue;
+                    }
+
+                    if (!holes.isEmpty() && (holes.last().end == INT64_MAX || hole.start <= holes.last().end + 1))
+                    {
+                        holes.last().end = qMax(holes.last().end, hole.end);
+                    }
+                    else
+                    {
+                        holes.append(hole);
+                    }
+                }
+
+                if (!ce->isPlaceholder() && ((ce->cached == nullptr && ce->raw == nullptr) || (holes.size() == 1
+                        && holes[0].start == ce->start && holes[0].end == ce->end)))
+                {
+                    /* The whole entry changed, so there's nothing to split.
+                     * Entries whose points were released can't be split
+                     * either, so they are fetched again in full, and keep
+                     * their points after that.
+                     */
+                    if (ce->cached == nullptr && ce->raw == nullptr)
+                    {
+                        ce->keephostcopy = true;
+                    }
+                    this->markStale(ce);
+                    i++;
+                    continue;
+                }
+
+                /* Keep the parts of the entry outside of the changed windows,
+                 * and mark the parts inside of them as stale.
+                 */
+                QList<QSharedPointer<CacheEntry>> pieces;
+                if (!ce->isPlaceholder() && ce->cachedlen != 0)
+                {
+                    int64_t keepfrom = ce->start;
+                    bool keeprest = true;
+                    for (auto k = holes.begin(); k != holes.end(); k++)
+                    {
+                        if (k->start > keepfrom)
+                        {
+                            QSharedPointer<CacheEntry> piece = ce->slice(keepfrom, k->start - 1);
+                            if (piece != nullptr)
+                            {
+                                pieces.append(piece);
+                            }
+                        }
+
+                        QSharedPointer<CacheEntry> stalepiece = ce->slice(k->start, k->end);
+                        if (stalepiece != nullptr)
+                        {
+                            stalepiece->stale = true;
+                            pieces.append(stalepiece);
+                        }
+
+                        if (k->end == ce->end)
+                        {
+                            keeprest = false;
+                            break;
+                        }
+                        keepfrom = k->end + 1;
+                    }
+
+                    if (keeprest)
+                    {
+                        QSharedPointer<CacheEntry> piece = ce->slice(keepfrom, ce->end);
+                        if (piece != nullptr)
+                        {
+                            pieces.append(piece);
+                        }
+                    }
+                }
+
+                /* Replace the entry with its pieces. Their keys are no larger
+                 * than the entry's, so I stays valid and points past them.
+                 */
+                i = pentries->erase(i);
+                for (auto j = pieces.begin(); j != pieces.end(); j++)
+                {
+                    QSharedPointer<CacheEntry>& piece = *j;
+                    piece->cachepos = pentries->insert(piece->end, piece);
+                    this->use(piece, true);
+                    if (piece->stale)
+                    {
+                        this->markStale(piece);
+                    }
+
+                    /* Account for the pieces before evicting the entry, so
+                     * that the stream isn't mistaken for being empty. Any
+                     * evictions to meet the threshold happen at the end.
+                     */
+                    uint64_t amt = CACHE_ENTRY_OVERHEAD + piece->cost;
+                    scache.cachedbytes += amt;
+                    this->cost += amt;
+                    this->vramcost += piece->vramcost;
+                }
+
+                if (this->evictCacheEntry(ce))
+                {
+                    return;
+                }
             }
         }
     continueouterloop:
         ;
     }
+
+    this->addCost(sk, 0);
 }
 
 void Cache::dropBrackets(const StreamKey& sk)
@@ -1158,14 +3218,126 @@ void Cache::dropStream(const StreamKey& sk)
     this->evictStreamEntry(sk);
 }
 
-void Cache::use(QSharedPointer<CacheEntry> ce, bool firstuse)
+void Cache::use(QSharedPointer<CacheEntry> ce, bool firstuse)
+{
+    if (!firstuse)
+    {
+        this->lru.erase(ce->lrupos);
+    }
+    this->lru.push_front(CostEntry(ce));
+    ce->lrupos = this->lru.begin();
+}
+
+void Cache::markStale(QSharedPointer<CacheEntry> ce)
+{
+    Q_ASSERT(!ce->isPlaceholder());
+
+    /* If fresh data was already on its way, it may predate the change. */
+    ce->stale = true;
+    ce->replacement.clear();
+
+    this->lru.erase(ce->lrupos);
+    this->lru.push_back(CostEntry(ce));
+    ce->lrupos = this->lru.end() - 1;
+}
+
+void Cache::refetchStale(DataSource* source, QSharedPointer<CacheEntry> ce, bool keephostcopy)
+{
+    QSharedPointer<CacheEntry> fresh(new CacheEntry(this, ce->streamKey, ce->start, ce->end, ce->pwe));
+    fresh->keephostcopy = keephostcopy;
+    ce->replacement = fresh;
+
+    this->requester->makeDataRequest(ce->streamKey.uuid, fresh->start, fresh->end, fresh->pwe, source,
+                                     [this, ce, fresh](struct statpt* points, int len, uint64_t gen)
+    {
+        if (ce->evicted || ce->replacement != fresh)
+        {
+            /* The stale entry was evicted, or changed again, while the
+             * request was in flight. Either way, this data isn't needed.
+             */
+            return;
+        }
+        ce->replacement.clear();
+
+        StreamKey sk = ce->streamKey;
+        struct streamcache& scache = this->cache[sk];
+        QMap<int64_t, QSharedPointer<CacheEntry>>& entries = scache.entries[ce->pwe];
+        auto pos = ce->cachepos;
+
+        /* The neighbours have already decided which gaps they fill based
+         * on the stale entry, which has the same bounds as the fresh one.
+         */
+        QSharedPointer<CacheEntry> prev;
+        QSharedPointer<CacheEntry> next;
+        if (pos != entries.begin() && (*(pos - 1))->end + 1 == fresh->start)
+        {
+            prev = *(pos - 1);
+        }
+        if (pos + 1 != entries.end() && fresh->end + 1 == (*(pos + 1))->start)
+        {
+            next = *(pos + 1);
+        }
+
+        fresh->cacheData(points, len, prev, next);
+        if (len != 0)
+        {
+            fresh->generation = gen;
+        }
+
+        /* Swap the fresh entry in, and account for it before evicting the
+         * stale one so that the stream isn't mistaken for being empty.
+         */
+        *pos = fresh;
+        fresh->cachepos = pos;
+        this->use(fresh, true);
+
+        uint64_t amt = CACHE_ENTRY_OVERHEAD + fresh->cost;
+        scache.cachedbytes += amt;
+        this->cost += amt;
+
+        this->evictCacheEntry(ce);
+        if (len != 0)
+        {
+            this->updateGeneration(sk, gen);
+        }
+        this->addCost(sk, 0);
+
+        if (this->entriesReplaced)
+        {
+            this->entriesReplaced();
+        }
+    });
+}
+
+void Cache::restoreHostCopy(QSharedPointer<CacheEntry> ce)
 {
-    if (!firstuse)
+    /* A stale entry is fetched again anyway, as soon as it is requested. */
+    if (ce->cached != nullptr || ce->raw != nullptr || ce->evicted || ce->stale || !ce->replacement.isNull())
     {
-        this->lru.erase(ce->lrupos);
+        return;
     }
-    this->lru.push_front(CostEntry(ce));
-    ce->lrupos = this->lru.begin();
+    this->refetchStale(ce->streamKey.source, ce, true);
+}
+
+bool Cache::getReleaseHostCopies() const
+{
+    return this->releasehostcopies;
+}
+
+void Cache::setReleaseHostCopies(bool enable)
+{
+    this->releasehostcopies = enable;
+}
+
+void Cache::releaseCost(const StreamKey& sk, uint64_t amt)
+{
+    Q_ASSERT(this->cache.contains(sk));
+
+    struct streamcache& scache = this->cache[sk];
+    Q_ASSERT(amt <= scache.cachedbytes && amt <= this->cost);
+
+    scache.cachedbytes -= amt;
+    this->cost -= amt;
 }
 
 void Cache::addCost(const StreamKey& sk, uint64_t amt)
@@ -1187,7 +3359,7 @@ void Cache::addCost(const StreamKey& sk, uint64_t amt)
     scache.cachedbytes += amt;
     this->cost += amt;
 
-    while (this->cost >= CACHE_THRESHOLD && !this->lru.empty())
+    while ((this->cost >= CACHE_THRESHOLD || this->vramcost >= CACHE_VRAM_THRESHOLD) && !this->lru.empty())
     {
         CostEntry& todrop = this->lru.last();
         QSharedPointer<CacheEntry> ceptr;
@@ -1242,6 +3414,9 @@ bool Cache::evictCacheEntry(const QSharedPointer<CacheEntry> todrop)
 
         /* Remove from the LRU list. */
         this->lru.erase(todrop->lrupos);
+
+        Q_ASSERT(todrop->vramcost <= this->vramcost);
+        this->vramcost -= todrop->vramcost;
     }
 
     Q_ASSERT(dropvalue <= this->cost);
@@ -1307,12 +3482,119 @@ void Cache::updateGeneration(const StreamKey& sk, uint64_t receivedGen)
     }
 }
 
+QVector<struct genbucket> Cache::generationBuckets(const struct streamcache& scache)
+{
+    QVector<struct genbucket> buckets;
+    if (scache.entries == nullptr)
+    {
+        return buckets;
+    }
+
+    /* Collect the distinct generations of the cached data, in order. */
+    QMap<uint64_t, bool> gens;
+    for (uint8_t pwe = 0; pwe < PWE_MAX; pwe++)
+    {
+        const QMap<int64_t, QSharedPointer<CacheEntry>>& entries = scache.entries[pwe];
+        for (auto i = entries.constBegin(); i != entries.constEnd(); i++)
+        {
+            if ((*i)->generation != GENERATION_MAX && !(*i)->stale)
+            {
+                gens.insert((*i)->generation, true);
+            }
+        }
+    }
+
+    if (gens.isEmpty())
+    {
+        return buckets;
+    }
+
+    /* Split them into contiguous runs of about the same length. */
+    int perbucket = (gens.size() + CHANGED_RANGES_MAX_BUCKETS - 1) / CHANGED_RANGES_MAX_BUCKETS;
+    int k = 0;
+    for (auto j = gens.constBegin(); j != gens.constEnd(); j++, k++)
+    {
+        if (k % perbucket == 0)
+        {
+            struct genbucket bucket;
+            bucket.from = j.key();
+            bucket.to = j.key();
+            bucket.oldest = buckets.isEmpty();
+            buckets.append(bucket);
+        }
+        else
+        {
+            buckets.last().to = j.key();
+        }
+    }
+
+    return buckets;
+}
+
+bool Cache::inBucket(const QSharedPointer<CacheEntry>& ce, const struct genbucket* bucket)
+{
+    if (bucket == nullptr)
+    {
+        return true;
+    }
+    if (ce->generation == GENERATION_MAX)
+    {
+        return bucket->oldest;
+    }
+    return ce->generation >= bucket->from && ce->generation <= bucket->to;
+}
+
+void Cache::bumpGenerations(const StreamKey& sk, const struct genbucket& bucket, uint64_t generation)
+{
+    if (!this->cache.contains(sk))
+    {
+        return;
+    }
+
+    struct streamcache& scache = this->cache[sk];
+    if (scache.entries == nullptr)
+    {
+        return;
+    }
+
+    uint64_t oldest = GENERATION_MAX;
+    for (uint8_t pwe = 0; pwe < PWE_MAX; pwe++)
+    {
+        QMap<int64_t, QSharedPointer<CacheEntry>>& entries = scache.entries[pwe];
+        for (auto i = entries.begin(); i != entries.end(); i++)
+        {
+            QSharedPointer<CacheEntry>& ce = *i;
+
+            /* Placeholders get their generation when their data arrives,
+             * and stale entries when they are replaced.
+             */
+            if (ce->stale)
+            {
+                continue;
+            }
+            if (!ce->isPlaceholder() && Cache::inBucket(ce, &bucket))
+            {
+                ce->generation = generation;
+            }
+            oldest = qMin(oldest, ce->generation);
+        }
+    }
+    scache.oldestgen = oldest;
+}
+
 void Cache::beginChangedRangesUpdate()
 {
-    /* Go through all of the streams in the cache and send out a request to get
-     * changed ranges. If we don't have any data yet for the stream, or if there
-     * is already a pending request that has been made, skip over the stream.
+    /* Go through all of the streams in the cache and find the ones that are due
+     * for a changed ranges query. If we don't have any data yet for the stream,
+     * or if there is already a pending request that has been made, skip over
+     * the stream. The cache entries of each remaining stream are grouped into
+     * buckets by generation, and each bucket is checked for changes since its
+     * oldest generation. The queries are batched by data source, resolution,
+     * and bucket.
      */
+    int64_t now = QDateTime::currentMSecsSinceEpoch();
+    QHash<QPair<DataSource*, uint8_t>, QVector<QHash<QUuid, struct genbucket>>> batches;
+
     for (auto i = this->cache.begin(); i != this->cache.end(); i++)
     {
         const StreamKey sk = i.key();
@@ -1329,31 +3611,184 @@ void Cache::beginChangedRangesUpdate()
             continue;
         }
 
-        this->outstandingChangedRangeQueries.insert(sk);
+        if (scache.nextcheck > now)
+        {
+            continue;
+        }
+
+        QVector<struct genbucket> buckets = this->generationBuckets(scache);
+        if (buckets.isEmpty())
+        {
+            continue;
+        }
 
-        this->requester->makeChangedRangesQuery(sk.uuid, scache.oldestgen, 0, sk.source,
-                                                [this, sk](struct timerange* changed, int len, uint64_t gen)
+        /* Ask for changes at the finest pointwidth that is cached. This is
+         * the coarsest resolution that doesn't invalidate more of the cache
+         * than necessary.
+         */
+        uint8_t resolution = 0;
+        while (resolution < PWE_MAX - 1 && scache.entries[resolution].isEmpty())
         {
-            this->performChangedRangesUpdate(sk, changed, len, gen);
-        });
+            resolution++;
+        }
+
+        struct revalidation& rv = this->outstandingChangedRangeQueries[sk];
+        rv.reqsleft = buckets.size();
+        rv.changed = false;
+
+        /* The query reports the points pushed so far as changes. */
+        if (this->tails.contains(sk))
+        {
+            struct tailstate& ts = this->tails[sk];
+            ts.checking += ts.merged;
+            ts.merged.clear();
+        }
+
+        QPair<DataSource*, uint8_t> batchkey(sk.source, resolution);
+        QVector<QHash<QUuid, struct genbucket>>& sourcebatches = batches[batchkey];
+        if (sourcebatches.size() < buckets.size())
+        {
+            sourcebatches.resize(buckets.size());
+        }
+
+        for (int b = 0; b != buckets.size(); b++)
+        {
+            QHash<QUuid, struct genbucket>& batch = sourcebatches[b];
+            batch.insert(sk.uuid, buckets[b]);
+            if (batch.size() == CHANGED_RANGES_BATCH_MAX)
+            {
+                this->sendChangedRangesBatch(sk.source, resolution, batch);
+                batch.clear();
+            }
+        }
+    }
+
+    for (auto j = batches.begin(); j != batches.end(); j++)
+    {
+        for (auto k = j->begin(); k != j->end(); k++)
+        {
+            if (!k->isEmpty())
+            {
+                this->sendChangedRangesBatch(j.key().first, j.key().second, *k);
+            }
+        }
     }
 
     /* Schedule the next changed ranges update. */
-    QTimer::singleShot(CHANGED_RANGES_REQUEST_INTERVAL, Qt::CoarseTimer, [this]()
+    QTimer::singleShot(CHANGED_RANGES_TICK_INTERVAL, Qt::CoarseTimer, [this]()
     {
         this->beginChangedRangesUpdate();
     });
 }
 
-inline void Cache::performChangedRangesUpdate(const StreamKey& sk, struct timerange* changed, int len, uint64_t generation)
+void Cache::sendChangedRangesBatch(DataSource* source, uint8_t pwe, const QHash<QUuid, struct genbucket>& buckets)
+{
+    QHash<QUuid, uint64_t> fromGens;
+    for (auto i = buckets.begin(); i != buckets.end(); i++)
+    {
+        fromGens.insert(i.key(), i->from);
+    }
+
+    this->requester->makeChangedRangesBatch(fromGens, 0, pwe, source,
+                                            [this, source, buckets](QHash<QUuid, struct changedranges> result)
+    {
+        for (auto i = buckets.begin(); i != buckets.end(); i++)
+        {
+            StreamKey sk(i.key(), source);
+            if (result.contains(i.key()))
+            {
+                struct changedranges& cr = result[i.key()];
+                this->performChangedRangesUpdate(sk, *i, cr.ranges.data(), cr.ranges.size(), cr.gen);
+            }
+            else
+            {
+                this->performChangedRangesUpdate(sk, *i, nullptr, 0, GENERATION_MAX);
+            }
+        }
+    });
+}
+
+inline void Cache::performChangedRangesUpdate(const StreamKey& sk, const struct genbucket& bucket,
+                                              struct timerange* changed, int len, uint64_t generation)
 {
-    bool removed = this->outstandingChangedRangeQueries.remove(sk);
-    Q_ASSERT(removed); // Until I'm sure I'm getting this right
+    bool outstanding = this->outstandingChangedRangeQueries.contains(sk);
+    Q_ASSERT(outstanding); // Until I'm sure I'm getting this right
+    if (!outstanding)
+    {
+        return;
+    }
+
+    struct revalidation& rv = this->outstandingChangedRangeQueries[sk];
+    rv.changed = rv.changed || len != 0;
+    bool done = (--rv.reqsleft == 0);
+    bool changedany = rv.changed;
+
+    QVector<struct timerange> pushed;
+    if (this->tails.contains(sk))
+    {
+        struct tailstate& ts = this->tails[sk];
+        pushed = ts.checking + ts.merged;
+        if (done)
+        {
+            ts.checking.clear();
+        }
+    }
+
+    if (done)
+    {
+        this->outstandingChangedRangeQueries.remove(sk);
+    }
+
+    if (!this->cache.contains(sk))
+    {
+        return;
+    }
+
+    if (done)
+    {
+        struct streamcache& scache = this->cache[sk];
+        int64_t now = QDateTime::currentMSecsSinceEpoch();
+        if (!changedany)
+        {
+            /* Nothing changed, so check this stream less often. */
+            scache.checkinterval = qMin(scache.checkinterval << 1, (int64_t) CHANGED_RANGES_MAX_INTERVAL);
+        }
+        else if (now - scache.lastused <= CACHE_VISIBLE_TIME)
+        {
+            scache.checkinterval = CHANGED_RANGES_MIN_INTERVAL;
+        }
+        else
+        {
+            scache.checkinterval = CHANGED_RANGES_REQUEST_INTERVAL;
+        }
+        scache.nextcheck = now + scache.checkinterval;
+    }
 
-    if (removed && this->cache.contains(sk) && len != 0)
+    if (len != 0)
     {
         struct streamcache& scache = this->cache[sk];
-        scache.oldestgen = generation;
+
+        /* Changes that lie within a push that has been merged into the
+         * cache are those points, so there's no need to drop them.
+         */
+        QVector<struct timerange> unseen;
+        if (!pushed.isEmpty())
+        {
+            for (int i = 0; i != len; i++)
+            {
+                bool seen = false;
+                for (auto j = pushed.begin(); j != pushed.end() && !seen; j++)
+                {
+                    seen = (changed[i].start >= j->start && changed[i].end <= j->end);
+                }
+                if (!seen)
+                {
+                    unseen.append(changed[i]);
+                }
+            }
+            changed = unseen.data();
+            len = unseen.size();
+        }
 
         if (len != 0 && CACHED_BOUNDS(scache))
         {
@@ -1364,7 +3799,25 @@ inline void Cache::performChangedRangesUpdate(const StreamKey& sk, struct timera
             }
         }
 
-        this->dropRanges(sk, changed, len);
+        /* Only the entries in this bucket are invalidated. Newer entries
+         * were fetched after some of these changes, and are checked by the
+         * query for their own bucket.
+         */
+#ifdef SPLICE_CHANGED_RANGES
+        this->spliceRanges(sk, changed, len, &bucket);
+#else
+        this->dropRanges(sk, changed, len, &bucket);
+#endif
+    }
+
+    /* The entries of the bucket that remain are now known to be current,
+     * so the next query for them can start from the new generation. A
+     * stream with no changes reports the generation it was asked from,
+     * which may be older than the newest entries in the bucket.
+     */
+    if (generation != GENERATION_MAX)
+    {
+        this->bumpGenerations(sk, bucket, qMax(generation, bucket.to));
     }
 }
 
@@ -1376,3 +3829,154 @@ void Cache::beginChangedRangesUpdateLoopIfNotBegun()
         this->beginChangedRangesUpdate();
     }
 }
+
+void Cache::setLiveTail(DataSource* source, const QUuid& uuid, bool enable)
+{
+    StreamKey sk(uuid, source);
+
+    if (enable)
+    {
+        struct tailstate& ts = this->tails[sk];
+        if (ts.refs++ != 0)
+        {
+            return;
+        }
+
+        ts.merged.clear();
+        ts.checking.clear();
+
+        bool pushes = source->tail(uuid, [this, sk](struct rawpt* points, int len)
+        {
+            this->appendTail(sk, points, len);
+        });
+        if (!pushes)
+        {
+            qDebug("Data source cannot push live data; falling back to polling");
+        }
+    }
+    else if (this->tails.contains(sk))
+    {
+        if (--this->tails[sk].refs == 0)
+        {
+            source->untail(uuid);
+            this->tails.remove(sk);
+        }
+    }
+}
+
+/* Removes the times up to and including SKIPPED from SPANS. */
+static void trimSpans(QVector<struct timerange>& spans, int64_t skipped)
+{
+    for (auto i = spans.begin(); i != spans.end();)
+    {
+        if (i->end <= skipped)
+        {
+            i = spans.erase(i);
+            continue;
+        }
+        i->start = qMax(i->start, skipped + 1);
+        i++;
+    }
+}
+
+void Cache::appendTail(const StreamKey& sk, struct rawpt* points, int len)
+{
+    if (len == 0 || !this->tails.contains(sk))
+    {
+        return;
+    }
+
+    if (this->cache.contains(sk))
+    {
+        struct streamcache& scache = this->cache[sk];
+        if (CACHED_BOUNDS(scache))
+        {
+            scache.upperbound = qMax(scache.upperbound, points[len - 1].time);
+        }
+    }
+
+    int64_t skipped = INT64_MIN;
+
+    /* Extend the newest entry at each pointwidth that has any. */
+    for (uint8_t pwe = 0; pwe < PWE_MAX; pwe++)
+    {
+        /* Adding cost may have evicted the whole stream. */
+        if (!this->cache.contains(sk) || this->cache[sk].entries == nullptr)
+        {
+            break;
+        }
+
+        QMap<int64_t, QSharedPointer<CacheEntry>>* pentries = &this->cache[sk].entries[pwe];
+        if (pentries->isEmpty())
+        {
+            continue;
+        }
+
+        auto last = pentries->end() - 1;
+        QSharedPointer<CacheEntry> ce = *last;
+        if (ce->isPlaceholder())
+        {
+            continue;
+        }
+
+        int64_t entryskipped;
+        int64_t grown = ce->appendPoints(points, len, &entryskipped);
+        skipped = qMax(skipped, entryskipped);
+        if (grown == -1)
+        {
+            /* Can't extend it in place, so fetch it again when needed. */
+            pentries->erase(last);
+            if (this->evictCacheEntry(ce))
+            {
+                break;
+            }
+        }
+        else if (grown != 0)
+        {
+            this->addCost(sk, (uint64_t) grown);
+        }
+    }
+
+    /* Only points that were merged into every entry that covers them
+     * count as pushed, so that changes to the others are still picked up
+     * by the changed ranges queries.
+     */
+    struct tailstate& ts = this->tails[sk];
+    if (skipped != INT64_MIN)
+    {
+        trimSpans(ts.merged, skipped);
+        trimSpans(ts.checking, skipped);
+    }
+
+    int first = 0;
+    while (first != len && points[first].time <= skipped)
+    {
+        first++;
+    }
+    if (first != len)
+    {
+        /* Every point written to a live stream is pushed, so a push that
+         * follows the last one leaves no gap between them.
+         */
+        if (!ts.merged.isEmpty() && points[first].time > ts.merged.last().end)
+        {
+            ts.merged.last().end = points[len - 1].time;
+        }
+        else
+        {
+            if (ts.merged.size() == CACHE_TAIL_SPANS)
+            {
+                ts.merged.removeFirst();
+            }
+            struct timerange span;
+            span.start = points[first].time;
+            span.end = points[len - 1].time;
+            ts.merged.append(span);
+        }
+    }
+
+    if (this->tailAppended)
+    {
+        this->tailAppended();
+    }
+}
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <functional>
 
+#include <QOpenGLExtraFunctions>
 #include <QOpenGLFunctions>
 #include <QHash>
 #include <QLinkedList>
@@ -15,6 +16,7 @@
 #include <QVector>
 
 #include "requester.h"
+#include "vboarena.h"
 
 /* One more than the maximum pointwidth. */
 #define PWE_MAX 63
@@ -23,9 +25,79 @@
 /* Currently set to 1 GiB. */
 #define CACHE_THRESHOLD Q_INT64_C(1073741824)
 
-/* Time between changed range queries. */
+/* The number of bytes of GPU memory that the VBOs of the cache entries may
+ * take up before entries are evicted. This is tracked separately from the
+ * threshold above, which covers host memory.
+ */
+#define CACHE_VRAM_THRESHOLD Q_INT64_C(536870912)
+
+/* Time between changed range queries for a stream, by default. */
 #define CHANGED_RANGES_REQUEST_INTERVAL 10000
 
+/* Bounds on the time between changed range queries for a stream. The time
+ * doubles each time a query finds no changes, and drops to the minimum when
+ * a visible stream changes.
+ */
+#define CHANGED_RANGES_MIN_INTERVAL 2000
+#define CHANGED_RANGES_MAX_INTERVAL 600000
+
+/* How often to look for streams that are due for a changed range query. */
+#define CHANGED_RANGES_TICK_INTERVAL 1000
+
+/* The maximum number of streams in a single changed range query. */
+#define CHANGED_RANGES_BATCH_MAX 64
+
+/* The maximum number of generation buckets that the cache entries of a
+ * stream are grouped into for changed range queries. Each bucket costs
+ * one query per stream, but entries in newer buckets are not invalidated
+ * by changes that they already reflect.
+ */
+#define CHANGED_RANGES_MAX_BUCKETS 4
+
+/* A stream counts as visible if its data was requested this recently. */
+#define CACHE_VISIBLE_TIME 30000
+
+/* If defined, the parts of cache entries that overlap a changed range are
+ * cut out and fetched again, rather than dropping the entire entries.
+ */
+#define SPLICE_CHANGED_RANGES
+
+/* The number of extra points reserved, in both memory and the VBO, when
+ * live data is first appended to a Cache Entry.
+ */
+#define CACHE_TAIL_HEADROOM 256
+
+/* The number of spans of pushed points remembered for each live stream
+ * between changed ranges queries. Pushes that arrive in order extend the
+ * last span, so only out-of-order pushes use more than one. Changes in a
+ * forgotten span are fetched again.
+ */
+#define CACHE_TAIL_SPANS 64
+
+/* Cache entries at a pointwidth exponent PWE have epochs that are multiples
+ * of 2^(PWE + CACHE_EPOCH_GRID_SHIFT), so that nearby entries share an epoch
+ * and can be drawn together.
+ */
+#define CACHE_EPOCH_GRID_SHIFT 16
+
+/* Entries at pointwidth exponent 0 keep a compact copy of their points in
+ * host memory instead, since they may need to be decimated. This is the
+ * number of decimations, at different scales, that each of them keeps.
+ */
+#define CACHE_DECIMATION_LEVELS 3
+
+/* The number of buckets at the end of a decimation that it can be extended
+ * from. Appending live points rewrites the last point and the padding
+ * after it, which may each be in a bucket of their own.
+ */
+#define CACHE_DECIMATION_RESUME 4
+
+#define CACHE_SUMMARY_BLOCK 16
+
+/* The signature of glMultiDrawArrays, which is not part of OpenGL ES 2.0. */
+typedef void (QOPENGLF_APIENTRYP MultiDrawArraysFunc)(GLenum mode, const GLint* first,
+                                                      const GLsizei* count, GLsizei drawcount);
+
 class StreamKey
 {
 public:
@@ -48,7 +120,8 @@ enum class CostType
 };
 
 class CacheEntry;
-
+struct decimation;
+struct rawcachedpt;
 
 /* Represents an entity associated with a cost in the cache. Currently there are
  * only two types of entities associated with a cost: (1) Cache Entries, which contain
@@ -68,6 +141,100 @@ public:
 
 class Cache;
 
+/* A range of the points of a Cache Entry that is drawn. */
+struct pointrange
+{
+    int first;
+    int count;
+
+    /* True if the range has so many points per pixel that its points and
+     * the vertical lines for disconnected points are left out, as they
+     * would be hidden under the min-max background anyway.
+     */
+    bool dense;
+};
+
+/* Counts of the work done to draw a frame. */
+struct drawstats
+{
+    int drawcalls;
+    int64_t vertices;
+    int64_t uploaded; // bytes
+    int64_t decimated; // bytes of raw points read to decimate them
+};
+
+/* A summary of a block of consecutive cached points. Times are relative to
+ * the epoch of the entry. The values only cover points that are drawn, and
+ * are -FLT_MAX (or FLT_MAX, for MIN) if there are none.
+ */
+struct blocksummary
+{
+    float starttime;
+    float endtime;
+    float min;
+    float max;
+    float truecount;
+};
+
+/* A group of cache entries that can be drawn with the same uniforms and
+ * vertex attribute pointers. FIRST and COUNT give the range of points in
+ * VBO that each entry draws.
+ */
+struct drawbatch
+{
+    GLuint vbo;
+    bool compact; // VBO holds the compact data density points
+    bool raw; // VBO holds raw points
+    bool dense; // leave out the points and vertical lines
+    int64_t epoch;
+    uint8_t pwe;
+    QVector<GLint> first;
+    QVector<GLsizei> count;
+};
+
+/* The most ranges of points drawn with one set of uniforms by the
+ * multi-stream program. Each takes three uniform vectors in the vertex
+ * shader, and OpenGL ES 3.0 only guarantees 256.
+ */
+#define MULTI_STREAM_RANGES 64
+
+/* A range of points drawn by the multi-stream program, along with the
+ * state of the stream it belongs to. FIRST is the index in the VBO of its
+ * first point.
+ */
+struct multirange
+{
+    GLint first;
+    GLsizei count;
+    float axis[4]; // time base, y base, y scale, 1 if always connected
+    float color[3];
+    bool dense; // leave out the points and vertical lines
+    bool raw; // VBO holds raw points
+};
+
+/* The ranges drawn by the multi-stream program from one VBO, in the order
+ * in which they are drawn.
+ */
+struct multigroup
+{
+    GLuint vbo;
+    QVector<struct multirange> ranges;
+};
+
+/* The uniform locations of the multi-stream program. */
+struct multiuniforms
+{
+    GLint timeScale;
+    GLint vertsPerPoint;
+    GLint tstrip;
+    GLint opacity;
+    GLint pointsize;
+    GLint rangeCount;
+    GLint rangeStart;
+    GLint rangeAxis;
+    GLint rangeColor;
+};
+
 /* A Cache Entry represents a set of contiguous data cached in memory.
  *
  * We need to be careful: two cache entries may be adjacent, but if
@@ -94,25 +261,156 @@ public:
     /* Returns true if CACHEDATA has not been called on this entry. */
     bool isPlaceholder();
 
-    /* Prepares this cache entry for rendering. */
-    void prepare(QOpenGLFunctions* funcs);
+    /* The bytes of host memory and of GPU memory charged to this entry,
+     * including its decimations.
+     */
+    uint64_t getHostCost() const;
+    uint64_t getVRAMCost() const;
+
+    /* Prepares this cache entry for rendering in the main plot or, if DD
+     * is true, in the data density plot. Each has a buffer of its own, so
+     * preparing for one doesn't upload the points needed by the other. The
+     * bytes uploaded are added to STATS.
+     */
+    void prepare(QOpenGLFunctions* funcs, bool dd, struct drawstats& stats);
 
-    /* Returns whether this Cache Entry is ready to be drawn. */
-    bool isPrepared() const;
+    /* Returns whether this Cache Entry is ready to be drawn in the main
+     * plot or, if DD is true, in the data density plot.
+     */
+    bool isPrepared(bool dd) const;
+
+    /* Returns true if points were appended to this cache entry since it
+     * was prepared or last updated.
+     */
+    bool needsUpdate() const;
+
+    /* Uploads the points appended since the last upload to the VBOs. */
+    void update(QOpenGLFunctions* funcs, struct drawstats& stats);
+
+    /* Returns true if this entry can be drawn from its M4 decimation in
+     * buckets of 2^EXPONENT nanoseconds: it is prepared, at pointwidth
+     * exponent 0, and has more points than the decimation would keep.
+     */
+    bool canDecimate(int exponent) const;
 
-    /* Renders the contents of this cache entry in the main plot. */
-    void renderPlot(QOpenGLFunctions* funcs, float yStart,
+    /* Returns the decimation of this entry at EXPONENT if it has been
+     * made, and otherwise the one at the largest exponent below it, or a
+     * null pointer if there is none. EXACT is set to whether the one
+     * returned is at EXPONENT.
+     */
+    QSharedPointer<CacheEntry> getDecimation(int exponent, bool* exact) const;
+
+    /* Makes the M4 decimation of this entry at EXPONENT, unless it has
+     * been made already, and returns an entry that draws it: the first,
+     * last, minimum and maximum point of each run of connected points in
+     * each bucket of 2^EXPONENT nanoseconds, with gaps kept as they are.
+     * Every point left out shares a bucket with kept points whose values
+     * span its own, so with buckets at most half a pixel wide it is drawn
+     * within half a pixel of the lines it would have been drawn on. The
+     * decimated points are uploaded to a VBO of their own, adding to
+     * STATS, and only a summary of them stays in host memory. The
+     * decimation is extended as live points are appended to this entry.
+     * Must be called only when the GUI thread is blocked, and
+     * canDecimate(EXPONENT) is true.
+     */
+    QSharedPointer<CacheEntry> decimate(QOpenGLFunctions* funcs, int exponent, struct drawstats& stats);
+
+    /* Finds the points of this entry that are drawn within the (closed)
+     * interval [TSTART, TEND], along with the nearest point on either side
+     * so that lines to points offscreen are drawn too. Must be called only
+     * when the GUI thread is blocked.
+     */
+    struct pointrange visibleRange(int64_t tStart, int64_t tEnd) const;
+
+    /* Renders the points of this cache entry in RANGE in the main plot.
+     * The mean line is left out unless MEANLINE is true, and the points and
+     * vertical lines are left out if RANGE is dense. This and the other
+     * render functions add the draw calls they make to STATS.
+     */
+    void renderPlot(QOpenGLFunctions* funcs, const struct pointrange& range, float yStart,
                     float yEnd, int64_t tStart, int64_t tEnd,
                     int64_t timeOffset,
                     GLint axisMatUniform, GLint axisVecUniform,
-                    GLint tstripUniform, GLint opacityUniform);
+                    GLint tstripUniform, GLint opacityUniform,
+                    bool meanLine, struct drawstats& stats);
 
-    /* Renders the contents of this cache entry in the data density plot. */
-    void renderDDPlot(QOpenGLFunctions* funcs, float yStart,
+    /* Renders the points of this cache entry in RANGE in the data density
+     * plot.
+     */
+    void renderDDPlot(QOpenGLFunctions* funcs, const struct pointrange& range, float yStart,
                       float yEnd, int64_t tStart, int64_t tEnd,
                       int64_t timeOffset,
-                      GLint axisMatUniform, GLint axisVecUniform);
+                      GLint axisMatUniform, GLint axisVecUniform,
+                      struct drawstats& stats);
 
+    /* Like renderPlot, but renders all of the ENTRIES of a stream with a
+     * few calls to MULTIDRAWARRAYS per group of entries that share a VBO
+     * and an epoch, rather than four draw calls per entry. RANGES gives the
+     * range of points drawn for each entry.
+     */
+    static void renderPlotBatch(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                const QList<QSharedPointer<CacheEntry>>& entries,
+                                const QVector<struct pointrange>& ranges,
+                                float yStart, float yEnd, int64_t tStart, int64_t tEnd,
+                                int64_t timeOffset,
+                                GLint axisMatUniform, GLint axisVecUniform,
+                                GLint tstripUniform, GLint opacityUniform,
+                                bool meanLine, struct drawstats& stats);
+
+    /* Renders the mean lines of the ENTRIES of a stream with the
+     * antialiased line program, drawing each segment as an instance of
+     * the quad in CORNERS. The caller sets the uniforms other than the
+     * axis transform. Requires instanced drawing.
+     */
+    static void renderMeanLinesAA(QOpenGLExtraFunctions* funcs, GLuint corners,
+                                  const QList<QSharedPointer<CacheEntry>>& entries,
+                                  const QVector<struct pointrange>& ranges,
+                                  float yStart, float yEnd, int64_t tStart, int64_t tEnd,
+                                  int64_t timeOffset,
+                                  GLint axisMatUniform, GLint axisVecUniform,
+                                  struct drawstats& stats);
+
+    /* Adds the RANGES of the ENTRIES of a stream to be drawn with the
+     * multi-stream program, to the group of the VBO they are in. Groups
+     * are kept in the order in which they were first added to, and the
+     * ranges in each group in the order in which they were added, so
+     * streams added in the same order overlap the same way in every frame.
+     * The rest of the arguments are as for renderPlot, along with the state
+     * of the stream.
+     */
+    static void addMultiRanges(const QList<QSharedPointer<CacheEntry>>& entries,
+                               const QVector<struct pointrange>& ranges,
+                               float yStart, float yEnd, int64_t tStart, int64_t timeOffset,
+                               const float* color, bool alwaysConnect,
+                               QVector<struct multigroup>& groups);
+
+    /* Renders the ranges collected by addMultiRanges, of any number of
+     * streams, with a few calls to MULTIDRAWARRAYS per group, in order.
+     * The streams' states are passed in uniform arrays, and each vertex
+     * finds its own by its index in the VBO. MULTIDRAWARRAYS may be null,
+     * in which case there is a draw call per range, but no uniforms change
+     * between them.
+     */
+    static void renderPlotMulti(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                const QVector<struct multigroup>& groups,
+                                int64_t tStart, int64_t tEnd, const struct multiuniforms& uniforms,
+                                bool meanLine, struct drawstats& stats);
+
+    /* Like renderDDPlot, but batched in the same way as renderPlotBatch. */
+    static void renderDDPlotBatch(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                  const QList<QSharedPointer<CacheEntry>>& entries,
+                                  const QVector<struct pointrange>& ranges,
+                                  float yStart, float yEnd, int64_t tStart, int64_t tEnd,
+                                  int64_t timeOffset,
+                                  GLint axisMatUniform, GLint axisVecUniform,
+                                  struct drawstats& stats);
+
+    /* Widens MINIMUM and MAXIMUM to the range of the values, or the counts
+     * if COUNT is true, between STARTTIME and ENDTIME. If the points were
+     * released, the summary is used, and the blocks at either end may
+     * widen it slightly; the points are then fetched again, so that the
+     * next call is exact.
+     */
     void getRange(int64_t starttime, int64_t endtime, bool count, float& minimum, float& maximum);
 
     const int64_t start;
@@ -123,6 +421,83 @@ private:
      * are both inclusive. */
     CacheEntry(Cache* c, const StreamKey& sk, int64_t startRange, int64_t endRange, uint8_t pwe);
 
+    /* Merges live raw points, sorted by time, into the windows at the end
+     * of this cache entry. Returns the number of bytes by which the cost of
+     * this entry grew, or -1 if the entry cannot be extended in place (in
+     * which case it should be dropped and fetched again). SKIPPED is set to
+     * the time of the newest point that couldn't be merged (because it was
+     * out of order, or may already be counted), or INT64_MIN if there was
+     * none.
+     */
+    int64_t appendPoints(const struct rawpt* points, int len, int64_t* skipped);
+
+    /* Groups the RANGES of the prepared ENTRIES into batches. If DD is
+     * true, the ranges are narrowed to those drawn in the data density plot.
+     */
+    static void batchEntries(const QList<QSharedPointer<CacheEntry>>& entries,
+                             const QVector<struct pointrange>& ranges, bool dd,
+                             QVector<struct drawbatch>& batches);
+
+    /* Narrows RANGE to the points drawn in the data density plot. */
+    struct pointrange ddRange(const struct pointrange& range) const;
+
+    /* Copies the time and count of the points in CACHED, from index FROM
+     * on, into DDVBOREF.
+     */
+    void uploadDD(QOpenGLFunctions* funcs, int from, struct drawstats& stats);
+
+    /* Updates the GPU memory charged to this entry for its VBOs and those
+     * of its decimations, and the host memory for the summaries of its
+     * decimations, then evicts entries if the cache is over either of its
+     * thresholds. As that may evict this entry, it must be the last thing
+     * done to it.
+     */
+    void chargeVRAM();
+
+    /* Frees the CACHED array, keeping only a summary of it. Must only be
+     * called once the points are in the VBO, and no more can be appended.
+     */
+    void releaseHostCopy();
+
+    /* Makes sure that the CACHED array can hold at least NEEDED points. */
+    void reserve(int needed);
+
+    /* Returns the arena that VBOREF must be in for its points to be drawn
+     * with the layout given by RAWVBO.
+     */
+    VBOArena* vboArena() const;
+
+    /* Whether the point at index I is a real point, and the statistical
+     * point drawn there, from CACHED or, if it was freed, RAW.
+     */
+    bool isRealPointAt(int i) const;
+    void unfillPointAt(struct statpt* output, int i) const;
+
+    /* Returns the points of this entry from index FROM on as raw points,
+     * converting them into CONVERTED if this entry doesn't keep them.
+     */
+    const struct rawcachedpt* rawPoints(int from, QVector<struct rawcachedpt>& converted) const;
+
+    /* Brings the decimations of this entry up to date with its points,
+     * which changed from index FROM on. Those that can't be are dropped,
+     * and made again when they are next drawn.
+     */
+    void extendDecimations(QOpenGLFunctions* funcs, int from, struct drawstats& stats);
+
+    /* Uploads the points of the decimation DEC from index FROM on, given
+     * in KEPT from index DEC.CARRIEDFROM on, and updates its summary and
+     * the points it carries over to the next extension.
+     */
+    void storeDecimation(QOpenGLFunctions* funcs, struct decimation& dec,
+                         const QVector<struct rawcachedpt>& kept, int from, struct drawstats& stats);
+
+    /* Returns a new cache entry spanning [FROM, TO], a subrange of this
+     * entry, that draws the same points as this entry does in that range.
+     * The new entry shares this entry's VBO, if it has one. Returns a null
+     * pointer if no points of this entry fall in the range.
+     */
+    QSharedPointer<CacheEntry> slice(int64_t from, int64_t to);
+
     /* Position of this entry in the cache, with regard to eviction.
      * Handled by the Cache class.
      */
@@ -160,8 +535,109 @@ private:
     /* The length of the CACHED array. */
     int cachedlen;
 
-    /* The VBO used to render this Cache Entry. */
-    GLuint vbo;
+    /* A summary of each block of CACHE_SUMMARY_BLOCK points in CACHED,
+     * kept in its place once it is released, or null if it hasn't been.
+     */
+    struct blocksummary* summary;
+    int summarylen;
+
+    /* The number of points that the CACHED array has room for. */
+    int cachedcap;
+
+    /* The index in CACHED of the last real point, if live data can be
+     * appended after it, or -1 otherwise.
+     */
+    int lastidx;
+
+    /* The time of the newest raw point reflected in this entry. Live
+     * points at or before this time are already accounted for.
+     */
+    int64_t tailtime;
+
+    /* The generation of the stream that the data in this entry is known
+     * to be current as of, or GENERATION_MAX if it is not known (e.g. the
+     * entry is a placeholder, or the fetch returned no points).
+     */
+    uint64_t generation;
+
+    /* True if the data in this entry is known to be out of date. A stale
+     * entry is still drawn until the fresh data that replaces it arrives.
+     */
+    bool stale;
+
+    /* The entry being fetched to replace this stale entry, or this
+     * released one, if any.
+     */
+    QSharedPointer<CacheEntry> replacement;
+
+    /* True if something needed the points of this entry, or of one that
+     * it replaced, after they were released. They are then kept even if
+     * host copies are released, as are those of the entry fetched to
+     * replace this one.
+     */
+    bool keephostcopy;
+
+    /* For an entry at pointwidth exponent 0 that can't have points
+     * appended, its points without the parts that are the same for every
+     * raw point, or null if it hasn't been prepared for the main plot yet.
+     * Once it has been, VBOREF holds points in this form too, and CACHED
+     * is freed.
+     */
+    struct rawcachedpt* raw;
+
+    /* True if VBOREF holds raw points, rather than cached points. */
+    bool rawvbo;
+
+    /* The range of the VBO arena used to render this Cache Entry. It may
+     * be shared with other entries after an entry is split.
+     */
+    QSharedPointer<VBORange> vboref;
+
+    /* The index in VBOREF of the first point of this entry. */
+    int vbooffset;
+
+    /* The range of the data density arena holding only the times and
+     * counts of the points, and the index in it of this entry's first
+     * point. Null if this entry isn't drawn in a data density plot, or if
+     * the host copy was released before it was, in which case the data
+     * density plot draws from VBOREF instead.
+     */
+    QSharedPointer<VBORange> ddvboref;
+    int ddvbooffset;
+    int ddcap;
+
+    /* True if other entries may draw from VBOREF or DDVBOREF as well, in
+     * which case they must not be modified.
+     */
+    bool sharesvbo;
+
+    /* The number of points in the VBOs that are drawn, and the number of
+     * points that VBOREF has room for. These are only modified when the
+     * GUI thread is blocked, so that the render thread may read them.
+     */
+    int gpulen;
+    int gpucap;
+
+    /* The index of the first point in CACHED that differs from the VBOs.
+     * Both VBOs are always brought up to date together.
+     */
+    int dirtyfrom;
+
+    /* The bytes of GPU memory charged to this entry in the cache. */
+    uint64_t vramcost;
+
+    /* The decimations of this entry, by the exponent of their bucket
+     * width.
+     */
+    QMap<int, QSharedPointer<struct decimation>> decimations;
+
+    /* The host memory of the decimations, included in COST. */
+    uint64_t decimationcost;
+
+    /* True if this entry is the decimation of another. It isn't in the
+     * cache, and its memory is charged to the entry it came from.
+     */
+    bool isdecimation;
 
     /* Pointwidth exponent. */
     const uint8_t pwe;
@@ -176,8 +652,11 @@ private:
      */
     bool joinsNext;
 
-    /* True if this cache entry has been prepared. */
+    /* True if this cache entry has been prepared for the main plot, and
+     * for the data density plot.
+     */
     bool prepared;
+    bool ddprepared;
 
     bool connectsToBefore;
     bool connectsToAfter;
@@ -190,10 +669,42 @@ struct streamcache {
     int64_t lowerbound;
     int64_t upperbound;
     uint64_t oldestgen;
+    int64_t lastused; // when data for this stream was last requested, in milliseconds
+    int64_t nextcheck; // when this stream is next due for a changed range query, in milliseconds
+    int64_t checkinterval; // the current time between changed range queries, in milliseconds
     QLinkedList<CostEntry>::iterator lrupos; // always set to cache->lru.end(), unless cachedpts == STREAM_OVERHEAD (in which case this is actually on the LRU list)
     QMap<int64_t, QSharedPointer<CacheEntry>>* entries;
 };
 
+/* A range of generations of cache entries in a stream, which are checked
+ * for changes with a single changed range query. Entries of unknown
+ * generation belong to the oldest bucket.
+ */
+struct genbucket {
+    uint64_t from;
+    uint64_t to;
+    bool oldest;
+};
+
+/* The progress of the changed range queries for one stream. */
+struct revalidation {
+    int reqsleft;
+    bool changed;
+};
+
+struct tailstate {
+    int refs;
+
+    /* The (inclusive) spans of time of the pushes that were merged into
+     * every entry that covers them. CHECKING holds those pushed before the
+     * changed ranges query in flight for the stream was sent, which it
+     * reports and which are forgotten once it is done, and MERGED those
+     * pushed since.
+     */
+    QVector<struct timerange> merged;
+    QVector<struct timerange> checking;
+};
+
 /* Use >= instead of > in case there's only one point in the stream. */
 #define CACHED_BOUNDS(s) ((s).upperbound >= (s).lowerbound)
 #define CLEAR_CACHED_BOUNDS(s) do { \
@@ -204,6 +715,8 @@ struct streamcache {
 
 class Cache
 {
+    friend class CacheEntry;
+
 public:
     Cache();
     ~Cache();
@@ -228,20 +741,84 @@ public:
     void requestBrackets(DataSource* source, const QList<QUuid> uuids,
                          std::function<void(int64_t, int64_t)> callback);
 
-    void dropRanges(const StreamKey& sk, const struct timerange* ranges, int len);
+    /* Marks the cache entries that overlap the RANGES as stale, so that
+     * they are fetched again when next requested. If BUCKET is not null,
+     * only the entries whose generations are in BUCKET are affected.
+     */
+    void dropRanges(const StreamKey& sk, const struct timerange* ranges, int len,
+                    const struct genbucket* bucket = nullptr);
+
+    /* Like dropRanges, but only the parts of the cache entries within
+     * the changed windows are marked as stale. The rest are split off into
+     * separate entries, so that they need not be fetched again.
+     */
+    void spliceRanges(const StreamKey& sk, const struct timerange* ranges, int len,
+                      const struct genbucket* bucket = nullptr);
 
     void dropBrackets(const StreamKey& sk);
 
     void dropStream(const StreamKey& sk);
 
-    /* The VBOs that need to be deleted. */
-    QVector<GLuint> todelete;
+    /* Enables or disables live tailing of a stream. While a stream is
+     * tailed, points pushed by its data source are appended to the newest
+     * cache entry at each pointwidth, rather than waiting for a changed
+     * range query to evict the stale entries. Calls are reference counted.
+     */
+    void setLiveTail(DataSource* source, const QUuid& uuid, bool enable);
+
+    /* Whether the points of each cache entry are released from host
+     * memory once they are uploaded to the GPU, keeping only a summary of
+     * each block of CACHE_SUMMARY_BLOCK points, which is enough for culling
+     * and most of autoscaling. Entries that may have live data appended
+     * keep their points. Anything else that needs the points of a released
+     * entry, such as splitting it when part of it changes, fetches it
+     * again. Off by default; setting it only affects entries uploaded
+     * afterwards.
+     */
+    bool getReleaseHostCopies() const;
+    void setReleaseHostCopies(bool enable);
+
+    /* Called after live data has been appended to the cache. */
+    std::function<void()> tailAppended;
+
+    /* Called after fresh data has replaced a stale cache entry. */
+    std::function<void()> entriesReplaced;
+
+    /* The buffers that hold the points of every prepared Cache Entry, and
+     * the compact copies of them drawn in data density plots. Entries with
+     * raw points keep them in a buffer of their own.
+     */
+    VBOArena vbos;
+    VBOArena ddvbos;
+    VBOArena rawvbos;
     Requester* requester;
 
 private:
     void use(QSharedPointer<CacheEntry> ce, bool firstuse);
+
+    /* Marks a cache entry with data as stale, and moves it to the end of
+     * the LRU list so that it is evicted first.
+     */
+    void markStale(QSharedPointer<CacheEntry> ce);
+
+    /* Fetches fresh data for a stale cache entry in the background, and
+     * swaps it into the cache in place of the stale entry once it arrives.
+     * If KEEPHOSTCOPY is true, the fresh entry keeps its points in host
+     * memory once it is uploaded.
+     */
+    void refetchStale(DataSource* source, QSharedPointer<CacheEntry> ce, bool keephostcopy = false);
+
+    /* Fetches the entry CE again if its points were released, so that
+     * they are in host memory the next time they are needed.
+     */
+    void restoreHostCopy(QSharedPointer<CacheEntry> ce);
     void addCost(const StreamKey& uuid, uint64_t amt);
 
+    /* Reduces the cost of the stream SK by AMT, after a cache entry has
+     * released memory without being evicted.
+     */
+    void releaseCost(const StreamKey& sk, uint64_t amt);
+
     /* Evicts an entry from the cache. Returns true iff it was the last entry for that UUID. */
     bool evictCacheEntry(const QSharedPointer<CacheEntry> todrop);
 
@@ -249,26 +826,49 @@ private:
 
     void updateGeneration(const StreamKey& sk, uint64_t receivedGen);
 
+    /* Groups the generations of the cache entries of a stream into at most
+     * CHANGED_RANGES_MAX_BUCKETS buckets, from oldest to newest.
+     */
+    QVector<struct genbucket> generationBuckets(const struct streamcache& scache);
+    static bool inBucket(const QSharedPointer<CacheEntry>& ce, const struct genbucket* bucket);
+
+    /* Marks the entries in BUCKET as current as of GENERATION. */
+    void bumpGenerations(const StreamKey& sk, const struct genbucket& bucket, uint64_t generation);
+
     void beginChangedRangesUpdate();
-    void performChangedRangesUpdate(const StreamKey& sk, struct timerange* changed, int len, uint64_t generation);
+    void sendChangedRangesBatch(DataSource* source, uint8_t pwe, const QHash<QUuid, struct genbucket>& buckets);
+    void performChangedRangesUpdate(const StreamKey& sk, const struct genbucket& bucket,
+                                    struct timerange* changed, int len, uint64_t generation);
 
     void beginChangedRangesUpdateLoopIfNotBegun();
 
+    void appendTail(const StreamKey& sk, struct rawpt* points, int len);
+
     bool begunChangedRangesUpdateLoop;
 
+    /* The streams that are being tailed, with the number of requests to
+     * tail each one and the points pushed since they were last checked.
+     */
+    QHash<StreamKey, struct tailstate> tails;
+
     uint64_t curr_queryid;
     /* The QMap here maps a timestamp to the cache entry that _ends_ at that timestamp. */
     QHash<StreamKey, struct streamcache> cache; /* Maps UUID to the total cost associated with that UUID and the data for that stream. */
     QHash<uint64_t, QPair<uint64_t, std::function<void()>>> outstanding; /* Maps query id to the number of outstanding requests, and the callback to call when all the data is ready. */
     QHash<QSharedPointer<CacheEntry>, uint64_t> loading; /* Maps cache entry to the list of queries waiting for it. */
 
-    QSet<StreamKey> outstandingChangedRangeQueries; /* The streams for which we are waiting for a response to a changed ranges query. */
+    QHash<StreamKey, struct revalidation> outstandingChangedRangeQueries; /* The streams for which we are waiting for responses to changed ranges queries. */
 
     /* A linked list used to clear cache entries in LRU order. */
     QLinkedList<CostEntry> lru;
 
     /* A representation of the total amount of data in the cache. */
     uint64_t cost;
+
+    /* The GPU memory used by the VBOs of the cache entries, in bytes. */
+    uint64_t vramcost;
+
+    bool releasehostcopies;
 };
 
 #endif // CACHE_H
@@ -1,4 +1,8 @@
 #include "datasource.h"
+#include "requester.h"
+
+#include <QSharedPointer>
+#include <QTimer>
 
 uint64_t DataSource::nextUniqueID = 0;
 
@@ -6,3 +10,58 @@ DataSource::DataSource(QObject *parent)
     : QObject(parent), uniqueID(DataSource::nextUniqueID++)
 {
 }
+
+bool DataSource::tail(const QUuid& uuid, TailCallback callback)
+{
+    Q_UNUSED(uuid);
+    Q_UNUSED(callback);
+    return false;
+}
+
+void DataSource::untail(const QUuid& uuid)
+{
+    Q_UNUSED(uuid);
+}
+
+struct batchstate
+{
+    BatchChangedRangesCallback callback;
+    QHash<QUuid, struct changedranges> result;
+    int reqsleft;
+};
+
+void DataSource::changedRangesBatch(const QHash<QUuid, uint64_t> fromGens, uint64_t toGen, uint8_t pwe, BatchChangedRangesCallback callback)
+{
+    if (fromGens.isEmpty())
+    {
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(QHash<QUuid, struct changedranges>());
+        });
+        return;
+    }
+
+    QSharedPointer<struct batchstate> state(new struct batchstate);
+    state->callback = callback;
+    state->reqsleft = fromGens.size();
+
+    for (auto i = fromGens.begin(); i != fromGens.end(); i++)
+    {
+        QUuid uuid = i.key();
+        this->changedRanges(uuid, i.value(), toGen, pwe, [state, uuid](struct timerange* changed, int len, uint64_t gen)
+        {
+            struct changedranges& cr = state->result[uuid];
+            cr.ranges.reserve(len);
+            for (int j = 0; j != len; j++)
+            {
+                cr.ranges.append(changed[j]);
+            }
+            cr.gen = gen;
+
+            if (--state->reqsleft == 0)
+            {
+                state->callback(state->result);
+            }
+        });
+    }
+}
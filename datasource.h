@@ -7,6 +7,8 @@
 typedef std::function<void(struct statpt*, int len, uint64_t gen)> ReqCallback;
 typedef std::function<void(QHash<QUuid, struct brackets>)> BracketCallback;
 typedef std::function<void(struct timerange*, int len, uint64_t gen)> ChangedRangesCallback;
+typedef std::function<void(struct rawpt*, int len)> TailCallback;
+typedef std::function<void(QHash<QUuid, struct changedranges>)> BatchChangedRangesCallback;
 
 class DataSource : public QObject
 {
@@ -18,6 +20,21 @@ public:
     virtual void brackets(const QList<QUuid> uuids, BracketCallback callback) = 0;
     virtual void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback) = 0;
 
+    /* Gets the changed ranges of several streams at once, each since its own
+     * generation in FROMGENS. The default implementation makes one
+     * changedRanges call per stream; sources that can answer for many
+     * streams in a single query should override it.
+     */
+    virtual void changedRangesBatch(const QHash<QUuid, uint64_t> fromGens, uint64_t toGen, uint8_t pwe, BatchChangedRangesCallback callback);
+
+    /* Asks the backend to push new raw points for the stream as they are
+     * inserted. The points are passed to the CALLBACK in order of time.
+     * Returns false if this source cannot push data, in which case the
+     * stream is only kept up to date by polling for changed ranges.
+     */
+    virtual bool tail(const QUuid& uuid, TailCallback callback);
+    virtual void untail(const QUuid& uuid);
+
 signals:
 
 public slots:
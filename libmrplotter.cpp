@@ -1,21 +1,35 @@
 #include "libmrplotter.h"
 
+#include <aggregatedatasource.h>
 #include <axis.h>
 #include <axisarea.h>
+#ifdef MRPLOTTER_BTRDB
 #include <btrdbdatasource.h>
+#endif
 #include <bwdatasource.h>
 #include <mrplotter.h>
 #include <plotarea.h>
+#include <recorderdatasource.h>
+#include <renderstats.h>
+#include <snapshotrenderer.h>
 
 void initLibMrPlotter()
 {
     qmlRegisterInterface<DataSource>("DataSource");
     qmlRegisterType<BWDataSource>("MrPlotter", 0, 1, "BWDataSource");
+#ifdef MRPLOTTER_BTRDB
+    qmlRegisterType<BTrDBDataSource>("MrPlotter", 0, 1, "BTrDBDataSource");
+#endif
+    qmlRegisterType<RecorderDataSource>("MrPlotter", 0, 1, "RecorderDataSource");
+    qmlRegisterInterface<RawDataSource>("RawDataSource");
+    qmlRegisterType<AggregateDataSource>("MrPlotter", 0, 1, "AggregateDataSource");
 
     qmlRegisterType<YAxis>("MrPlotter", 0, 1, "YAxis");
     qmlRegisterType<Stream>("MrPlotter", 0, 1, "Stream");
     qmlRegisterType<YAxisArea>("MrPlotter", 0, 1, "YAxisArea");
     qmlRegisterType<TimeAxisArea>("MrPlotter", 0, 1, "TimeAxisArea");
     qmlRegisterType<PlotArea>("MrPlotter", 0, 1, "PlotArea");
+    qmlRegisterUncreatableType<RenderStats>("MrPlotter", 0, 1, "RenderStats", "RenderStats is provided by a PlotArea");
     qmlRegisterType<MrPlotter>("MrPlotter", 0, 1, "MrPlotter");
+    qmlRegisterType<SnapshotRenderer>("MrPlotter", 0, 1, "SnapshotRenderer");
 }
@@ -31,6 +31,24 @@ MrPlotter::MrPlotter(): timeaxis(), plots()
     this->id = this->nextID++;
     this->instances.insert(this->id, this);
 
+    /* Redraw every plot when live data arrives. */
+    MrPlotter::cache.tailAppended = []()
+    {
+        for (auto i = MrPlotter::instances.begin(); i != MrPlotter::instances.end(); i++)
+        {
+            (*i)->updateView();
+        }
+    };
+
+    /* Fetch the fresh entries once stale data has been replaced. */
+    MrPlotter::cache.entriesReplaced = []()
+    {
+        for (auto i = MrPlotter::instances.begin(); i != MrPlotter::instances.end(); i++)
+        {
+            (*i)->updateDataAsyncThrottled();
+        }
+    };
+
     this->updateTimer = new QTimer(this);
     this->updateTimer->setSingleShot(false);
     this->updateTimer->setInterval(PLOT_DATA_UPDATE_INTERVAL);
@@ -335,6 +353,16 @@ bool MrPlotter::getTimeTickPromotion()
     return this->timeaxis.getPromoteTicks();
 }
 
+void MrPlotter::setReleaseHostCopies(bool enable)
+{
+    MrPlotter::cache.setReleaseHostCopies(enable);
+}
+
+bool MrPlotter::getReleaseHostCopies()
+{
+    return MrPlotter::cache.getReleaseHostCopies();
+}
+
 //bool MrPlotter::hardcodeLocalData(QUuid uuid, QVariantList data)
 //{
 //    QVector<struct rawpt> points(data.length());
@@ -20,6 +20,7 @@ class MrPlotter : public QObject
     Q_PROPERTY(QList<qreal> scrollableDomain READ getScrollableDomain WRITE setScrollableDomain)
     Q_PROPERTY(QString timeZone READ getTimeZoneName WRITE setTimeZone)
     Q_PROPERTY(bool timeTickPromotion READ getTimeTickPromotion WRITE setTimeTickPromotion)
+    Q_PROPERTY(bool releaseHostCopies READ getReleaseHostCopies WRITE setReleaseHostCopies)
     Q_PROPERTY(QList<QVariant> plotList READ getPlotList WRITE setPlotList)
 
 public:
@@ -65,6 +66,12 @@ public:
     Q_INVOKABLE void setTimeTickPromotion(bool enable);
     Q_INVOKABLE bool getTimeTickPromotion();
 
+    /* Whether the cache, which every Mr. Plotter shares, releases the points
+     * of its entries from host memory once they are on the GPU.
+     */
+    Q_INVOKABLE void setReleaseHostCopies(bool enable);
+    Q_INVOKABLE bool getReleaseHostCopies();
+
     Q_INVOKABLE void updateDataAsync();
     Q_INVOKABLE void updateView();
 
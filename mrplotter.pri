@@ -1,7 +1,36 @@
 QT += qml quick
 CONFIG += c++11
 
-INCLUDEPATH += $$PWD
+INCLUDEPATH += $$PWD $$OUT_PWD
+
+# The BTrDB data source talks to BTrDB over gRPC, so it is only built with
+# CONFIG += mrplotter_btrdb, which needs protobuf, gRPC and grpc_cpp_plugin.
+mrplotter_btrdb {
+    DEFINES += MRPLOTTER_BTRDB
+
+    LIBS += -lgrpc++ -lprotobuf
+
+    PROTOS += $$PWD/btrdb.proto $$PWD/btrdbv5.proto
+
+    GRPC_CPP_PLUGIN = $$system(which grpc_cpp_plugin)
+
+    protobuf.input = PROTOS
+    protobuf.output = ${QMAKE_FILE_BASE}.pb.cc
+    protobuf.commands = protoc -I$$PWD --cpp_out=. ${QMAKE_FILE_NAME}
+    protobuf.variable_out = SOURCES
+    protobuf.dependency_type = TYPE_C
+    QMAKE_EXTRA_COMPILERS += protobuf
+
+    grpc.input = PROTOS
+    grpc.output = ${QMAKE_FILE_BASE}.grpc.pb.cc
+    grpc.commands = protoc -I$$PWD --grpc_out=. --plugin=protoc-gen-grpc=$$GRPC_CPP_PLUGIN ${QMAKE_FILE_NAME}
+    grpc.variable_out = SOURCES
+    grpc.dependency_type = TYPE_C
+    QMAKE_EXTRA_COMPILERS += grpc
+
+    SOURCES += $$PWD/btrdbdatasource.cpp
+    HEADERS += $$PWD/btrdbapi.h $$PWD/btrdbdatasource.h
+}
 
 SOURCES += \
     $$PWD/plotarea.cpp \
@@ -15,7 +44,12 @@ SOURCES += \
     $$PWD/libmrplotter.cpp \
     $$PWD/utils.cpp \
     $$PWD/datasource.cpp \
-    $$PWD/bwdatasource.cpp
+    $$PWD/bwdatasource.cpp \
+    $$PWD/recorderdatasource.cpp \
+    $$PWD/aggregatedatasource.cpp \
+    $$PWD/vboarena.cpp \
+    $$PWD/renderstats.cpp \
+    $$PWD/snapshotrenderer.cpp
 
 HEADERS += \
     $$PWD/plotarea.h \
@@ -30,4 +64,9 @@ HEADERS += \
     $$PWD/libmrplotter.h \
     $$PWD/utils.h \
     $$PWD/datasource.h \
-    $$PWD/bwdatasource.h
+    $$PWD/bwdatasource.h \
+    $$PWD/recorderdatasource.h \
+    $$PWD/aggregatedatasource.h \
+    $$PWD/vboarena.h \
+    $$PWD/renderstats.h \
+    $$PWD/snapshotrenderer.h
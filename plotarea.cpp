@@ -3,6 +3,7 @@
 
 #include "cache.h"
 #include "stream.h"
+#include "utils.h"
 
 #include <cmath>
 #include <cstdint>
@@ -19,24 +20,6 @@
 #include <QWheelEvent>
 
 #define FANCY_PREFETCH 0
-int64_t safeSub(int64_t x, int64_t y)
-{
-    if (y > 0)
-    {
-        if ((uint64_t) y > (uint64_t) (x - INT64_MIN))
-        {
-            return INT64_MIN;
-        }
-    }
-    else
-    {
-        if ((uint64_t) (-y) > (uint64_t) (INT64_MAX - x))
-        {
-            return INT64_MAX;
-        }
-    }
-    return x - y;
-}
 
 bool PlotArea::initializedCursors = false;
 uint64_t PlotArea::nextID = 0;
@@ -45,17 +28,6 @@ QCursor PlotArea::defaultcursor;
 QCursor PlotArea::openhand;
 QCursor PlotArea::closedhand;
 
-/* Computes the number x such that 2 ^ x <= POINTWIDTH < 2 ^ (x + 1). */
-inline uint8_t getPWExponent(uint64_t pointwidth)
-{
-    if (pointwidth == 0)
-    {
-        return 0;
-    }
-    uint8_t pwe = (uint8_t) (63 - qCountLeadingZeroBits(pointwidth));
-    return qMin(pwe, (uint8_t) (PWE_MAX - 1));
-}
-
 PlotArea::PlotArea() : yaxisareas(), plotraw(false), noprefetch(false),
     previous_timewidth(0), previous_timeaxis_start(INT64_MAX),
     cache_data("cache", 2048), prefetch_data("prefetch", 4096),
@@ -81,6 +53,12 @@ PlotArea::PlotArea() : yaxisareas(), plotraw(false), noprefetch(false),
 
     this->instances.insert(this->id, this);
 
+    this->renderstats = new RenderStats(this);
+
+    this->msaasamples = DEFAULT_MSAA_SAMPLES;
+    this->analyticaa = false;
+    this->heatmapsaturation = DEFAULT_HEATMAP_SATURATION;
+
     this->setAntialiasing(true);
     this->setScrollZoomable(true);
 }
@@ -92,11 +70,59 @@ PlotArea::~PlotArea()
     qDebug() << "Cache hits" << this->id << this->cache_hits;
 }
 
+RenderStats* PlotArea::getRenderStats() const
+{
+    return this->renderstats;
+}
+
 QQuickFramebufferObject::Renderer* PlotArea::createRenderer() const
 {
     return new PlotRenderer(this);
 }
 
+int PlotArea::getMsaaSamples() const
+{
+    return this->msaasamples;
+}
+
+void PlotArea::setMsaaSamples(int samples)
+{
+    if (samples != 0 && samples != 2 && samples != 4 && samples != 8)
+    {
+        qWarning("Invalid MSAA sample count %d: must be 0, 2, 4 or 8", samples);
+        return;
+    }
+    this->msaasamples = samples;
+    this->update();
+}
+
+bool PlotArea::getAnalyticAntialiasing() const
+{
+    return this->analyticaa;
+}
+
+void PlotArea::setAnalyticAntialiasing(bool enable)
+{
+    this->analyticaa = enable;
+    this->update();
+}
+
+int PlotArea::getHeatmapSaturation() const
+{
+    return this->heatmapsaturation;
+}
+
+void PlotArea::setHeatmapSaturation(int saturation)
+{
+    if (saturation < 1)
+    {
+        qWarning("Invalid heatmap saturation %d: must be at least 1", saturation);
+        return;
+    }
+    this->heatmapsaturation = saturation;
+    this->update();
+}
+
 void PlotArea::addStream(Stream* s)
 {
     this->streams.append(s);
@@ -623,7 +649,7 @@ void PlotArea::updateDataAsync(Cache* cache)
                  * start prefetching.
                  */
 
-                s->data = data;
+                s->setData(data);
                 this->rescaleAxes(timeaxis_start, timeaxis_end);
                 this->update();
 
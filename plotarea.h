@@ -4,6 +4,7 @@
 #include "axisarea.h"
 #include "cache.h"
 #include "mrplotter.h"
+#include "renderstats.h"
 #include "stream.h"
 
 #include <QCursor>
@@ -30,6 +31,16 @@
  */
 #define WHEEL_SENSITIVITY (1.0 / 2048.0)
 
+/* The number of samples per pixel used for multisample antialiasing,
+ * unless set otherwise.
+ */
+#define DEFAULT_MSAA_SAMPLES 4
+
+/* The number of overlapping streams at which the density heatmap reaches
+ * the top of its colour map, unless set otherwise.
+ */
+#define DEFAULT_HEATMAP_SATURATION 32
+
 class MrPlotter;
 
 class PlotArea : public QQuickFramebufferObject
@@ -40,6 +51,10 @@ class PlotArea : public QQuickFramebufferObject
     Q_PROPERTY(bool scrollZoomable READ getScrollZoomable WRITE setScrollZoomable)
     Q_PROPERTY(bool donotaggregate MEMBER plotraw)
     Q_PROPERTY (bool donotprefetch MEMBER noprefetch)
+    Q_PROPERTY(RenderStats* renderStats READ getRenderStats CONSTANT)
+    Q_PROPERTY(int msaaSamples READ getMsaaSamples WRITE setMsaaSamples)
+    Q_PROPERTY(bool analyticAntialiasing READ getAnalyticAntialiasing WRITE setAnalyticAntialiasing)
+    Q_PROPERTY(int heatmapSaturation READ getHeatmapSaturation WRITE setHeatmapSaturation)
 
     friend class PlotRenderer;
 
@@ -69,6 +84,29 @@ public:
 
     void updateDataAsync(Cache* cache);
 
+    RenderStats* getRenderStats() const;
+
+    /* The number of samples per pixel for multisample antialiasing. Must
+     * be 0 (no multisampling), 2, 4 or 8.
+     */
+    int getMsaaSamples() const;
+    void setMsaaSamples(int samples);
+
+    /* If true, mean lines are drawn as quads that fade out at their edges,
+     * and the plot is drawn without multisampling. Where the context can't
+     * draw such lines, MSAASAMPLES is used as usual.
+     */
+    bool getAnalyticAntialiasing() const;
+    void setAnalyticAntialiasing(bool enable);
+
+    /* The streams with the heatmap property set are drawn together as a
+     * density heatmap, in which each pixel is coloured by how many of them
+     * cover it. This is the number of streams at which the colour map
+     * saturates. Must be at least 1.
+     */
+    int getHeatmapSaturation() const;
+    void setHeatmapSaturation(int saturation);
+
     MrPlotter* plot;
 
 protected:
@@ -102,6 +140,10 @@ private:
     bool plotraw;
     bool noprefetch;
 
+    int msaasamples;
+    bool analyticaa;
+    int heatmapsaturation;
+
     /* Some data used by the prefetcher. */
     uint64_t previous_timewidth;
     int64_t previous_timeaxis_start;
@@ -111,6 +153,9 @@ private:
     quint64 cache_misses;
     quint64 cache_hits;
 
+    /* Statistics about the frames drawn, filled in by the renderer. */
+    RenderStats* renderstats;
+
     static bool initializedCursors;
     static uint64_t nextID;
     static QHash<uint64_t, PlotArea*> instances;
@@ -4,120 +4,92 @@
 #include "shaders.h"
 #include "stream.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
 #include <QOpenGLFramebufferObject>
 #include <QOpenGLFramebufferObjectFormat>
 #include <QOpenGLFunctions>
 #include <QOpenGLShader>
 #include <QOpenGLShaderProgram>
+#ifndef QT_OPENGL_ES_2
+#include <QOpenGLTimerQuery>
+#endif
 #include <QQuickWindow>
 #include <QSize>
+#include <QSurfaceFormat>
+#include <QThread>
 #include <QtGlobal>
+#include <QHash>
+
+/* Not in the OpenGL ES 2.0 headers. */
+#ifndef GL_RGBA16F
+#define GL_RGBA16F 0x881A
+#endif
 
-/* The code to load a shader is taken from
- * https://www.khronos.org/assets/uploads/books/openglr_es_20_programming_guide_sample.pdf
+/* Builds a program from the given shader sources. Where Qt supports it,
+ * the linked program binary is cached on disk, keyed by the sources and the
+ * GL vendor, renderer and version, so that later launches need not compile
+ * the shaders again. If the cached binary is missing, or the driver rejects
+ * it, the shaders are compiled from source as usual.
  */
-QOpenGLShader* loadShader(QOpenGLShader::ShaderType type, const char* shaderSrc)
+QOpenGLShaderProgram* buildProgram(const char* vShaderSrc, const char* fShaderSrc, bool dataDensity)
 {
-    QOpenGLShader* shader = new QOpenGLShader(type);
-    bool compiled = shader->compileSourceCode(shaderSrc);
-
-    if (!compiled)
-    {
-        QString log = shader->log();
-        qFatal("Error compiling shader:\n%s", qPrintable(log));
-
-        delete shader;
+    QOpenGLShaderProgram* program = new QOpenGLShaderProgram;
 
-        return nullptr;
-    }
-
-    return shader;
-
-#if 0
-    // Create the shader object
-    shader = funcs->glCreateShader(type);
-
-    if (shader == 0)
-    {
-        qFatal("Could not create shader");
-    }
-
-    funcs->glShaderSource(shader, 1, &shaderSrc, nullptr);
-    funcs->glCompileShader(shader);
-    funcs->glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-
-    if(!compiled)
-    {
-       GLint infoLen = 0;
-       funcs->glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
-       if(infoLen > 1)
-       {
-          char* infoLog = new char[infoLen];
-          funcs->glGetShaderInfoLog(shader, infoLen, nullptr, infoLog);
-          qFatal("Error compiling shader:\n%s", infoLog);
-          delete[] infoLog;
-       }
-       funcs->glDeleteShader(shader);
-       return 0;
-    }
-
-    return shader;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+    bool added = program->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, vShaderSrc) &&
+            program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, fShaderSrc);
+#else
+    bool added = program->addShaderFromSourceCode(QOpenGLShader::Vertex, vShaderSrc) &&
+            program->addShaderFromSourceCode(QOpenGLShader::Fragment, fShaderSrc);
 #endif
-}
 
-GLuint compileAndLinkProgram(QOpenGLFunctions* funcs, QOpenGLShader* vertexShader, QOpenGLShader* fragmentShader, bool dataDensity)
-{
-    GLuint program = funcs->glCreateProgram();
-
-    if (program == 0)
+    if (!added)
     {
-        qFatal("Could not create program object");
-        return 0;
+        qFatal("Error compiling shader:\n%s", qPrintable(program->log()));
+        delete program;
+        return nullptr;
     }
 
-    funcs->glAttachShader(program, vertexShader->shaderId());
-    funcs->glAttachShader(program, fragmentShader->shaderId());
-
     if (!dataDensity)
     {
-        funcs->glBindAttribLocation(program, TIME_ATTR_LOC, "time");
-        funcs->glBindAttribLocation(program, VALUE_ATTR_LOC, "value");
-        funcs->glBindAttribLocation(program, FLAGS_ATTR_LOC, "flags");
+        program->bindAttributeLocation("time", TIME_ATTR_LOC);
+        program->bindAttributeLocation("value", VALUE_ATTR_LOC);
+        program->bindAttributeLocation("flags", FLAGS_ATTR_LOC);
+
+        /* Only the antialiased line program has these. */
+        program->bindAttributeLocation("time1", TIME1_ATTR_LOC);
+        program->bindAttributeLocation("value1", VALUE1_ATTR_LOC);
+        program->bindAttributeLocation("flags1", FLAGS1_ATTR_LOC);
+        program->bindAttributeLocation("corner", CORNER_ATTR_LOC);
     }
     else
     {
-        funcs->glBindAttribLocation(program, TIME_ATTR_LOC, "time");
-        funcs->glBindAttribLocation(program, COUNT_ATTR_LOC, "count");
+        program->bindAttributeLocation("time", TIME_ATTR_LOC);
+        program->bindAttributeLocation("count", COUNT_ATTR_LOC);
     }
 
-    funcs->glLinkProgram(program);
-
-    GLint linked;
-    funcs->glGetProgramiv(program, GL_LINK_STATUS, &linked);
-
-    if (!linked) {
-        GLint infoLen = 0;
-        funcs->glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
-        if(infoLen > 1)
-        {
-           char* infoLog = new char[infoLen];
-           funcs->glGetProgramInfoLog(program, infoLen, nullptr, infoLog);
-           qFatal("Error linking program:\n%s", infoLog);
-           delete[] infoLog;
-        }
-        funcs->glDeleteProgram(program);
-        return 0;
+    /* With cacheable shaders, compile errors only show up here. */
+    if (!program->link())
+    {
+        qFatal("Error linking program:\n%s", qPrintable(program->log()));
+        delete program;
+        return nullptr;
     }
 
     return program;
 }
 
 bool PlotRenderer::compiled_shaders = false;
+QOpenGLContextGroup* PlotRenderer::shadergroup = nullptr;
 
-QOpenGLShader* PlotRenderer::mainVertexShader;
-QOpenGLShader* PlotRenderer::ddVertexShader;
-QOpenGLShader* PlotRenderer::mainFragmentShader;
-QOpenGLShader* PlotRenderer::ddFragmentShader;
+QOpenGLShaderProgram* PlotRenderer::mainProgram;
+QOpenGLShaderProgram* PlotRenderer::ddProgram;
 
 GLuint PlotRenderer::program;
 GLuint PlotRenderer::ddprogram;
@@ -134,14 +106,62 @@ GLint PlotRenderer::axisMatLocDD;
 GLint PlotRenderer::axisVecLocDD;
 GLint PlotRenderer::colorLocDD;
 
-PlotRenderer::PlotRenderer(const PlotArea* plotarea) : pa(plotarea)
+QOpenGLShaderProgram* PlotRenderer::blitProgram;
+GLuint PlotRenderer::blitprogram;
+GLint PlotRenderer::blitShiftLoc;
+GLint PlotRenderer::blitFrameLoc;
+GLint PlotRenderer::blitPositionLoc;
+GLuint PlotRenderer::blitquad;
+
+QOpenGLShaderProgram* PlotRenderer::heatProgram;
+GLuint PlotRenderer::heatprogram;
+GLint PlotRenderer::heatDensityLoc;
+GLint PlotRenderer::heatPositionLoc;
+
+QOpenGLShaderProgram* PlotRenderer::aaProgram = nullptr;
+GLuint PlotRenderer::aaprogram;
+GLint PlotRenderer::axisMatLocAA;
+GLint PlotRenderer::axisVecLocAA;
+GLint PlotRenderer::viewportLocAA;
+GLint PlotRenderer::linewidthLocAA;
+GLint PlotRenderer::alwaysConnectLocAA;
+GLint PlotRenderer::colorLocAA;
+GLuint PlotRenderer::aaquad;
+
+QOpenGLShaderProgram* PlotRenderer::multiProgram = nullptr;
+GLuint PlotRenderer::multiprogram;
+struct multiuniforms PlotRenderer::multiLocs;
+
+QAtomicInt PlotRenderer::threadedrenderers;
+QAtomicInt PlotRenderer::snapshotcontexts;
+
+/* Two triangles covering the whole viewport, as a triangle strip. */
+static const GLfloat blitQuadVertices[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+/* The corners of the quad drawn for each segment of an antialiased line, as
+ * a triangle strip. See aavShaderStr.
+ */
+static const GLfloat aaQuadVertices[] = { 0.0f, -1.0f, 0.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f };
+
+PlotRenderer::PlotRenderer(const PlotArea* plotarea) : multiDrawArrays(nullptr),
+    samples(plotarea->msaasamples), analyticaa(false), warnedaa(false),
+    density(nullptr), densityformat(GL_RGBA), heatsaturation(plotarea->heatmapsaturation),
+    prevframe(nullptr), prevframe_start(0), prevframe_end(0), prevframe_signature(0),
+    blitframes(0), signature(0), datachanged(true), frameno(0), collectstats(false),
+    hastimerqueries(true), shadertime(0), firstframetime(-1), startupreported(false),
+    shadersready(false), gl33(false), threaded(false),
+    pa(plotarea), timeaxis(nullptr), timeaxis_version(0), pixelwidth(0), decimation(-1)
 {
+    this->sincecreated.start();
+
+    memset(&this->current, 0, sizeof(this->current));
+    memset(&this->counts, 0, sizeof(this->counts));
+
     const TimeAxis* timeaxis = plotarea->getTimeAxis();
-    if (timeaxis == nullptr)
+    if (timeaxis != nullptr)
     {
-        return;
+        timeaxis->getDomain(&this->timeaxis_start, &this->timeaxis_end);
     }
-    timeaxis->getDomain(&this->timeaxis_start, &this->timeaxis_end);
 
     this->initializeOpenGLFunctions();
 
@@ -150,44 +170,311 @@ PlotRenderer::PlotRenderer(const PlotArea* plotarea) : pa(plotarea)
     this->glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
 #endif
 
-    if (!this->compiled_shaders)
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+
+    /* Shaders are only built by the first renderer. The cache's VBOs are
+     * used without locking, so Plot Areas can't draw on a render thread of
+     * their own while snapshots are drawn on the GUI thread.
+     */
+    QElapsedTimer shadertimer;
+    shadertimer.start();
+    bool threaded = (QThread::currentThread() != QCoreApplication::instance()->thread());
+    if (threaded && PlotRenderer::snapshotcontexts.load() != 0)
+    {
+        qWarning("Plot Areas can't be drawn on a render thread while snapshots are drawn; set QSG_RENDER_LOOP=basic");
+    }
+    else
+    {
+        this->shadersready = PlotRenderer::initShaders(this);
+    }
+    this->shadertime = shadertimer.nsecsElapsed();
+
+    this->threaded = threaded && this->shadersready;
+    if (this->threaded)
+    {
+        PlotRenderer::threadedrenderers.ref();
+    }
+    this->gl33 = this->shadersready && PlotRenderer::multiProgram != nullptr && PlotRenderer::hasGL33(ctx);
+
+    this->densityformat = PlotRenderer::getDensityFormat(ctx);
+
+    /* Batch draw calls if possible. */
+    this->multiDrawArrays = PlotRenderer::getMultiDrawArrays(ctx);
+}
+
+bool PlotRenderer::initShaders(QOpenGLFunctions* funcs)
+{
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    if (PlotRenderer::compiled_shaders)
+    {
+        if (ctx->shareGroup() != PlotRenderer::shadergroup)
+        {
+            qWarning("Shaders were built in a context that isn't shared with this one; set Qt::AA_ShareOpenGLContexts");
+            return false;
+        }
+    }
+    else
+    {
+        PlotRenderer::buildShaders(funcs);
+        PlotRenderer::shadergroup = ctx->shareGroup();
+        PlotRenderer::compiled_shaders = true;
+    }
+
+    /* The first context that can run them builds the programs that need
+     * OpenGL 3.3, which may not be the first context.
+     */
+    if (PlotRenderer::multiProgram == nullptr && PlotRenderer::hasGL33(ctx))
+    {
+        PlotRenderer::buildGL33Shaders(funcs, ctx);
+    }
+    return true;
+}
+
+void PlotRenderer::buildShaders(QOpenGLFunctions* funcs)
+{
+    PlotRenderer::mainProgram = buildProgram(vShaderStr, fShaderStr, false);
+    Q_ASSERT(PlotRenderer::mainProgram != nullptr);
+    PlotRenderer::program = PlotRenderer::mainProgram->programId();
+
+    PlotRenderer::ddProgram = buildProgram(ddvShaderStr, ddfShaderStr, true);
+    Q_ASSERT(PlotRenderer::ddProgram != nullptr);
+    PlotRenderer::ddprogram = PlotRenderer::ddProgram->programId();
+
+    PlotRenderer::axisMatLoc = funcs->glGetUniformLocation(PlotRenderer::program, "axisTransform");
+    PlotRenderer::axisVecLoc = funcs->glGetUniformLocation(PlotRenderer::program, "axisBase");
+    PlotRenderer::pointsizeLoc = funcs->glGetUniformLocation(PlotRenderer::program, "pointsize");
+    PlotRenderer::tstripLoc = funcs->glGetUniformLocation(PlotRenderer::program, "tstrip");
+    PlotRenderer::alwaysConnectLoc = funcs->glGetUniformLocation(PlotRenderer::program, "alwaysConnect");
+    PlotRenderer::opacityLoc = funcs->glGetUniformLocation(PlotRenderer::program, "opacity");
+    PlotRenderer::colorLoc = funcs->glGetUniformLocation(PlotRenderer::program, "color");
+
+    PlotRenderer::axisMatLocDD = funcs->glGetUniformLocation(PlotRenderer::ddprogram, "axisTransform");
+    PlotRenderer::axisVecLocDD = funcs->glGetUniformLocation(PlotRenderer::ddprogram, "axisBase");
+    PlotRenderer::colorLocDD = funcs->glGetUniformLocation(PlotRenderer::ddprogram, "color");
+
+    PlotRenderer::blitProgram = buildProgram(blitvShaderStr, blitfShaderStr, false);
+    Q_ASSERT(PlotRenderer::blitProgram != nullptr);
+    PlotRenderer::blitprogram = PlotRenderer::blitProgram->programId();
+
+    PlotRenderer::blitShiftLoc = funcs->glGetUniformLocation(PlotRenderer::blitprogram, "shift");
+    PlotRenderer::blitFrameLoc = funcs->glGetUniformLocation(PlotRenderer::blitprogram, "frame");
+    PlotRenderer::blitPositionLoc = funcs->glGetAttribLocation(PlotRenderer::blitprogram, "position");
+
+    funcs->glGenBuffers(1, &PlotRenderer::blitquad);
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, PlotRenderer::blitquad);
+    funcs->glBufferData(GL_ARRAY_BUFFER, sizeof(blitQuadVertices), blitQuadVertices, GL_STATIC_DRAW);
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    PlotRenderer::heatProgram = buildProgram(heatvShaderStr, heatfShaderStr, false);
+    Q_ASSERT(PlotRenderer::heatProgram != nullptr);
+    PlotRenderer::heatprogram = PlotRenderer::heatProgram->programId();
+
+    PlotRenderer::heatDensityLoc = funcs->glGetUniformLocation(PlotRenderer::heatprogram, "density");
+    PlotRenderer::heatPositionLoc = funcs->glGetAttribLocation(PlotRenderer::heatprogram, "position");
+}
+
+void PlotRenderer::buildGL33Shaders(QOpenGLFunctions* funcs, QOpenGLContext* ctx)
+{
+    PlotRenderer::aaProgram = buildProgram(aavShaderStr, aafShaderStr, false);
+    Q_ASSERT(PlotRenderer::aaProgram != nullptr);
+    PlotRenderer::aaprogram = PlotRenderer::aaProgram->programId();
+
+    PlotRenderer::axisMatLocAA = funcs->glGetUniformLocation(PlotRenderer::aaprogram, "axisTransform");
+    PlotRenderer::axisVecLocAA = funcs->glGetUniformLocation(PlotRenderer::aaprogram, "axisBase");
+    PlotRenderer::viewportLocAA = funcs->glGetUniformLocation(PlotRenderer::aaprogram, "viewport");
+    PlotRenderer::linewidthLocAA = funcs->glGetUniformLocation(PlotRenderer::aaprogram, "linewidth");
+    PlotRenderer::alwaysConnectLocAA = funcs->glGetUniformLocation(PlotRenderer::aaprogram, "alwaysConnect");
+    PlotRenderer::colorLocAA = funcs->glGetUniformLocation(PlotRenderer::aaprogram, "color");
+
+    funcs->glGenBuffers(1, &PlotRenderer::aaquad);
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, PlotRenderer::aaquad);
+    funcs->glBufferData(GL_ARRAY_BUFFER, sizeof(aaQuadVertices), aaQuadVertices, GL_STATIC_DRAW);
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    QByteArray header = ctx->isOpenGLES() ?
+                QByteArrayLiteral("#version 300 es\nprecision highp float;\nprecision highp int;\n") :
+                QByteArrayLiteral("#version 330\n");
+    header += "#define MULTI_STREAM_RANGES " + QByteArray::number(MULTI_STREAM_RANGES) + "\n";
+    PlotRenderer::multiProgram = buildProgram((header + multivShaderStr).constData(), (header + multifShaderStr).constData(), false);
+    Q_ASSERT(PlotRenderer::multiProgram != nullptr);
+    PlotRenderer::multiprogram = PlotRenderer::multiProgram->programId();
+
+    PlotRenderer::multiLocs.timeScale = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "timeScale");
+    PlotRenderer::multiLocs.vertsPerPoint = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "vertsPerPoint");
+    PlotRenderer::multiLocs.tstrip = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "tstrip");
+    PlotRenderer::multiLocs.opacity = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "opacity");
+    PlotRenderer::multiLocs.pointsize = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "pointsize");
+    PlotRenderer::multiLocs.rangeCount = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "rangeCount");
+    PlotRenderer::multiLocs.rangeStart = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "rangeStart");
+    PlotRenderer::multiLocs.rangeAxis = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "rangeAxis");
+    PlotRenderer::multiLocs.rangeColor = funcs->glGetUniformLocation(PlotRenderer::multiprogram, "rangeColor");
+}
+
+bool PlotRenderer::hasGL33(QOpenGLContext* ctx)
+{
+    /* Antialiased lines need instanced drawing, with divisors, and the
+     * multi-stream program needs gl_VertexID. Both come with OpenGL 3.3
+     * and OpenGL ES 3.0.
+     */
+    QSurfaceFormat format = ctx->format();
+    return ctx->isOpenGLES() ? format.majorVersion() >= 3 : format.version() >= qMakePair(3, 3);
+}
+
+GLenum PlotRenderer::getDensityFormat(QOpenGLContext* ctx)
+{
+    /* Half floats are precise enough for the density of thousands of
+     * overlapping streams. OpenGL ES 3.0 can only render to them with an
+     * extension.
+     */
+    if (ctx->isOpenGLES() ?
+            (ctx->format().majorVersion() >= 3 &&
+             (ctx->hasExtension(QByteArrayLiteral("GL_EXT_color_buffer_half_float")) ||
+              ctx->hasExtension(QByteArrayLiteral("GL_EXT_color_buffer_float")))) :
+            ctx->format().majorVersion() >= 3)
     {
-        this->mainVertexShader = loadShader(QOpenGLShader::Vertex, vShaderStr);
-        this->mainFragmentShader = loadShader(QOpenGLShader::Fragment, fShaderStr);
-        Q_ASSERT(this->mainVertexShader != nullptr && this->mainFragmentShader != nullptr);
-        this->program = compileAndLinkProgram(this, this->mainVertexShader, this->mainFragmentShader, false);
+        return GL_RGBA16F;
+    }
+    return GL_RGBA;
+}
 
-        this->ddVertexShader = loadShader(QOpenGLShader::Vertex, ddvShaderStr);
-        this->ddFragmentShader = loadShader(QOpenGLShader::Fragment, ddfShaderStr);
-        Q_ASSERT(this->ddVertexShader != nullptr && this->ddFragmentShader != nullptr);
-        this->ddprogram = compileAndLinkProgram(this, this->ddVertexShader, this->ddFragmentShader, true);
+MultiDrawArraysFunc PlotRenderer::getMultiDrawArrays(QOpenGLContext* ctx)
+{
+    /* OpenGL ES 2.0 only has it as an extension. */
+    if (!ctx->isOpenGLES())
+    {
+        return (MultiDrawArraysFunc) ctx->getProcAddress("glMultiDrawArrays");
+    }
+    else if (ctx->hasExtension(QByteArrayLiteral("GL_EXT_multi_draw_arrays")))
+    {
+        return (MultiDrawArraysFunc) ctx->getProcAddress("glMultiDrawArraysEXT");
+    }
+    return nullptr;
+}
 
-        this->axisMatLoc = this->glGetUniformLocation(this->program, "axisTransform");
-        this->axisVecLoc = this->glGetUniformLocation(this->program, "axisBase");
-        this->pointsizeLoc = this->glGetUniformLocation(this->program, "pointsize");
-        this->tstripLoc = this->glGetUniformLocation(this->program, "tstrip");
-        this->alwaysConnectLoc = this->glGetUniformLocation(this->program, "alwaysConnect");
-        this->opacityLoc = this->glGetUniformLocation(this->program, "opacity");
-        this->colorLoc = this->glGetUniformLocation(this->program, "color");
+PlotRenderer::~PlotRenderer()
+{
+    if (this->threaded)
+    {
+        PlotRenderer::threadedrenderers.deref();
+    }
 
-        this->axisMatLocDD = this->glGetUniformLocation(this->ddprogram, "axisTransform");
-        this->axisVecLocDD = this->glGetUniformLocation(this->ddprogram, "axisBase");
-        this->colorLocDD = this->glGetUniformLocation(this->ddprogram, "color");
+    /* The GL context is current when the renderer is destroyed. */
+    delete this->prevframe;
+    delete this->density;
 
-        this->compiled_shaders = true;
+#ifndef QT_OPENGL_ES_2
+    for (auto i = this->pendingframes.begin(); i != this->pendingframes.end(); i++)
+    {
+        delete i->first;
     }
+    qDeleteAll(this->freequeries);
+#endif
 }
 
 QOpenGLFramebufferObject* PlotRenderer::createFramebufferObject(const QSize& size)
 {
     QOpenGLFramebufferObjectFormat fof;
-    fof.setSamples(4);
+    fof.setSamples(this->samples);
     return new QOpenGLFramebufferObject(size, fof);
 }
 
+/* Marks each of the visible ranges of D as dense if it has enough points
+ * per pixel that it spans, when VSTART to VEND is drawn across WIDTH
+ * pixels, that its points and vertical lines would be hidden under the
+ * min-max background. An entry spans the pixels between its start and
+ * end, so a stream with a dense stretch and a sparse one keeps its points
+ * where they can be seen.
+ */
+static void markDense(struct drawable& d, int64_t vstart, int64_t vend, int width)
+{
+    double pixelspertime = (double) width / qMax(vend - vstart, Q_INT64_C(1));
+    for (int k = 0; k != d.visible.size(); k++)
+    {
+        const QSharedPointer<CacheEntry>& ce = d.visible[k];
+        struct pointrange& range = d.ranges[k];
+        int64_t spanned = qMin(ce->end, vend) - qMax(ce->start, vstart);
+        double pixels = qMax(spanned * pixelspertime, 1.0);
+        range.dense = range.count >= PLOT_DENSE_POINTS_PER_PIXEL * pixels;
+    }
+}
+
+/* Hashes everything about D that affects how it is drawn, other than the
+ * time domain.
+ */
+static uint drawableSignature(const struct drawable& d, uint seed)
+{
+    uint h = seed;
+    h = qHash((qint64) d.timeOffset, h);
+    h = qHash(d.ymin, h);
+    h = qHash(d.ymax, h);
+    h = qHash(d.color.red, h);
+    h = qHash(d.color.green, h);
+    h = qHash(d.color.blue, h);
+    h = qHash((d.dataDensity ? 1 : 0) | (d.selected ? 2 : 0) | (d.alwaysConnect ? 4 : 0) | (d.heatmap ? 8 : 0), h);
+    for (auto i = d.drawn.begin(); i != d.drawn.end(); i++)
+    {
+        h = qHash((quintptr) i->data(), h);
+    }
+    return h;
+}
+
 void PlotRenderer::synchronize(QQuickFramebufferObject* plotareafbo)
 {
     PlotArea* plotarea = static_cast<PlotArea*>(plotareafbo);
+
+    /* The reason was reported when the renderer was made. */
+    if (!this->shadersready)
+    {
+        return;
+    }
+
+    QElapsedTimer synctimer;
+    synctimer.start();
+
+    /* Hand the frames drawn since the last call to the Plot Area. */
+    this->collectstats = plotarea->renderstats->isEnabled();
+    if (this->collectstats)
+    {
+        for (auto i = this->finished.begin(); i != this->finished.end(); i++)
+        {
+            plotarea->renderstats->record(*i);
+        }
+    }
+    this->finished.clear();
+
+    /* Use a new framebuffer if the antialiasing settings changed. */
+    bool analytic = plotarea->analyticaa && this->gl33;
+    if (plotarea->analyticaa && !analytic && !this->warnedaa)
+    {
+        qWarning("Analytic antialiasing needs OpenGL 3.3 or OpenGL ES 3.0; using MSAA instead");
+        this->warnedaa = true;
+    }
+    int samples = analytic ? 0 : plotarea->msaasamples;
+    if (samples != this->samples || analytic != this->analyticaa)
+    {
+        this->samples = samples;
+        this->analyticaa = analytic;
+        this->invalidateFramebufferObject();
+
+        /* The previous frame was drawn differently, so don't reuse it. */
+        delete this->prevframe;
+        this->prevframe = nullptr;
+    }
+
+    this->heatsaturation = plotarea->heatmapsaturation;
+    if (this->densityformat == GL_RGBA)
+    {
+        this->heatsaturation = qMin(this->heatsaturation, 255);
+    }
+
+    if (this->firstframetime != -1 && !this->startupreported)
+    {
+        plotarea->renderstats->recordStartup(this->shadertime, this->firstframetime);
+        this->startupreported = true;
+    }
+
+    memset(&this->counts, 0, sizeof(this->counts));
+
     const TimeAxis* timeaxis = plotarea->getTimeAxis();
     if (timeaxis == nullptr)
     {
@@ -195,38 +482,350 @@ void PlotRenderer::synchronize(QQuickFramebufferObject* plotareafbo)
     }
     timeaxis->getDomain(&this->timeaxis_start, &this->timeaxis_end);
 
-    /* Delete any VBOs pending deletion. */
-    QVector<GLuint>& todelete = plotarea->plot->cache.todelete;
-    if (todelete.size() != 0)
-    {
-        this->glDeleteBuffers(todelete.size(), todelete.data());
-        todelete.clear();
-    }
+    /* Delete unused VBOs, and compact fragmented ones. */
+    plotarea->plot->cache.vbos.collect(this);
+    plotarea->plot->cache.ddvbos.collect(this);
+    plotarea->plot->cache.rawvbos.collect(this);
+
+    /* Every drawable must be culled again if the time domain moved, or
+     * the plot was resized.
+     */
+    int pixelwidth = qRound(plotarea->width() * plotarea->window()->devicePixelRatio());
+    bool moved = timeaxis != this->timeaxis || timeaxis->getVersion() != this->timeaxis_version ||
+            pixelwidth != this->pixelwidth;
+    this->timeaxis = timeaxis;
+    this->timeaxis_version = timeaxis->getVersion();
+    this->pixelwidth = pixelwidth;
 
+    this->decimation = PlotRenderer::decimationExponent(this->timeaxis_end - this->timeaxis_start, pixelwidth);
+
+    int oldsize = this->streams.size();
     this->streams.resize(plotarea->streams.size());
 
+    this->datachanged = false;
+
+    /* Entries that haven't been uploaded yet, and whether they are drawn
+     * in a data density plot. Those that can be seen are uploaded first.
+     */
+    QList<QPair<QSharedPointer<CacheEntry>, bool>> toprepare;
+    QList<QPair<QSharedPointer<CacheEntry>, bool>> offscreen;
+
     int index = 0;
     for (auto i = plotarea->streams.begin(); i != plotarea->streams.end(); i++)
     {
         Stream* s = *i;
         Q_ASSERT_X(s != nullptr, "synchronize", "invalid value in streamlist");
-        bool hasaxis = s->toDrawable(this->streams[index]);
-        if (!hasaxis)
+        if (s->axis == nullptr)
         {
             continue;
         }
-        QList<QSharedPointer<CacheEntry>>& todraw = this->streams[index].data;
-        for (auto j = todraw.begin(); j != todraw.end(); j++)
+
+        struct drawable& d = this->streams[index];
+        index++;
+
+        /* Only take a new snapshot of streams that changed. The entry list
+         * is implicitly shared with the stream, so this doesn't copy it.
+         */
+        bool fresh = (index > oldsize || d.stream != s || d.version != s->getVersion() ||
+                      d.axis != s->axis || d.axisversion != s->axis->getVersion());
+        if (fresh)
+        {
+            if (index > oldsize || d.stream != s)
+            {
+                d.drawn.clear();
+                d.stream = s;
+            }
+            else if (d.dataDensity != s->getDataDensity())
+            {
+                /* The entries drawn before may not be prepared for the
+                 * other kind of plot.
+                 */
+                d.drawn.clear();
+            }
+            s->toDrawable(d);
+            d.pending = false;
+            d.decimating = false;
+            d.dirty = true;
+        }
+
+        if (d.data.isEmpty())
+        {
+            continue;
+        }
+
+        int64_t vstart = this->timeaxis_start - d.timeOffset;
+        int64_t vend = this->timeaxis_end - d.timeOffset;
+
+        /* Points are only ever appended to the newest entry, so that is
+         * the only one to check unless the entries themselves changed.
+         */
+        QList<QSharedPointer<CacheEntry>>& todraw = d.data;
+        auto j = (fresh || d.pending) ? todraw.begin() : todraw.end() - 1;
+        for (; j != todraw.end(); j++)
         {
             QSharedPointer<CacheEntry>& ce = *j;
             Q_ASSERT(!ce->isPlaceholder());
-            if (!ce->isPrepared())
+            if (!ce->isPrepared(d.dataDensity))
             {
-                ce->prepare(this);
+                if (ce->end >= vstart && ce->start <= vend)
+                {
+                    toprepare.append(qMakePair(ce, d.dataDensity));
+                }
+                else
+                {
+                    offscreen.append(qMakePair(ce, d.dataDensity));
+                }
+                d.pending = true;
+            }
+            else if (ce->needsUpdate())
+            {
+                ce->update(this, this->counts);
+                this->datachanged = true;
+                d.dirty = true;
             }
         }
+    }
+    this->streams.resize(index);
+    toprepare.append(offscreen);
 
-        index++;
+    /* Upload as much as the budget allows. At least one entry is uploaded
+     * each frame, however big, so that we always make progress.
+     */
+    bool deferred = false;
+    int uploads = 0;
+    for (auto j = toprepare.begin(); j != toprepare.end(); j++)
+    {
+        QSharedPointer<CacheEntry>& ce = j->first;
+        bool dd = j->second;
+        if (ce->isPrepared(dd))
+        {
+            /* The same entry can be in more than one drawable. */
+            continue;
+        }
+        if (uploads != 0 && this->counts.uploaded + this->counts.decimated >= PLOT_UPLOAD_BUDGET)
+        {
+            deferred = true;
+            break;
+        }
+        ce->prepare(this, dd, this->counts);
+        this->datachanged = true;
+        uploads++;
+    }
+
+    /* Entries whose decimation at this scale hasn't been made yet. */
+    QList<QSharedPointer<CacheEntry>> todecimate;
+
+    uint sig = qHash(this->streams.size(), (uint) this->heatsaturation);
+
+    for (index = 0; index != this->streams.size(); index++)
+    {
+        struct drawable& d = this->streams[index];
+        if (d.pending)
+        {
+            /* Some of the entries may have been uploaded just now, or by
+             * another stream. Whatever is left is drawn from the entries
+             * drawn last time.
+             */
+            this->useFallback(d);
+            d.dirty = true;
+        }
+        else if (d.dirty)
+        {
+            d.drawn = d.data;
+        }
+
+        if (d.dirty)
+        {
+            d.signature = drawableSignature(d, 0);
+        }
+        if (d.dirty || moved || d.decimating)
+        {
+            PlotRenderer::cull(d, this->timeaxis_start, this->timeaxis_end, this->pixelwidth, this->decimation, todecimate);
+        }
+        d.dirty = false;
+
+        sig = qHash(d.signature, sig);
+    }
+
+    /* Decimate as much as the rest of the budget allows, and cull the
+     * streams that were waiting for it again. Unless an entry was uploaded
+     * already, at least one is decimated, so that we always make progress.
+     */
+    int decimations = 0;
+    for (auto j = todecimate.begin(); j != todecimate.end(); j++)
+    {
+        bool exact;
+        (*j)->getDecimation(this->decimation, &exact);
+        if (exact)
+        {
+            /* The same entry can be in more than one drawable. */
+            continue;
+        }
+        if (uploads + decimations != 0 && this->counts.uploaded + this->counts.decimated >= PLOT_UPLOAD_BUDGET)
+        {
+            deferred = true;
+            break;
+        }
+        (*j)->decimate(this, this->decimation, this->counts);
+        decimations++;
+    }
+    if (decimations != 0)
+    {
+        QList<QSharedPointer<CacheEntry>> waiting;
+        for (index = 0; index != this->streams.size(); index++)
+        {
+            struct drawable& d = this->streams[index];
+            if (d.decimating)
+            {
+                PlotRenderer::cull(d, this->timeaxis_start, this->timeaxis_end, this->pixelwidth, this->decimation, waiting);
+            }
+        }
+        this->datachanged = true;
+    }
+
+    /* Come back for the rest in the next frame. */
+    if (deferred)
+    {
+        this->update();
+    }
+
+    this->signature = sig;
+
+    this->current.uploaded = this->counts.uploaded;
+    this->current.vbos = plotarea->plot->cache.vbos.bufferCount() + plotarea->plot->cache.ddvbos.bufferCount() +
+            plotarea->plot->cache.rawvbos.bufferCount();
+    this->current.synctime = synctimer.nsecsElapsed();
+}
+
+void PlotRenderer::useFallback(struct drawable& d)
+{
+    QList<QSharedPointer<CacheEntry>> usable;
+    bool complete = true;
+    for (auto i = d.data.begin(); i != d.data.end(); i++)
+    {
+        if ((*i)->isPrepared(d.dataDensity))
+        {
+            usable.append(*i);
+        }
+        else
+        {
+            complete = false;
+        }
+    }
+    if (complete)
+    {
+        d.pending = false;
+        d.drawn = d.data;
+        return;
+    }
+
+    /* Fill the gaps with the entries drawn last time, which are all
+     * prepared. They may be at a different resolution, so only those that
+     * don't overlap an entry being drawn can be used.
+     */
+    int fresh = usable.size();
+    for (auto j = d.drawn.begin(); j != d.drawn.end(); j++)
+    {
+        const QSharedPointer<CacheEntry>& old = *j;
+        bool overlaps = false;
+        for (int k = 0; k != fresh && !overlaps; k++)
+        {
+            overlaps = old->end >= usable[k]->start && old->start <= usable[k]->end;
+        }
+        if (!overlaps)
+        {
+            usable.append(old);
+        }
+    }
+
+    /* Culling expects the entries to be sorted by time. */
+    std::sort(usable.begin(), usable.end(),
+              [](const QSharedPointer<CacheEntry>& a, const QSharedPointer<CacheEntry>& b)
+    {
+        return a->start < b->start;
+    });
+    d.drawn = usable;
+}
+
+int PlotRenderer::decimationExponent(int64_t span, int pixelwidth)
+{
+    /* Raw points are decimated in buckets a power of two nanoseconds wide,
+     * so that the decimations can be reused while scrolling. The buckets
+     * are between a quarter and a half of a pixel wide, so that every point
+     * left out is drawn within half a pixel of the lines it belongs on.
+     */
+    int64_t pixelspan = (pixelwidth > 0) ? span / pixelwidth : 0;
+    int exponent = -1;
+    while (exponent < 61 && (Q_INT64_C(2) << (exponent + 1)) <= pixelspan)
+    {
+        exponent++;
+    }
+    return exponent;
+}
+
+void PlotRenderer::cull(struct drawable& d, int64_t start, int64_t end, int pixelwidth, int decimation,
+                        QList<QSharedPointer<CacheEntry>>& todecimate)
+{
+    /* Points at time T are drawn at T + timeOffset. */
+    int64_t vstart = start - d.timeOffset;
+    int64_t vend = end - d.timeOffset;
+
+    /* The entries are sorted by time. Keep the ones that overlap the
+     * visible interval, along with the nearest one on either side, since
+     * it may draw a line onto the screen.
+     */
+    const QList<QSharedPointer<CacheEntry>>& drawn = d.drawn;
+    int n = drawn.size();
+    int lo = 0;
+    while (lo < n && drawn[lo]->end < vstart)
+    {
+        lo++;
+    }
+    int hi = lo;
+    while (hi < n && drawn[hi]->start <= vend)
+    {
+        hi++;
+    }
+    lo = qMax(lo - 1, 0);
+    hi = qMin(hi + 1, n);
+
+    d.visible.clear();
+    d.ranges.clear();
+    for (int k = lo; k < hi; k++)
+    {
+        d.visible.append(drawn[k]);
+        d.ranges.append(drawn[k]->visibleRange(vstart, vend));
+    }
+
+    markDense(d, vstart, vend, pixelwidth);
+
+    /* The data density plot needs every point. */
+    d.decimating = false;
+    if (d.dataDensity || decimation == -1)
+    {
+        return;
+    }
+    for (int k = 0; k != d.visible.size(); k++)
+    {
+        if (!d.visible[k]->canDecimate(decimation))
+        {
+            continue;
+        }
+
+        bool exact;
+        QSharedPointer<CacheEntry> decimated = d.visible[k]->getDecimation(decimation, &exact);
+        if (!exact)
+        {
+            todecimate.append(d.visible[k]);
+            d.decimating = true;
+        }
+        if (!decimated.isNull())
+        {
+            bool dense = d.ranges[k].dense;
+            d.visible[k] = decimated;
+            d.ranges[k] = decimated->visibleRange(vstart, vend);
+            d.ranges[k].dense = dense;
+        }
     }
 }
 
@@ -234,6 +833,20 @@ void PlotRenderer::render()
 {
     this->initializeOpenGLFunctions();
 
+    if (!this->shadersready)
+    {
+        this->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        this->glClear(GL_COLOR_BUFFER_BIT);
+        return;
+    }
+
+    QElapsedTimer rendertimer;
+    rendertimer.start();
+    QOpenGLTimerQuery* query = this->beginTimerQuery();
+
+    this->counts.drawcalls = 0;
+    this->counts.vertices = 0;
+
     QOpenGLFramebufferObject* fbo = this->framebufferObject();
 
     int width = fbo->width();
@@ -247,33 +860,433 @@ void PlotRenderer::render()
     this->glEnable(GL_BLEND);
     this->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    int dx;
+    if (this->canReusePreviousFrame(width, height, &dx))
+    {
+        /* The plot has only scrolled, so shift the previous frame over and
+         * draw just the strip that it leaves uncovered.
+         */
+        this->drawPreviousFrame(dx, width);
+        if (dx != 0)
+        {
+            int stripwidth = qMin(qAbs(dx) + PLOT_BLIT_MARGIN, width);
+            this->glEnable(GL_SCISSOR_TEST);
+            this->glScissor(dx > 0 ? 0 : width - stripwidth, 0, stripwidth, height);
+            this->glClear(GL_COLOR_BUFFER_BIT);
+            this->renderStreams();
+            this->glDisable(GL_SCISSOR_TEST);
+        }
+
+        /* Keep the saved domain on the pixel grid of the saved frame, so
+         * that rounding errors don't build up over many frames.
+         */
+        int64_t span = this->prevframe_end - this->prevframe_start;
+        int64_t moved = (int64_t) ((double) dx * span / width);
+        this->prevframe_start -= moved;
+        this->prevframe_end -= moved;
+        this->blitframes++;
+    }
+    else
+    {
+        this->renderStreams();
+        this->prevframe_start = this->timeaxis_start;
+        this->prevframe_end = this->timeaxis_end;
+        this->blitframes = 0;
+    }
+
+    this->prevframe_signature = this->signature;
+    this->savePreviousFrame(fbo);
+
+    this->current.samples = this->samples;
+    this->current.analyticaa = this->analyticaa;
+    this->current.drawcalls = this->counts.drawcalls;
+    this->current.vertices = this->counts.vertices;
+    this->current.rendertime = rendertimer.nsecsElapsed();
+    this->finishFrame(query);
+
+    if (this->firstframetime == -1)
+    {
+        this->firstframetime = this->sincecreated.nsecsElapsed();
+    }
+
+    this->pa->window()->resetOpenGLState();
+}
+
+bool PlotRenderer::inHeatmap(const struct drawable& d)
+{
+    return d.heatmap && !d.dataDensity && !d.selected;
+}
+
+void PlotRenderer::renderStreams()
+{
+    QOpenGLFramebufferObject* fbo = this->framebufferObject();
+
+    /* The heatmap goes under everything else. */
+    QVector<const struct drawable*> heat;
+    for (auto i = this->streams.begin(); i != this->streams.end(); ++i)
+    {
+        if (inHeatmap(*i))
+        {
+            heat.append(&*i);
+        }
+    }
+    if (!heat.isEmpty())
+    {
+        PlotRenderer::renderHeatmap(this, this->multiDrawArrays, heat, fbo, &this->density, this->densityformat,
+                                    this->heatsaturation, this->gl33, this->timeaxis_start, this->timeaxis_end,
+                                    this->counts);
+    }
+
+    /* With analytic antialiasing, the mean line is drawn separately. */
+    bool meanLine = !this->analyticaa;
+
+    /* Draw the unselected streams all together, where the context allows
+     * it. The selected streams are drawn over them, with wider lines.
+     */
+    bool multi = this->gl33;
+    if (multi)
+    {
+        QVector<struct multigroup> groups;
+        for (auto i = this->streams.begin(); i != this->streams.end(); ++i)
+        {
+            const struct drawable& s = *i;
+            if (!s.dataDensity && !s.selected && !inHeatmap(s))
+            {
+                CacheEntry::addMultiRanges(s.visible, s.ranges, s.ymin, s.ymax, this->timeaxis_start, s.timeOffset, COLOR_TO_ARRAY(s.color), s.alwaysConnect, groups);
+            }
+        }
+
+        if (!groups.isEmpty())
+        {
+            this->glUseProgram(this->multiprogram);
+            this->glLineWidth(1.0);
+            CacheEntry::renderPlotMulti(this, this->multiDrawArrays, groups, this->timeaxis_start, this->timeaxis_end, this->multiLocs, meanLine, this->counts);
+        }
+    }
+
     for (auto i = this->streams.begin(); i != this->streams.end(); ++i)
     {
         struct drawable& s = *i;
-        QList<QSharedPointer<CacheEntry>>& todraw = s.data;
+        if (inHeatmap(s))
+        {
+            continue;
+        }
 
-        this->glUseProgram(s.dataDensity ? this->ddprogram : this->program);
+        if (!multi || s.dataDensity || s.selected)
+        {
+            PlotRenderer::renderStream(this, this->multiDrawArrays, s, COLOR_TO_ARRAY(s.color), meanLine,
+                                       this->timeaxis_start, this->timeaxis_end, this->counts);
+        }
 
-        /* Set uniforms depending on whether *i is a selected stream. */
-        this->glLineWidth(s.selected ? 3.0 : 1.0);
-        this->glUniform1f(pointsizeLoc, s.selected ? 5.0 : 3.0);
-        this->glUniform3fv(s.dataDensity ? colorLocDD : colorLoc, 1, COLOR_TO_ARRAY(s.color));
-        this->glUniform1i(alwaysConnectLoc, s.alwaysConnect ? 1 : 0);
-        for (auto j = todraw.begin(); j != todraw.end(); ++j)
+        if (!s.dataDensity && !meanLine)
         {
-            QSharedPointer<CacheEntry>& ce = *j;
+            this->glUseProgram(this->aaprogram);
+            this->glUniform2f(viewportLocAA, fbo->width(), fbo->height());
+            this->glUniform1f(linewidthLocAA, s.selected ? 3.0 : 1.0);
+            this->glUniform3fv(colorLocAA, 1, COLOR_TO_ARRAY(s.color));
+            this->glUniform1i(alwaysConnectLocAA, s.alwaysConnect ? 1 : 0);
+            CacheEntry::renderMeanLinesAA(QOpenGLContext::currentContext()->extraFunctions(), this->aaquad, s.visible, s.ranges, s.ymin, s.ymax, this->timeaxis_start, this->timeaxis_end, s.timeOffset, axisMatLocAA, axisVecLocAA, this->counts);
+        }
+    }
+}
+
+void PlotRenderer::renderStream(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                const struct drawable& s, const GLfloat* color, bool meanLine,
+                                int64_t start, int64_t end, struct drawstats& stats)
+{
+    const QList<QSharedPointer<CacheEntry>>& todraw = s.visible;
+
+    funcs->glUseProgram(s.dataDensity ? PlotRenderer::ddprogram : PlotRenderer::program);
+
+    /* Set uniforms depending on whether S is a selected stream. */
+    funcs->glLineWidth(s.selected ? 3.0 : 1.0);
+    funcs->glUniform1f(pointsizeLoc, s.selected ? 5.0 : 3.0);
+    funcs->glUniform3fv(s.dataDensity ? colorLocDD : colorLoc, 1, color);
+    funcs->glUniform1i(alwaysConnectLoc, s.alwaysConnect ? 1 : 0);
+
+    if (multiDrawArrays != nullptr)
+    {
+        if (s.dataDensity)
+        {
+            CacheEntry::renderDDPlotBatch(funcs, multiDrawArrays, todraw, s.ranges, s.ymin, s.ymax, start, end, s.timeOffset, axisMatLocDD, axisVecLocDD, stats);
+        }
+        else
+        {
+            CacheEntry::renderPlotBatch(funcs, multiDrawArrays, todraw, s.ranges, s.ymin, s.ymax, start, end, s.timeOffset, axisMatLoc, axisVecLoc, tstripLoc, opacityLoc, meanLine, stats);
+        }
+    }
+    else
+    {
+        for (int j = 0; j != todraw.size(); ++j)
+        {
+            const QSharedPointer<CacheEntry>& ce = todraw[j];
             Q_ASSERT(!ce->isPlaceholder());
 
             if (s.dataDensity)
             {
-                ce->renderDDPlot(this, s.ymin, s.ymax, this->timeaxis_start, this->timeaxis_end, s.timeOffset, axisMatLocDD, axisVecLocDD);
+                ce->renderDDPlot(funcs, s.ranges[j], s.ymin, s.ymax, start, end, s.timeOffset, axisMatLocDD, axisVecLocDD, stats);
             }
             else
             {
-                ce->renderPlot(this, s.ymin, s.ymax, this->timeaxis_start, this->timeaxis_end, s.timeOffset, axisMatLoc, axisVecLoc, tstripLoc, opacityLoc);
+                ce->renderPlot(funcs, s.ranges[j], s.ymin, s.ymax, start, end, s.timeOffset, axisMatLoc, axisVecLoc, tstripLoc, opacityLoc, meanLine, stats);
             }
         }
     }
+}
 
-    this->pa->window()->resetOpenGLState();
+void PlotRenderer::renderHeatmap(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                                 const QVector<const struct drawable*>& heat, QOpenGLFramebufferObject* fbo,
+                                 QOpenGLFramebufferObject** density, GLenum format, int saturation, bool gl33,
+                                 int64_t start, int64_t end, struct drawstats& stats)
+{
+    if (*density == nullptr || (*density)->size() != fbo->size())
+    {
+        delete *density;
+        *density = new QOpenGLFramebufferObject(fbo->size(), QOpenGLFramebufferObject::CombinedDepthStencil, GL_TEXTURE_2D, format);
+    }
+
+    /* Any scissor set for scrolling applies here too, so only the strip
+     * being drawn is cleared and accumulated.
+     */
+    (*density)->bind();
+    funcs->glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    /* Every stream adds its share to the red channel of each pixel that
+     * its min-max background, vertical lines, mean line or points cover,
+     * once, however many of them cover it. The stencil buffer holds the
+     * number of the last stream counted in each pixel, and a stream is
+     * only drawn where its own number isn't there yet. The alpha channel
+     * is ignored. The streams are drawn just as they would be as lines,
+     * from the same VBOs.
+     */
+    funcs->glBlendFunc(GL_ONE, GL_ONE);
+    funcs->glEnable(GL_STENCIL_TEST);
+    funcs->glStencilMask(0xFF);
+    funcs->glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    GLfloat increment[3] = { 1.0f / saturation, 0.0f, 0.0f };
+
+    int counted = 0;
+    for (auto i = heat.begin(); i != heat.end(); ++i)
+    {
+        const struct drawable& s = **i;
+
+        if (counted == PLOT_HEATMAP_STENCIL_STREAMS)
+        {
+            funcs->glClear(GL_STENCIL_BUFFER_BIT);
+            counted = 0;
+        }
+        counted++;
+        funcs->glStencilFunc(GL_NOTEQUAL, counted, 0xFF);
+
+        if (gl33)
+        {
+            QVector<struct multigroup> groups;
+            CacheEntry::addMultiRanges(s.visible, s.ranges, s.ymin, s.ymax, start, s.timeOffset, increment, s.alwaysConnect, groups);
+
+            funcs->glUseProgram(PlotRenderer::multiprogram);
+            funcs->glLineWidth(1.0);
+            CacheEntry::renderPlotMulti(funcs, multiDrawArrays, groups, start, end, PlotRenderer::multiLocs, true, stats);
+        }
+        else
+        {
+            PlotRenderer::renderStream(funcs, multiDrawArrays, s, increment, true, start, end, stats);
+        }
+    }
+
+    funcs->glDisable(GL_STENCIL_TEST);
+
+    /* Colour-map the density over the whole plot in one pass. */
+    fbo->bind();
+    funcs->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    funcs->glUseProgram(PlotRenderer::heatprogram);
+    funcs->glActiveTexture(GL_TEXTURE0);
+    funcs->glBindTexture(GL_TEXTURE_2D, (*density)->texture());
+    funcs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    funcs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    funcs->glUniform1i(PlotRenderer::heatDensityLoc, 0);
+
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, PlotRenderer::blitquad);
+    funcs->glVertexAttribPointer(PlotRenderer::heatPositionLoc, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    funcs->glEnableVertexAttribArray(PlotRenderer::heatPositionLoc);
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    funcs->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    stats.drawcalls++;
+    stats.vertices += 4;
+
+    funcs->glDisableVertexAttribArray(PlotRenderer::heatPositionLoc);
+    funcs->glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool PlotRenderer::canReusePreviousFrame(int width, int height, int* dx)
+{
+    if (this->prevframe == nullptr || this->prevframe->size() != QSize(width, height))
+    {
+        return false;
+    }
+
+    /* Anything other than a scroll means the whole plot must be drawn
+     * again. So does a long run of scrolls, to be safe.
+     */
+    if (this->datachanged || this->signature != this->prevframe_signature ||
+            this->blitframes >= PLOT_BLIT_MAX_FRAMES)
+    {
+        return false;
+    }
+
+    int64_t span = this->timeaxis_end - this->timeaxis_start;
+    if (span <= 0 || span != this->prevframe_end - this->prevframe_start)
+    {
+        return false;
+    }
+
+    double shift = (double) (this->prevframe_start - this->timeaxis_start) * width / span;
+    if (qAbs(shift) >= width)
+    {
+        return false;
+    }
+
+    int pixels = qRound(shift);
+    if (qAbs(shift - pixels) > PLOT_BLIT_TOLERANCE)
+    {
+        return false;
+    }
+
+    *dx = pixels;
+    return true;
+}
+
+void PlotRenderer::drawPreviousFrame(int dx, int width)
+{
+    /* Copy the pixels exactly, without blending or filtering. */
+    this->glDisable(GL_BLEND);
+
+    this->glUseProgram(this->blitprogram);
+    this->glActiveTexture(GL_TEXTURE0);
+    this->glBindTexture(GL_TEXTURE_2D, this->prevframe->texture());
+    this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    this->glUniform1i(this->blitFrameLoc, 0);
+    this->glUniform2f(this->blitShiftLoc, 2.0f * dx / width, 0.0f);
+
+    this->glBindBuffer(GL_ARRAY_BUFFER, this->blitquad);
+    this->glVertexAttribPointer(this->blitPositionLoc, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    this->glEnableVertexAttribArray(this->blitPositionLoc);
+    this->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    this->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    this->counts.drawcalls++;
+    this->counts.vertices += 4;
+
+    this->glDisableVertexAttribArray(this->blitPositionLoc);
+    this->glBindTexture(GL_TEXTURE_2D, 0);
+
+    this->glEnable(GL_BLEND);
+}
+
+void PlotRenderer::savePreviousFrame(QOpenGLFramebufferObject* fbo)
+{
+    /* The framebuffer is multisampled, so it has to be resolved into a
+     * texture before it can be drawn from.
+     */
+    if (!QOpenGLFramebufferObject::hasOpenGLFramebufferBlit())
+    {
+        return;
+    }
+
+    if (this->prevframe == nullptr || this->prevframe->size() != fbo->size())
+    {
+        delete this->prevframe;
+        this->prevframe = new QOpenGLFramebufferObject(fbo->size());
+    }
+
+    QOpenGLFramebufferObject::blitFramebuffer(this->prevframe, fbo);
+    fbo->bind();
+}
+
+QOpenGLTimerQuery* PlotRenderer::beginTimerQuery()
+{
+#ifndef QT_OPENGL_ES_2
+    if (!this->collectstats || !this->hastimerqueries)
+    {
+        return nullptr;
+    }
+
+    QOpenGLTimerQuery* query;
+    if (!this->freequeries.isEmpty())
+    {
+        query = this->freequeries.takeLast();
+    }
+    else if (this->pendingframes.size() < RENDER_STATS_MAX_QUERIES)
+    {
+        query = new QOpenGLTimerQuery;
+        if (!query->create())
+        {
+            /* Fall back to the CPU timers alone. */
+            delete query;
+            this->hastimerqueries = false;
+            return nullptr;
+        }
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    query->begin();
+    return query;
+#else
+    return nullptr;
+#endif
+}
+
+void PlotRenderer::finishFrame(QOpenGLTimerQuery* query)
+{
+    this->current.frame = this->frameno++;
+    this->current.gputime = -1;
+
+#ifndef QT_OPENGL_ES_2
+    if (query != nullptr)
+    {
+        query->end();
+    }
+#endif
+
+    if (this->collectstats)
+    {
+        /* Frames are queued even if they weren't timed, to keep them in
+         * order.
+         */
+        this->pendingframes.append(qMakePair(query, this->current));
+    }
+
+    /* Uploads only happen in synchronize, which may not run before the
+     * next frame.
+     */
+    this->current.uploaded = 0;
+    this->current.synctime = 0;
+
+    /* Collect the results of earlier frames, without waiting on the GPU. */
+    while (!this->pendingframes.isEmpty())
+    {
+        QPair<QOpenGLTimerQuery*, struct framestats>& oldest = this->pendingframes.first();
+#ifndef QT_OPENGL_ES_2
+        if (oldest.first != nullptr)
+        {
+            if (!oldest.first->isResultAvailable())
+            {
+                break;
+            }
+            oldest.second.gputime = (qint64) oldest.first->waitForResult();
+            this->freequeries.append(oldest.first);
+        }
+#endif
+        if (this->finished.size() == RENDER_STATS_FRAMES)
+        {
+            this->finished.removeFirst();
+        }
+        this->finished.append(oldest.second);
+        this->pendingframes.removeFirst();
+    }
 }
@@ -3,12 +3,17 @@
 
 #include "cache.h"
 #include "plotarea.h"
+#include "renderstats.h"
 #include "stream.h"
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QQuickFramebufferObject>
 #include <QOpenGLFunctions>
-#include <QOpenGLShader>
+#include <QOpenGLShaderProgram>
+#include <QHash>
 #include <QList>
+#include <QPair>
 #include <QVector>
 #include <QUuid>
 
@@ -17,11 +22,67 @@
 #define FLAGS_ATTR_LOC 2
 #define COUNT_ATTR_LOC 3
 
+/* Used only by the antialiased line program, which takes both ends of each
+ * segment of the mean line, and the corner of the segment's quad.
+ */
+#define TIME1_ATTR_LOC 4
+#define VALUE1_ATTR_LOC 5
+#define FLAGS1_ATTR_LOC 6
+#define CORNER_ATTR_LOC 7
+
+/* The maximum number of frames in a row that are drawn by shifting the
+ * previous frame while scrolling, before the whole plot is drawn again.
+ */
+#define PLOT_BLIT_MAX_FRAMES 60
+
+/* The width, in pixels, of the area next to the newly exposed strip that
+ * is drawn again when scrolling, so that wide lines and points that cross
+ * into the strip are drawn in full.
+ */
+#define PLOT_BLIT_MARGIN 4
+
+/* How far, in pixels, a scroll may be from a whole number of pixels for
+ * the previous frame to be reused.
+ */
+#define PLOT_BLIT_TOLERANCE 0.05
+
+/* The number of bytes of cached points uploaded to the GPU, and of raw
+ * points read to decimate them, per frame. If more are needed, the rest
+ * are done in the following frames. In the meantime, streams are drawn
+ * from the entries drawn last time, and entries from a finer decimation,
+ * or from all of their points.
+ */
+#define PLOT_UPLOAD_BUDGET (16 << 20)
+
+/* Once a stream has this many visible points per pixel of width, the
+ * points and the vertical lines for disconnected points are no longer
+ * drawn, as they would be hidden under the min-max background.
+ */
+#define PLOT_DENSE_POINTS_PER_PIXEL 4
+
+/* The number of streams in the density heatmap drawn between clears of
+ * the stencil buffer that keeps each of them from being counted more than
+ * once in a pixel. The stencil buffer has 8 bits.
+ */
+#define PLOT_HEATMAP_STENCIL_STREAMS 255
+
+/* The maximum number of GPU timer queries in flight. If the GPU falls
+ * further behind than this, frames are not timed rather than waiting.
+ */
+#define RENDER_STATS_MAX_QUERIES 4
+
+class QOpenGLContext;
+class QOpenGLContextGroup;
+class QOpenGLTimerQuery;
+
 class PlotRenderer : public QQuickFramebufferObject::Renderer,
         protected QOpenGLFunctions
 {
+    friend class SnapshotRenderer;
+
 public:
     PlotRenderer(const PlotArea* plotarea);
+    ~PlotRenderer();
     void synchronize(QQuickFramebufferObject* plotareafbo) override;
     void render() override;
 
@@ -29,12 +90,106 @@ protected:
     QOpenGLFramebufferObject* createFramebufferObject(const QSize& size) override;
 
 private:
+    /* Builds the shader programs, unless they have been built already.
+     * They are shared by every renderer, so they can only be used in
+     * contexts that share with the one they were built in. Returns false,
+     * with a warning, if the current context doesn't. Contexts must check
+     * hasGL33 for themselves before using the programs that need it.
+     */
+    static bool initShaders(QOpenGLFunctions* funcs);
+
+    /* Build the programs that every context can run, and those that need
+     * OpenGL 3.3, in the current context CTX.
+     */
+    static void buildShaders(QOpenGLFunctions* funcs);
+    static void buildGL33Shaders(QOpenGLFunctions* funcs, QOpenGLContext* ctx);
+
+    /* Returns true if CTX has OpenGL 3.3 or OpenGL ES 3.0, which the
+     * antialiased line program and the multi-stream program need.
+     */
+    static bool hasGL33(QOpenGLContext* ctx);
+
+    /* Returns glMultiDrawArrays for the current context, or null if it
+     * doesn't have it.
+     */
+    static MultiDrawArraysFunc getMultiDrawArrays(QOpenGLContext* ctx);
+
+    /* Returns the most precise format of the density texture that CTX can
+     * render to.
+     */
+    static GLenum getDensityFormat(QOpenGLContext* ctx);
+
+    /* Returns true if D is drawn in the heatmap rather than as lines. */
+    static bool inHeatmap(const struct drawable& d);
+
+    /* Returns the exponent of the bucket width used to decimate raw
+     * points when SPAN nanoseconds are drawn across PIXELWIDTH pixels, or
+     * -1 if they aren't decimated.
+     */
+    static int decimationExponent(int64_t span, int pixelwidth);
+
+    /* Finds the entries of D that are visible between START and END, and
+     * the range of points to draw for each of them. Visible entries with
+     * many raw points per pixel of PIXELWIDTH are replaced by their
+     * decimations at DECIMATION. Those whose decimation hasn't been made
+     * yet are appended to TODECIMATE, and drawn from the nearest finer one
+     * in the meantime.
+     */
+    static void cull(struct drawable& d, int64_t start, int64_t end, int pixelwidth, int decimation,
+                     QList<QSharedPointer<CacheEntry>>& todecimate);
+
+    /* Sets the entries of D to draw to those that have been uploaded,
+     * with the gaps filled by the entries drawn last time, where they fit.
+     */
+    void useFallback(struct drawable& d);
+
+    /* Draws all of the streams into the current framebuffer. */
+    void renderStreams();
+
+    /* Draws S on its own with the main program, or the data density
+     * program, in COLOR, over the time domain from START to END.
+     */
+    static void renderStream(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                             const struct drawable& s, const GLfloat* color, bool meanLine,
+                             int64_t start, int64_t end, struct drawstats& stats);
+
+    /* Accumulates the streams in HEAT into the density texture, which is
+     * made in FORMAT, or remade if it isn't the size of FBO, with each
+     * stream adding 1/SATURATION to the pixels it covers. Then draws it
+     * into FBO through the colour map. GL33 is whether the context can run
+     * the multi-stream program.
+     */
+    static void renderHeatmap(QOpenGLFunctions* funcs, MultiDrawArraysFunc multiDrawArrays,
+                              const QVector<const struct drawable*>& heat, QOpenGLFramebufferObject* fbo,
+                              QOpenGLFramebufferObject** density, GLenum format, int saturation, bool gl33,
+                              int64_t start, int64_t end, struct drawstats& stats);
+
+    /* Returns true if the previous frame can be reused for this one, in
+     * which case DX is set to the number of pixels to shift it right by.
+     */
+    bool canReusePreviousFrame(int width, int height, int* dx);
+
+    /* Draws the previous frame, shifted right by DX pixels. */
+    void drawPreviousFrame(int dx, int width);
+
+    /* Keeps a copy of FBO, to be reused for the next frame. */
+    void savePreviousFrame(QOpenGLFramebufferObject* fbo);
+
+    /* Starts timing this frame on the GPU. Returns null if the frame is
+     * not to be timed.
+     */
+    QOpenGLTimerQuery* beginTimerQuery();
+
+    /* Queues the statistics for this frame, along with the timer query for
+     * it, and collects the results of any earlier queries that are ready.
+     */
+    void finishFrame(QOpenGLTimerQuery* query);
+
     static bool compiled_shaders;
+    static QOpenGLContextGroup* shadergroup;
 
-    static QOpenGLShader* mainVertexShader;
-    static QOpenGLShader* ddVertexShader;
-    static QOpenGLShader* mainFragmentShader;
-    static QOpenGLShader* ddFragmentShader;
+    static QOpenGLShaderProgram* mainProgram;
+    static QOpenGLShaderProgram* ddProgram;
 
     static GLuint program;
     static GLuint ddprogram;
@@ -51,7 +206,119 @@ private:
     static GLint axisVecLocDD;
     static GLint colorLocDD;
 
-    /* State required to actually render the plots. */
+    static QOpenGLShaderProgram* blitProgram;
+
+    /* Null until a context that can draw instanced has been made. Until
+     * then, and in contexts that can't, antialiasing is always done by
+     * multisampling.
+     */
+    static QOpenGLShaderProgram* aaProgram;
+    static GLuint aaprogram;
+    static GLint axisMatLocAA;
+    static GLint axisVecLocAA;
+    static GLint viewportLocAA;
+    static GLint linewidthLocAA;
+    static GLint alwaysConnectLocAA;
+    static GLint colorLocAA;
+    static GLuint aaquad;
+
+    /* Null until a context with GLSL 3.30 or GLSL ES 3.00 has been made.
+     * In those contexts, the unselected streams are drawn together by this
+     * program.
+     */
+    static QOpenGLShaderProgram* multiProgram;
+    static GLuint multiprogram;
+    static struct multiuniforms multiLocs;
+    static GLuint blitprogram;
+    static GLint blitShiftLoc;
+    static GLint blitFrameLoc;
+    static GLint blitPositionLoc;
+    static GLuint blitquad;
+
+    static QOpenGLShaderProgram* heatProgram;
+    static GLuint heatprogram;
+    static GLint heatDensityLoc;
+    static GLint heatPositionLoc;
+
+    /* The number of renderers drawing on a render thread other than the
+     * GUI thread, and the number of contexts made for snapshots, which
+     * are drawn on the GUI thread. The cache's VBOs are used without
+     * locking, so only one of them may be nonzero.
+     */
+    static QAtomicInt threadedrenderers;
+    static QAtomicInt snapshotcontexts;
+
+    /* glMultiDrawArrays, or null if the context doesn't have it. */
+    MultiDrawArraysFunc multiDrawArrays;
+
+    /* The samples per pixel of the framebuffer, and whether mean lines are
+     * drawn with the antialiased line program instead.
+     */
+    int samples;
+    bool analyticaa;
+    bool warnedaa;
+
+    /* How many streams in the heatmap cover each pixel, divided by the
+     * saturation. It is floating point where the context can render to
+     * that, and eight bits per channel otherwise, in which case the
+     * saturation is at most 255.
+     */
+    QOpenGLFramebufferObject* density;
+    GLenum densityformat;
+    int heatsaturation;
+
+    /* The previous frame, and the time domain that it shows. */
+    QOpenGLFramebufferObject* prevframe;
+    int64_t prevframe_start;
+    int64_t prevframe_end;
+    uint prevframe_signature;
+    int blitframes;
+
+    /* Hashes everything drawn in this frame other than the time domain.
+     * The previous frame can only be reused if it is the same, and no
+     * data changed.
+     */
+    uint signature;
+    bool datachanged;
+
+    /* Statistics for the frame being drawn. */
+    struct framestats current;
+    struct drawstats counts;
+    quint64 frameno;
+    bool collectstats;
+
+    /* Frames waiting on the GPU to finish, oldest first, and the queries
+     * that can be reused.
+     */
+    QList<QPair<QOpenGLTimerQuery*, struct framestats>> pendingframes;
+    QList<QOpenGLTimerQuery*> freequeries;
+    bool hastimerqueries;
+
+    /* Frames waiting to be handed to the Plot Area in synchronize. */
+    QVector<struct framestats> finished;
+
+    /* How long this renderer took to start up, in nanoseconds. The first
+     * frame time is -1 until the first frame has been drawn.
+     */
+    QElapsedTimer sincecreated;
+    qint64 shadertime;
+    qint64 firstframetime;
+    bool startupreported;
+
+    /* Whether the shader programs can be used in this context. If they
+     * can't, nothing is drawn. The antialiased line program and the
+     * multi-stream program are shared with contexts that might not be
+     * able to run them, so whether this one can is kept separately.
+     */
+    bool shadersready;
+    bool gl33;
+
+    /* Whether this renderer draws on a render thread of its own. */
+    bool threaded;
+
+    /* State required to actually render the plots. The drawables are kept
+     * from frame to frame, and only updated where the streams changed.
+     */
     QVector<struct drawable> streams; // the streams to draw
     const PlotArea* pa;
 
@@ -59,6 +326,15 @@ private:
     QList<QSharedPointer<CacheEntry>> todraw;
     int64_t timeaxis_start;
     int64_t timeaxis_end;
+    const TimeAxis* timeaxis;
+    uint64_t timeaxis_version;
+
+    /* The width of the plot in pixels, and the exponent of the bucket
+     * width used to decimate raw points at this scale, or -1 if there is
+     * none.
+     */
+    int pixelwidth;
+    int decimation;
 };
 
 #endif // PLOTRENDERER_H
@@ -0,0 +1,395 @@
+#include "recorderdatasource.h"
+#include "requester.h"
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTimer>
+#include <QVector>
+
+RecorderDataSource::RecorderDataSource(QObject* parent) : DataSource(parent),
+    source(nullptr), mode(Record), timeScale(1.0), logopen(false)
+{
+}
+
+RecorderDataSource::~RecorderDataSource()
+{
+    this->closeLog();
+}
+
+DataSource* RecorderDataSource::getSource() const
+{
+    return this->source;
+}
+
+void RecorderDataSource::setSource(DataSource* wrapped)
+{
+    this->source = wrapped;
+}
+
+QString RecorderDataSource::getLogFile() const
+{
+    return this->filename;
+}
+
+void RecorderDataSource::setLogFile(QString filename)
+{
+    this->closeLog();
+    this->filename = filename;
+}
+
+RecorderDataSource::Mode RecorderDataSource::getMode() const
+{
+    return this->mode;
+}
+
+void RecorderDataSource::setMode(Mode newmode)
+{
+    this->closeLog();
+    this->mode = newmode;
+}
+
+bool RecorderDataSource::openLog()
+{
+    if (this->logopen)
+    {
+        return true;
+    }
+
+    if (this->filename.isEmpty())
+    {
+        qWarning("Recorder data source has no log file");
+        return false;
+    }
+
+    if (this->mode == Replay)
+    {
+        this->logopen = this->loadLog();
+        return this->logopen;
+    }
+
+    this->log.setFileName(this->filename);
+    if (!this->log.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning("Could not open %s for recording", qPrintable(this->filename));
+        return false;
+    }
+
+    this->logstream.setDevice(&this->log);
+    this->logstream.setVersion(QDataStream::Qt_5_0);
+    this->logstream << (quint64) RECORDER_LOG_MAGIC << (quint32) RECORDER_LOG_VERSION;
+
+    this->logopen = true;
+    return true;
+}
+
+void RecorderDataSource::closeLog()
+{
+    if (this->log.isOpen())
+    {
+        this->logstream.setDevice(nullptr);
+        this->log.close();
+    }
+    this->recorded.clear();
+    this->logopen = false;
+}
+
+bool RecorderDataSource::loadLog()
+{
+    QFile infile(this->filename);
+    if (!infile.open(QIODevice::ReadOnly))
+    {
+        qWarning("Could not open %s for replay", qPrintable(this->filename));
+        return false;
+    }
+
+    QDataStream in(&infile);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint64 magic;
+    quint32 version;
+    in >> magic >> version;
+    if (magic != RECORDER_LOG_MAGIC || version < 1 || version > RECORDER_LOG_VERSION)
+    {
+        qWarning("%s is not a recorded query log", qPrintable(this->filename));
+        return false;
+    }
+
+    this->recorded.clear();
+
+    while (!in.atEnd())
+    {
+        QByteArray request;
+        struct recordedcall call;
+        in >> request;
+        if (version == 1)
+        {
+            /* The first version also recorded when each query was made,
+             * which was never used.
+             */
+            qint64 offset;
+            in >> offset;
+        }
+        in >> call.latency >> call.response;
+        if (in.status() != QDataStream::Ok)
+        {
+            /* The recording was probably cut off while it was being written. */
+            qWarning("Truncated record in %s", qPrintable(this->filename));
+            break;
+        }
+        this->recorded[request].append(call);
+    }
+
+    return true;
+}
+
+void RecorderDataSource::record(const QByteArray& request, qint64 latency, const QByteArray& response)
+{
+    if (!this->logopen || this->mode != Record)
+    {
+        /* The log was closed or changed while the query was outstanding. */
+        return;
+    }
+
+    this->logstream << request << latency << response;
+}
+
+void RecorderDataSource::replay(const QByteArray& request, std::function<void(QByteArray)> reply)
+{
+    QByteArray response;
+    qint64 delay = 0;
+
+    if (this->openLog())
+    {
+        auto i = this->recorded.find(request);
+        if (i != this->recorded.end() && !i->isEmpty())
+        {
+            /* Serve repeated queries in the order that they were recorded,
+             * reusing the last response once we run out.
+             */
+            struct recordedcall call = (i->size() == 1) ? i->first() : i->takeFirst();
+            response = call.response;
+            delay = qRound64((call.latency / 1000.0) * this->timeScale);
+        }
+        else
+        {
+            qWarning("No recorded response for query");
+        }
+    }
+
+    /* Always reply asynchronously, as a real data source would. */
+    QTimer::singleShot((int) delay, [reply, response]()
+    {
+        reply(response);
+    });
+}
+
+void RecorderDataSource::alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback)
+{
+    QByteArray request;
+    QDataStream reqstream(&request, QIODevice::WriteOnly);
+    reqstream.setVersion(QDataStream::Qt_5_0);
+    reqstream << (quint8) RecordType::ALIGNED_WINDOWS << uuid << (qint64) start << (qint64) end << (quint8) pwe;
+
+    if (this->mode == Replay)
+    {
+        this->replay(request, [callback](QByteArray response)
+        {
+            QDataStream in(response);
+            in.setVersion(QDataStream::Qt_5_0);
+
+            quint64 generation = GENERATION_MAX;
+            qint32 len = 0;
+            if (!response.isEmpty())
+            {
+                in >> generation >> len;
+            }
+
+            QVector<struct statpt> points(len);
+            for (int i = 0; i < len; i++)
+            {
+                struct statpt& pt = points[i];
+                qint64 time;
+                quint64 count;
+                in >> time >> pt.min >> pt.mean >> pt.max >> count;
+                pt.time = time;
+                pt.count = count;
+            }
+
+            callback(points.data(), len, generation);
+        });
+        return;
+    }
+
+    if (this->source == nullptr || !this->openLog())
+    {
+        qWarning("Recorder data source is not ready to record");
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(nullptr, 0, GENERATION_MAX);
+        });
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    this->source->alignedWindows(uuid, start, end, pwe, [this, request, timer, callback](struct statpt* points, int len, uint64_t generation)
+    {
+        qint64 latency = timer.nsecsElapsed() / 1000;
+
+        QByteArray response;
+        QDataStream out(&response, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << (quint64) generation << (qint32) len;
+        for (int i = 0; i < len; i++)
+        {
+            struct statpt* pt = &points[i];
+            out << (qint64) pt->time << pt->min << pt->mean << pt->max << (quint64) pt->count;
+        }
+
+        this->record(request, latency, response);
+
+        callback(points, len, generation);
+    });
+}
+
+void RecorderDataSource::brackets(const QList<QUuid> uuids, BracketCallback callback)
+{
+    QByteArray request;
+    QDataStream reqstream(&request, QIODevice::WriteOnly);
+    reqstream.setVersion(QDataStream::Qt_5_0);
+    reqstream << (quint8) RecordType::BRACKETS << (qint32) uuids.size();
+    for (auto i = uuids.begin(); i != uuids.end(); i++)
+    {
+        reqstream << *i;
+    }
+
+    if (this->mode == Replay)
+    {
+        this->replay(request, [callback](QByteArray response)
+        {
+            QDataStream in(response);
+            in.setVersion(QDataStream::Qt_5_0);
+
+            QHash<QUuid, struct brackets> brkts;
+            qint32 len = 0;
+            if (!response.isEmpty())
+            {
+                in >> len;
+            }
+
+            for (int i = 0; i < len; i++)
+            {
+                QUuid uuid;
+                qint64 lowerbound;
+                qint64 upperbound;
+                in >> uuid >> lowerbound >> upperbound;
+                brkts[uuid].lowerbound = lowerbound;
+                brkts[uuid].upperbound = upperbound;
+            }
+
+            callback(brkts);
+        });
+        return;
+    }
+
+    if (this->source == nullptr || !this->openLog())
+    {
+        qWarning("Recorder data source is not ready to record");
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(QHash<QUuid, struct brackets>());
+        });
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    this->source->brackets(uuids, [this, request, timer, callback](QHash<QUuid, struct brackets> brkts)
+    {
+        qint64 latency = timer.nsecsElapsed() / 1000;
+
+        QByteArray response;
+        QDataStream out(&response, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << (qint32) brkts.size();
+        for (auto i = brkts.begin(); i != brkts.end(); i++)
+        {
+            out << i.key() << (qint64) i->lowerbound << (qint64) i->upperbound;
+        }
+
+        this->record(request, latency, response);
+
+        callback(brkts);
+    });
+}
+
+void RecorderDataSource::changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback)
+{
+    QByteArray request;
+    QDataStream reqstream(&request, QIODevice::WriteOnly);
+    reqstream.setVersion(QDataStream::Qt_5_0);
+    reqstream << (quint8) RecordType::CHANGED_RANGES << uuid << (quint64) fromGen << (quint64) toGen << (quint8) pwe;
+
+    if (this->mode == Replay)
+    {
+        this->replay(request, [callback](QByteArray response)
+        {
+            QDataStream in(response);
+            in.setVersion(QDataStream::Qt_5_0);
+
+            quint64 generation = GENERATION_MAX;
+            qint32 len = 0;
+            if (!response.isEmpty())
+            {
+                in >> generation >> len;
+            }
+
+            QVector<struct timerange> changed(len);
+            for (int i = 0; i < len; i++)
+            {
+                qint64 start;
+                qint64 end;
+                in >> start >> end;
+                changed[i].start = start;
+                changed[i].end = end;
+            }
+
+            callback(changed.data(), len, generation);
+        });
+        return;
+    }
+
+    if (this->source == nullptr || !this->openLog())
+    {
+        qWarning("Recorder data source is not ready to record");
+        QTimer::singleShot(0, [callback]()
+        {
+            callback(nullptr, 0, GENERATION_MAX);
+        });
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    this->source->changedRanges(uuid, fromGen, toGen, pwe, [this, request, timer, callback](struct timerange* changed, int len, uint64_t generation)
+    {
+        qint64 latency = timer.nsecsElapsed() / 1000;
+
+        QByteArray response;
+        QDataStream out(&response, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << (quint64) generation << (qint32) len;
+        for (int i = 0; i < len; i++)
+        {
+            out << (qint64) changed[i].start << (qint64) changed[i].end;
+        }
+
+        this->record(request, latency, response);
+
+        callback(changed, len, generation);
+    });
+}
@@ -0,0 +1,106 @@
+#ifndef RECORDERDATASOURCE_H
+#define RECORDERDATASOURCE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QUuid>
+
+#include "datasource.h"
+
+/* Magic number and version at the start of every log file. */
+#define RECORDER_LOG_MAGIC Q_UINT64_C(0x4D52504C4F544C47)
+#define RECORDER_LOG_VERSION 2
+
+enum class RecordType : quint8
+{
+    ALIGNED_WINDOWS = 1,
+    BRACKETS = 2,
+    CHANGED_RANGES = 3
+};
+
+/* A single recorded call, as loaded back from the log. */
+struct recordedcall
+{
+    qint64 latency; // microseconds between the request and the response
+    QByteArray response;
+};
+
+/* A decorator around another Data Source. In RECORD mode, every query is
+ * forwarded to the wrapped source, and the request parameters, response
+ * payload and latency are appended to a compact binary log. In REPLAY
+ * mode, no wrapped source is needed; queries are answered from the log,
+ * after the recorded latency multiplied by the time scale.
+ */
+class RecorderDataSource : public DataSource
+{
+    Q_OBJECT
+    Q_PROPERTY(DataSource* source READ getSource WRITE setSource)
+    Q_PROPERTY(QString logFile READ getLogFile WRITE setLogFile)
+    Q_PROPERTY(Mode mode READ getMode WRITE setMode)
+    Q_PROPERTY(double timeScale MEMBER timeScale)
+
+public:
+    enum Mode
+    {
+        Record,
+        Replay
+    };
+    Q_ENUM(Mode)
+
+    explicit RecorderDataSource(QObject* parent = nullptr);
+    virtual ~RecorderDataSource();
+
+    DataSource* getSource() const;
+    void setSource(DataSource* wrapped);
+
+    QString getLogFile() const;
+    void setLogFile(QString filename);
+
+    Mode getMode() const;
+    void setMode(Mode newmode);
+
+    void alignedWindows(const QUuid& uuid, int64_t start, int64_t end, uint8_t pwe, ReqCallback callback) override;
+    void brackets(const QList<QUuid> uuids, BracketCallback callback) override;
+    void changedRanges(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, uint8_t pwe, ChangedRangesCallback callback) override;
+
+signals:
+
+public slots:
+
+private:
+    bool openLog();
+    void closeLog();
+    bool loadLog();
+
+    void record(const QByteArray& request, qint64 latency, const QByteArray& response);
+
+    /* Finds the response recorded for REQUEST, and calls REPLY with it
+     * after the (scaled) recorded latency. If there is no such response,
+     * REPLY is called with an empty byte array.
+     */
+    void replay(const QByteArray& request, std::function<void(QByteArray)> reply);
+
+    DataSource* source;
+    QString filename;
+    Mode mode;
+
+    /* Multiplier applied to recorded latencies during replay. 1.0
+     * reproduces the original timing, and 0.0 replays as fast as possible.
+     */
+    double timeScale;
+
+    QFile log;
+    QDataStream logstream;
+    bool logopen;
+
+    /* Maps a serialized request to the responses recorded for it, in the order
+     * in which they were recorded. */
+    QHash<QByteArray, QList<struct recordedcall>> recorded;
+};
+
+#endif // RECORDERDATASOURCE_H
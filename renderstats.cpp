@@ -0,0 +1,159 @@
+#include "renderstats.h"
+
+#include <QMetaObject>
+
+RenderStats::RenderStats(QObject* parent) : QObject(parent),
+    frames(RENDER_STATS_FRAMES), next(0), count(0), enabled(true),
+    notifypending(false), shadertime(-1), firstframetime(-1)
+{
+    this->notifytimer.setSingleShot(true);
+    this->notifytimer.setInterval(RENDER_STATS_NOTIFY_INTERVAL);
+    connect(&this->notifytimer, &QTimer::timeout, this, &RenderStats::notify);
+}
+
+bool RenderStats::isEnabled() const
+{
+    return this->enabled;
+}
+
+void RenderStats::setEnabled(bool enable)
+{
+    if (enable != this->enabled)
+    {
+        this->enabled = enable;
+        emit this->enabledChanged();
+    }
+}
+
+int RenderStats::getCount() const
+{
+    return this->count;
+}
+
+qreal RenderStats::getShaderTime() const
+{
+    return this->shadertime < 0 ? -1.0 : this->shadertime / 1000000.0;
+}
+
+qreal RenderStats::getFirstFrameTime() const
+{
+    return this->firstframetime < 0 ? -1.0 : this->firstframetime / 1000000.0;
+}
+
+void RenderStats::recordStartup(qint64 shadertime, qint64 firstframetime)
+{
+    this->shadertime = shadertime;
+    this->firstframetime = firstframetime;
+
+    /* Called on the render thread. */
+    QMetaObject::invokeMethod(this, "startupRecorded", Qt::QueuedConnection);
+}
+
+void RenderStats::record(const struct framestats& stats)
+{
+    this->frames[this->next] = stats;
+    this->next = (this->next + 1) % RENDER_STATS_FRAMES;
+    this->count = qMin(this->count + 1, RENDER_STATS_FRAMES);
+
+    /* Called on the render thread, where the timer can't be started. */
+    if (!this->notifypending)
+    {
+        this->notifypending = true;
+        QMetaObject::invokeMethod(&this->notifytimer, "start", Qt::QueuedConnection);
+    }
+}
+
+void RenderStats::notify()
+{
+    this->notifypending = false;
+    emit this->updated();
+}
+
+QVariantMap RenderStats::toVariant(const struct framestats& stats)
+{
+    QVariantMap map;
+    map.insert("frame", (qreal) stats.frame);
+    map.insert("drawCalls", stats.drawcalls);
+    map.insert("vertices", (qreal) stats.vertices);
+    map.insert("uploadedBytes", (qreal) stats.uploaded);
+    map.insert("vboCount", stats.vbos);
+    map.insert("samples", stats.samples);
+    map.insert("analyticAntialiasing", stats.analyticaa);
+
+    /* Times are given to QML in milliseconds. */
+    map.insert("syncTime", stats.synctime / 1000000.0);
+    map.insert("renderTime", stats.rendertime / 1000000.0);
+    map.insert("gpuTime", stats.gputime < 0 ? -1.0 : stats.gputime / 1000000.0);
+    return map;
+}
+
+QVariantMap RenderStats::latest() const
+{
+    if (this->count == 0)
+    {
+        return QVariantMap();
+    }
+    int last = (this->next + RENDER_STATS_FRAMES - 1) % RENDER_STATS_FRAMES;
+    return RenderStats::toVariant(this->frames[last]);
+}
+
+QVariantList RenderStats::history() const
+{
+    QVariantList list;
+    int first = (this->next + RENDER_STATS_FRAMES - this->count) % RENDER_STATS_FRAMES;
+    for (int i = 0; i != this->count; i++)
+    {
+        list.append(RenderStats::toVariant(this->frames[(first + i) % RENDER_STATS_FRAMES]));
+    }
+    return list;
+}
+
+QVariantMap RenderStats::average() const
+{
+    QVariantMap map;
+    if (this->count == 0)
+    {
+        return map;
+    }
+
+    double drawcalls = 0.0;
+    double vertices = 0.0;
+    double uploaded = 0.0;
+    double vbos = 0.0;
+    double synctime = 0.0;
+    double rendertime = 0.0;
+    double gputime = 0.0;
+    int gpuframes = 0;
+
+    for (int i = 0; i != this->count; i++)
+    {
+        const struct framestats& stats = this->frames[i];
+        drawcalls += stats.drawcalls;
+        vertices += stats.vertices;
+        uploaded += stats.uploaded;
+        vbos += stats.vbos;
+        synctime += stats.synctime;
+        rendertime += stats.rendertime;
+        if (stats.gputime >= 0)
+        {
+            gputime += stats.gputime;
+            gpuframes++;
+        }
+    }
+
+    map.insert("drawCalls", drawcalls / this->count);
+    map.insert("vertices", vertices / this->count);
+    map.insert("uploadedBytes", uploaded / this->count);
+    map.insert("vboCount", vbos / this->count);
+    map.insert("syncTime", synctime / this->count / 1000000.0);
+    map.insert("renderTime", rendertime / this->count / 1000000.0);
+    map.insert("gpuTime", gpuframes == 0 ? -1.0 : gputime / gpuframes / 1000000.0);
+    return map;
+}
+
+void RenderStats::clear()
+{
+    this->next = 0;
+    this->count = 0;
+    emit this->updated();
+}
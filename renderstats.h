@@ -0,0 +1,112 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <cstdint>
+
+#include <QObject>
+#include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
+#include <QVector>
+
+/* The number of frames kept in the history of each Plot Area. */
+#define RENDER_STATS_FRAMES 256
+
+/* The minimum time between updated signals, in milliseconds. */
+#define RENDER_STATS_NOTIFY_INTERVAL 250
+
+/* What it took to draw one frame of a Plot Area. Times are in nanoseconds. */
+struct framestats
+{
+    quint64 frame;
+    int drawcalls;
+    int64_t vertices;
+    int64_t uploaded; // bytes uploaded to VBOs in synchronize
+    int vbos; // buffers in the VBO arena
+    int samples; // MSAA samples per pixel
+    bool analyticaa; // mean lines drawn with analytic antialiasing
+    qint64 synctime;
+    qint64 rendertime; // CPU time spent issuing the draw calls
+    qint64 gputime; // -1 if timer queries are not available
+};
+
+/* Keeps a ring buffer of the statistics of the most recent frames drawn by
+ * a Plot Area, for QML to inspect. Frames are recorded by the renderer
+ * while the GUI thread is blocked, so no locking is needed. The signals
+ * are emitted on the GUI thread, and updated at most once every
+ * RENDER_STATS_NOTIFY_INTERVAL milliseconds.
+ */
+class RenderStats : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ isEnabled WRITE setEnabled NOTIFY enabledChanged)
+    Q_PROPERTY(int count READ getCount NOTIFY updated)
+    Q_PROPERTY(qreal shaderTime READ getShaderTime NOTIFY startupRecorded)
+    Q_PROPERTY(qreal firstFrameTime READ getFirstFrameTime NOTIFY startupRecorded)
+
+public:
+    explicit RenderStats(QObject* parent = nullptr);
+
+    bool isEnabled() const;
+    void setEnabled(bool enable);
+
+    int getCount() const;
+
+    /* Time spent building the shader programs when the renderer was
+     * created, in milliseconds. This is much shorter when the programs are
+     * loaded from the disk cache. -1 if not yet known.
+     */
+    qreal getShaderTime() const;
+
+    /* Time from the renderer being created to the end of its first frame,
+     * in milliseconds. -1 if not yet known.
+     */
+    qreal getFirstFrameTime() const;
+
+    void record(const struct framestats& stats);
+
+    /* Records how long the renderer took to start up. Times are in
+     * nanoseconds.
+     */
+    void recordStartup(qint64 shadertime, qint64 firstframetime);
+
+    /* Returns the most recent frame, or an empty map if there is none. */
+    Q_INVOKABLE QVariantMap latest() const;
+
+    /* Returns the recorded frames, oldest first. */
+    Q_INVOKABLE QVariantList history() const;
+
+    /* Returns the average of each statistic over the recorded frames. */
+    Q_INVOKABLE QVariantMap average() const;
+
+    Q_INVOKABLE void clear();
+
+signals:
+    void enabledChanged();
+    void updated();
+    void startupRecorded();
+
+public slots:
+
+private slots:
+    void notify();
+
+private:
+    static QVariantMap toVariant(const struct framestats& stats);
+
+    QVector<struct framestats> frames;
+    int next;
+    int count;
+    bool enabled;
+
+    /* Started from the render thread with a queued call, so that frames
+     * recorded close together are reported once.
+     */
+    QTimer notifytimer;
+    bool notifypending;
+
+    qint64 shadertime;
+    qint64 firstframetime;
+};
+
+#endif // RENDERSTATS_H
@@ -116,3 +116,8 @@ void Requester::makeChangedRangesQuery(const QUuid& uuid, uint64_t fromGen, uint
 {
     source->changedRanges(uuid, fromGen, toGen, 0, callback);
 }
+
+void Requester::makeChangedRangesBatch(const QHash<QUuid, uint64_t> fromGens, uint64_t toGen, uint8_t pwe, DataSource* source, BatchChangedRangesCallback callback)
+{
+    source->changedRangesBatch(fromGens, toGen, pwe, callback);
+}
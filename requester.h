@@ -6,8 +6,10 @@
 
 #include "utils.h"
 
+#include <QHash>
 #include <QUuid>
 #include <QVariantMap>
+#include <QVector>
 
 #define GENERATION_MAX Q_UINT64_C(0xFFFFFFFFFFFFFFFF)
 
@@ -38,9 +40,19 @@ struct timerange {
     int64_t end;
 };
 
+/* The ranges of time in which a stream changed, and the generation that
+ * the changes bring the stream up to.
+ */
+struct changedranges {
+    QVector<struct timerange> ranges;
+    uint64_t gen;
+};
+
 typedef std::function<void(struct statpt*, int len, uint64_t gen)> ReqCallback;
 typedef std::function<void(QHash<QUuid, struct brackets>)> BracketCallback;
 typedef std::function<void(struct timerange*, int len, uint64_t gen)> ChangedRangesCallback;
+typedef std::function<void(struct rawpt*, int len)> TailCallback;
+typedef std::function<void(QHash<QUuid, struct changedranges>)> BatchChangedRangesCallback;
 
 class DataSource;
 
@@ -53,6 +65,7 @@ public:
                          DataSource* source, ReqCallback callback);
     void makeBracketRequest(const QList<QUuid> uuids, DataSource* source, BracketCallback callback);
     void makeChangedRangesQuery(const QUuid& uuid, uint64_t fromGen, uint64_t toGen, DataSource* source, ChangedRangesCallback callback);
+    void makeChangedRangesBatch(const QHash<QUuid, uint64_t> fromGens, uint64_t toGen, uint8_t pwe, DataSource* source, BatchChangedRangesCallback callback);
 
 private:
     LatencyBuffer data_performance;
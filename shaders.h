@@ -79,5 +79,208 @@ void main()
 }
 )shadercode";
 
+/* Draws each segment of a mean line as a quad, one instance per segment.
+ * TIME, VALUE and FLAGS are the point at the start of the segment, and
+ * TIME1, VALUE1 and FLAGS1 the point at its end. CORNER says which corner of
+ * the quad this vertex is: x is 0 at the start and 1 at the end, and y is -1
+ * or 1 for either side of the line.
+ */
+char aavShaderStr[] = R"shadercode(
+uniform highp mat3 axisTransform;
+uniform highp vec2 axisBase;
+uniform highp vec2 viewport;
+uniform highp float linewidth;
+uniform bool alwaysConnect;
+attribute highp float time;
+attribute highp float value;
+attribute highp float flags;
+attribute highp float time1;
+attribute highp float value1;
+attribute highp float flags1;
+attribute highp vec2 corner;
+varying highp float edge;
+varying highp float render;
+
+/* The same test that the main shader does for the mean line. */
+highp float connects(highp float f)
+{
+    if ((alwaysConnect && (f <= 0.625 || f >= 0.875)) || f <= 0.5 || f >= 1.5)
+    {
+        return (!alwaysConnect && f >= -1.5 && f <= -0.5) ? 0.0 : 1.0;
+    }
+    return 0.0;
+}
+
+void main()
+{
+    /* Work in pixels, so that the line is as wide in every direction. */
+    vec2 halfview = viewport * 0.5;
+    vec2 start = (axisTransform * vec3(vec2(time, value) - axisBase, 1.0)).xy * halfview;
+    vec2 end = (axisTransform * vec3(vec2(time1, value1) - axisBase, 1.0)).xy * halfview;
+
+    vec2 along = end - start;
+    highp float len = length(along);
+    along = (len > 0.0) ? along / len : vec2(1.0, 0.0);
+    vec2 across = vec2(-along.y, along.x);
+
+    /* Leave a pixel on each side for the line to fade out over, and extend
+     * the ends by as much, so that consecutive segments meet.
+     */
+    highp float halfwidth = linewidth * 0.5 + 1.0;
+    vec2 position = mix(start, end, corner.x) + along * (corner.x * 2.0 - 1.0) * halfwidth
+            + across * corner.y * halfwidth;
+    gl_Position = vec4(position / halfview, 0.0, 1.0);
+
+    edge = corner.y * halfwidth;
+    render = min(connects(flags), connects(flags1));
+})shadercode";
+
+char aafShaderStr[] = R"shadercode(
+uniform highp vec3 color;
+uniform highp float linewidth;
+varying highp float edge;
+varying highp float render;
+void main()
+{
+    if (render < 1.0)
+    {
+        discard;
+    }
+
+    /* Fade out over the pixel at each edge of the line. */
+    highp float coverage = clamp(linewidth * 0.5 + 0.5 - abs(edge), 0.0, 1.0);
+    gl_FragColor = vec4(color, coverage);
+})shadercode";
+
+/* Draws the ranges of many streams at once. These need GLSL 3.30 or GLSL
+ * ES 3.00; the #version line, the default precisions for GLSL ES, and the
+ * definition of MULTI_STREAM_RANGES are added before compiling them. Each range has its own transform and
+ * color, found by looking up the index of the vertex among the starts of
+ * the ranges. RANGEAXIS is the time base, y base, y scale, and 1 if the
+ * points are always connected. Otherwise, this works like vShaderStr.
+ */
+char multivShaderStr[] = R"shadercode(
+uniform float timeScale;
+uniform int vertsPerPoint;
+uniform bool tstrip;
+uniform float pointsize;
+uniform int rangeCount;
+uniform int rangeStart[MULTI_STREAM_RANGES];
+uniform vec4 rangeAxis[MULTI_STREAM_RANGES];
+uniform vec3 rangeColor[MULTI_STREAM_RANGES];
+in float time;
+in float value;
+in float flags;
+out float render;
+flat out vec3 vcolor;
+void main()
+{
+    /* Find the last range that starts at or before this point. */
+    int point = gl_VertexID / vertsPerPoint;
+    int lo = 0;
+    int hi = rangeCount - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (rangeStart[mid] <= point)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    vec4 axis = rangeAxis[lo];
+    vcolor = rangeColor[lo];
+
+    gl_Position = vec4((time - axis.x) * timeScale - 1.0, (value - axis.y) * axis.z + 1.0, 0.0, 1.0);
+    gl_PointSize = pointsize;
+
+    bool alwaysConnect = axis.w > 0.5;
+    if ((alwaysConnect && (flags <= 0.625 || flags >= 0.875)) || flags <= 0.5 || flags >= 1.5)
+    {
+        render = (tstrip ^^ (!alwaysConnect && flags >= -1.5 && flags <= -0.5)) ? 1.0 : 0.0;
+    }
+    else
+    {
+        render = 0.0;
+    }
+})shadercode";
+
+char multifShaderStr[] = R"shadercode(
+uniform float opacity;
+in float render;
+flat in vec3 vcolor;
+out vec4 fragColor;
+void main()
+{
+    if (render >= 1.0)
+    {
+        fragColor = vec4(vcolor, opacity);
+    }
+    else
+    {
+        discard;
+    }
+})shadercode";
+
+char blitvShaderStr[] = R"shadercode(
+uniform highp vec2 shift;
+attribute highp vec2 position;
+varying highp vec2 texcoord;
+void main()
+{
+    /* Draw the whole previous frame, moved over by SHIFT. */
+    texcoord = position * 0.5 + 0.5;
+    gl_Position = vec4(position + shift, 0.0, 1.0);
+}
+)shadercode";
+
+char blitfShaderStr[] = R"shadercode(
+uniform sampler2D frame;
+varying highp vec2 texcoord;
+void main()
+{
+    gl_FragColor = texture2D(frame, texcoord);
+}
+)shadercode";
+
+char heatvShaderStr[] = R"shadercode(
+attribute highp vec2 position;
+varying highp vec2 texcoord;
+void main()
+{
+    texcoord = position * 0.5 + 0.5;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)shadercode";
+
+char heatfShaderStr[] = R"shadercode(
+uniform sampler2D density;
+varying highp vec2 texcoord;
+void main()
+{
+    /* The red channel holds the density, which is 1.0 where as many
+     * streams overlap as the saturation.
+     */
+    highp float d = min(texture2D(density, texcoord).r, 1.0);
+    if (d <= 0.0)
+    {
+        discard;
+    }
+
+    /* Blue through red to yellow. The square root spreads out the low
+     * densities, which is where most of the pixels are.
+     */
+    d = sqrt(d);
+    highp vec3 low = vec3(0.15, 0.1, 0.6);
+    highp vec3 mid = vec3(0.9, 0.2, 0.15);
+    highp vec3 high = vec3(1.0, 0.95, 0.3);
+    highp vec3 c = d < 0.5 ? mix(low, mid, d * 2.0) : mix(mid, high, d * 2.0 - 1.0);
+    gl_FragColor = vec4(c, 0.4 + 0.6 * d);
+}
+)shadercode";
+
 
 #endif // SHADERS_H
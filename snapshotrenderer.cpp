@@ -0,0 +1,438 @@
+#include "snapshotrenderer.h"
+#include "cache.h"
+#include "mrplotter.h"
+#include "plotarea.h"
+#include "plotrenderer.h"
+#include "stream.h"
+#include "utils.h"
+
+#include <cstring>
+
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFramebufferObjectFormat>
+#include <QPointer>
+#include <QSurfaceFormat>
+
+SnapshotRenderer::SnapshotRenderer(QObject* parent) : QObject(parent),
+    nextid(0), scheduled(false), samples(DEFAULT_MSAA_SAMPLES),
+    context(nullptr), surface(nullptr), usable(false), gl33(false), fbo(nullptr), fbosamples(0),
+    density(nullptr), densityformat(GL_RGBA), multiDrawArrays(nullptr), rendered(0), rendertime(0)
+{
+    memset(&this->counts, 0, sizeof(this->counts));
+}
+
+SnapshotRenderer::~SnapshotRenderer()
+{
+    if (this->context != nullptr)
+    {
+        if (this->context->makeCurrent(this->surface))
+        {
+            delete this->fbo;
+            delete this->density;
+            this->context->doneCurrent();
+        }
+        delete this->context;
+        delete this->surface;
+        PlotRenderer::snapshotcontexts.deref();
+    }
+}
+
+int SnapshotRenderer::enqueue(const QList<Stream*>& streams, int64_t start, int64_t end,
+                              const QSize& size, const QString& path)
+{
+    struct snapshotjob job;
+    job.id = this->nextid++;
+    job.start = start;
+    job.end = end;
+    job.size = size;
+    job.path = path;
+    job.waiting = -1;
+    job.heatsaturation = 0;
+
+    for (auto i = streams.begin(); i != streams.end(); i++)
+    {
+        Stream* s = *i;
+        Q_ASSERT_X(s != nullptr, "enqueue", "invalid value in streamlist");
+
+        struct snapshotstream ss;
+        ss.source = s->getDataSource();
+        ss.uuid = s->uuid;
+        if (!s->toDrawable(ss.d))
+        {
+            continue;
+        }
+
+        /* The stream's own entries are for whatever it is showing now. */
+        ss.d.data.clear();
+        ss.d.stream = s;
+        ss.d.pending = false;
+        ss.d.dirty = false;
+        job.streams.append(ss);
+
+        if (job.heatsaturation == 0 && PlotRenderer::inHeatmap(ss.d))
+        {
+            job.heatsaturation = (s->plotarea != nullptr) ? s->plotarea->getHeatmapSaturation() : DEFAULT_HEATMAP_SATURATION;
+        }
+    }
+
+    this->queue.append(job);
+    this->scheduleProcessing();
+    emit this->queueChanged();
+    return job.id;
+}
+
+int SnapshotRenderer::enqueue(QList<QVariant> streams, QList<qreal> domain,
+                              int width, int height, QString path)
+{
+    QList<Stream*> streamlist;
+    for (auto i = streams.begin(); i != streams.end(); i++)
+    {
+        Stream* s = i->value<Stream*>();
+        Q_ASSERT_X(s != nullptr, "enqueue", "invalid member in stream list");
+        if (s != nullptr)
+        {
+            streamlist.append(s);
+        }
+    }
+
+    int64_t start;
+    int64_t end;
+    fromJSList(domain, &start, &end);
+
+    return this->enqueue(streamlist, start, end, QSize(width, height), path);
+}
+
+void SnapshotRenderer::clear()
+{
+    /* Data that is still on its way is dropped when it arrives. */
+    this->queue.clear();
+    emit this->queueChanged();
+}
+
+int SnapshotRenderer::getMsaaSamples() const
+{
+    return this->samples;
+}
+
+void SnapshotRenderer::setMsaaSamples(int samples)
+{
+    if (samples != 0 && samples != 2 && samples != 4 && samples != 8)
+    {
+        qWarning("Invalid MSAA sample count %d: must be 0, 2, 4 or 8", samples);
+        return;
+    }
+    this->samples = samples;
+}
+
+int SnapshotRenderer::getPending() const
+{
+    return this->queue.size();
+}
+
+int SnapshotRenderer::getRendered() const
+{
+    return this->rendered;
+}
+
+qreal SnapshotRenderer::getRendersPerSecond() const
+{
+    if (this->rendertime == 0)
+    {
+        return 0.0;
+    }
+    return this->rendered * 1e9 / this->rendertime;
+}
+
+void SnapshotRenderer::fetch(struct snapshotjob& job)
+{
+    job.waiting = job.streams.size();
+    if (job.waiting == 0)
+    {
+        this->scheduleProcessing();
+        return;
+    }
+
+    uint64_t width = (uint64_t) qMax(job.size.width(), 1);
+    uint8_t pwe = getPWExponent(((uint64_t) (job.end - job.start)) / width);
+
+    QPointer<SnapshotRenderer> self(this);
+    int id = job.id;
+    for (int k = 0; k != job.streams.size(); k++)
+    {
+        const struct snapshotstream& ss = job.streams[k];
+
+        /* Take the stream's offset into account when deciding which part of the data to query. */
+        int64_t srch_start = safeSub(job.start, ss.d.timeOffset);
+        int64_t srch_end = safeSub(job.end, ss.d.timeOffset);
+
+        MrPlotter::cache.requestData(ss.source, ss.uuid, srch_start, srch_end, pwe,
+                                     [self, id, k](QList<QSharedPointer<CacheEntry>> data, bool hit)
+        {
+            Q_UNUSED(hit);
+
+            /* The Snapshot Renderer may have been deleted in between making
+             * the request and receiving the response.
+             */
+            if (!self.isNull())
+            {
+                self->receive(id, k, data);
+            }
+        });
+    }
+}
+
+void SnapshotRenderer::receive(int id, int index, const QList<QSharedPointer<CacheEntry>>& data)
+{
+    for (auto i = this->queue.begin(); i != this->queue.end(); i++)
+    {
+        if (i->id == id)
+        {
+            i->streams[index].d.data = data;
+            if (--i->waiting == 0)
+            {
+                this->scheduleProcessing();
+            }
+            return;
+        }
+    }
+}
+
+void SnapshotRenderer::scheduleProcessing()
+{
+    if (!this->scheduled)
+    {
+        this->scheduled = true;
+        QMetaObject::invokeMethod(this, "processQueue", Qt::QueuedConnection);
+    }
+}
+
+void SnapshotRenderer::processQueue()
+{
+    this->scheduled = false;
+
+    /* Draw the snapshots at the front of the queue whose data has all
+     * arrived, keeping them in order.
+     */
+    bool drew = false;
+    while (!this->queue.isEmpty() && this->queue.first().waiting == 0)
+    {
+        struct snapshotjob job = this->queue.takeFirst();
+        QImage image = this->render(job);
+        if (!image.isNull() && !job.path.isEmpty() && !image.save(job.path))
+        {
+            qWarning("Could not save snapshot to %s", qPrintable(job.path));
+        }
+        emit this->snapshotReady(job.id, image);
+        drew = true;
+    }
+
+    /* Request the data for the next few snapshots. */
+    int ahead = 0;
+    for (auto i = this->queue.begin(); i != this->queue.end() && ahead != SNAPSHOT_FETCH_AHEAD; i++)
+    {
+        if (i->waiting == -1)
+        {
+            this->fetch(*i);
+        }
+        ahead++;
+    }
+
+    if (drew)
+    {
+        emit this->queueChanged();
+    }
+}
+
+bool SnapshotRenderer::makeCurrent()
+{
+    if (this->context != nullptr)
+    {
+        return this->usable && this->context->makeCurrent(this->surface);
+    }
+
+    /* Share with the contexts of the Plot Areas, if they share at all. */
+    this->context = new QOpenGLContext;
+    PlotRenderer::snapshotcontexts.ref();
+    this->context->setFormat(QSurfaceFormat::defaultFormat());
+    this->context->setShareContext(QOpenGLContext::globalShareContext());
+    this->surface = new QOffscreenSurface;
+    if (!this->context->create())
+    {
+        qWarning("Could not create an OpenGL context for snapshots");
+        return false;
+    }
+    this->surface->setFormat(this->context->format());
+    this->surface->create();
+    if (!this->context->makeCurrent(this->surface))
+    {
+        qWarning("Could not make the snapshot context current");
+        return false;
+    }
+
+    this->initializeOpenGLFunctions();
+
+    /* Needed to draw points correctly. This constant isn't always included for some reason. */
+#ifdef GL_VERTEX_PROGRAM_POINT_SIZE
+    this->glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+#endif
+
+    this->usable = PlotRenderer::initShaders(this);
+    this->gl33 = this->usable && PlotRenderer::multiProgram != nullptr && PlotRenderer::hasGL33(this->context);
+    this->multiDrawArrays = PlotRenderer::getMultiDrawArrays(this->context);
+    this->densityformat = PlotRenderer::getDensityFormat(this->context);
+    return this->usable;
+}
+
+QImage SnapshotRenderer::render(struct snapshotjob& job)
+{
+    if (job.size.isEmpty() || job.end <= job.start)
+    {
+        return QImage();
+    }
+
+    /* The cache's VBOs are used without locking, so they can't be drawn
+     * from here while a render thread draws from them too.
+     */
+    if (PlotRenderer::threadedrenderers.load() != 0)
+    {
+        qWarning("Snapshots can't be drawn while Plot Areas draw on a render thread; set QSG_RENDER_LOOP=basic");
+        return QImage();
+    }
+
+    if (!this->makeCurrent())
+    {
+        return QImage();
+    }
+
+    QElapsedTimer rendertimer;
+    rendertimer.start();
+    memset(&this->counts, 0, sizeof(this->counts));
+
+    /* Delete unused VBOs, and compact fragmented ones. */
+    MrPlotter::cache.vbos.collect(this);
+    MrPlotter::cache.ddvbos.collect(this);
+    MrPlotter::cache.rawvbos.collect(this);
+
+    if (this->fbo == nullptr || this->fbo->size() != job.size || this->fbosamples != this->samples)
+    {
+        delete this->fbo;
+        QOpenGLFramebufferObjectFormat fof;
+        fof.setSamples(this->samples);
+        this->fbo = new QOpenGLFramebufferObject(job.size, fof);
+        this->fbosamples = this->samples;
+    }
+
+    /* Upload and decimate whatever hasn't been. Unlike a Plot Area, there
+     * is no earlier frame to fall back on, so there is no budget.
+     */
+    int width = job.size.width();
+    int decimation = PlotRenderer::decimationExponent(job.end - job.start, width);
+    for (auto i = job.streams.begin(); i != job.streams.end(); i++)
+    {
+        struct drawable& d = i->d;
+        for (auto j = d.data.begin(); j != d.data.end(); j++)
+        {
+            QSharedPointer<CacheEntry>& ce = *j;
+            Q_ASSERT(!ce->isPlaceholder());
+            if (!ce->isPrepared(d.dataDensity))
+            {
+                ce->prepare(this, d.dataDensity, this->counts);
+            }
+            else if (ce->needsUpdate())
+            {
+                ce->update(this, this->counts);
+            }
+        }
+        d.drawn = d.data;
+        QList<QSharedPointer<CacheEntry>> todecimate;
+        PlotRenderer::cull(d, job.start, job.end, width, decimation, todecimate);
+        if (!todecimate.isEmpty())
+        {
+            for (auto j = todecimate.begin(); j != todecimate.end(); j++)
+            {
+                (*j)->decimate(this, decimation, this->counts);
+            }
+            PlotRenderer::cull(d, job.start, job.end, width, decimation, todecimate);
+        }
+    }
+
+    this->fbo->bind();
+    this->glViewport(0, 0, width, job.size.height());
+
+    this->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    this->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    this->glEnable(GL_BLEND);
+    this->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    /* As in a Plot Area, the heatmap goes under everything else. */
+    QVector<const struct drawable*> heat;
+    for (auto i = job.streams.begin(); i != job.streams.end(); ++i)
+    {
+        if (PlotRenderer::inHeatmap(i->d))
+        {
+            heat.append(&i->d);
+        }
+    }
+    if (!heat.isEmpty())
+    {
+        /* Colours saturate at 1.0 with eight bits per channel. */
+        int saturation = job.heatsaturation;
+        if (this->densityformat == GL_RGBA)
+        {
+            saturation = qMin(saturation, 255);
+        }
+        PlotRenderer::renderHeatmap(this, this->multiDrawArrays, heat, this->fbo, &this->density, this->densityformat,
+                                    saturation, this->gl33, job.start, job.end, this->counts);
+    }
+
+    /* The unselected streams are drawn together where the context allows
+     * it, and the selected ones over them.
+     */
+    bool multi = this->gl33;
+    if (multi)
+    {
+        QVector<struct multigroup> groups;
+        for (auto i = job.streams.begin(); i != job.streams.end(); ++i)
+        {
+            const struct drawable& s = i->d;
+            if (!s.dataDensity && !s.selected && !s.heatmap)
+            {
+                CacheEntry::addMultiRanges(s.visible, s.ranges, s.ymin, s.ymax, job.start, s.timeOffset, COLOR_TO_ARRAY(s.color), s.alwaysConnect, groups);
+            }
+        }
+
+        if (!groups.isEmpty())
+        {
+            this->glUseProgram(PlotRenderer::multiprogram);
+            this->glLineWidth(1.0);
+            CacheEntry::renderPlotMulti(this, this->multiDrawArrays, groups, job.start, job.end, PlotRenderer::multiLocs, true, this->counts);
+        }
+    }
+
+    for (auto i = job.streams.begin(); i != job.streams.end(); ++i)
+    {
+        const struct drawable& s = i->d;
+        if (PlotRenderer::inHeatmap(s))
+        {
+            continue;
+        }
+        if (!multi || s.dataDensity || s.selected)
+        {
+            PlotRenderer::renderStream(this, this->multiDrawArrays, s, COLOR_TO_ARRAY(s.color), true,
+                                       job.start, job.end, this->counts);
+        }
+    }
+
+    /* Reading the image back waits for the GPU to finish. */
+    QImage image = this->fbo->toImage();
+    this->fbo->release();
+
+    this->rendertime += rendertimer.nsecsElapsed();
+    this->rendered++;
+    return image;
+}
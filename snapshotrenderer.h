@@ -0,0 +1,187 @@
+#ifndef SNAPSHOTRENDERER_H
+#define SNAPSHOTRENDERER_H
+
+#include "cache.h"
+#include "stream.h"
+
+#include <cstdint>
+
+#include <QImage>
+#include <QList>
+#include <QObject>
+#include <QOpenGLFunctions>
+#include <QSize>
+#include <QString>
+#include <QUuid>
+#include <QVariant>
+#include <QVector>
+
+/* The number of snapshots at the front of the queue whose data is fetched
+ * at once. The rest wait their turn, so that a long queue doesn't flood
+ * the data sources with requests.
+ */
+#define SNAPSHOT_FETCH_AHEAD 8
+
+class QOffscreenSurface;
+class QOpenGLContext;
+class QOpenGLFramebufferObject;
+
+/* A stream in a snapshot, and where to fetch its data from. */
+struct snapshotstream
+{
+    DataSource* source;
+    QUuid uuid;
+    struct drawable d;
+};
+
+/* A snapshot waiting in the queue. */
+struct snapshotjob
+{
+    int id;
+    QVector<struct snapshotstream> streams;
+    int64_t start;
+    int64_t end;
+    QSize size;
+    QString path; // where to save the image, if not empty
+
+    /* The number of streams covering a pixel at which the heatmap is at
+     * its hottest.
+     */
+    int heatsaturation;
+
+    /* The number of streams whose data hasn't arrived yet, or -1 if it
+     * hasn't been requested.
+     */
+    int waiting;
+};
+
+/* Draws streams into images, without a window, for thumbnails and
+ * snapshots made on a server.
+ *
+ * Snapshots are drawn in the order they are queued, in an OpenGL context
+ * of their own with an offscreen surface, so no display is needed if the
+ * platform plugin can create one without it (e.g. eglfs on Mesa's
+ * surfaceless platform, which falls back to llvmpipe). Data is fetched
+ * through the same cache as the Plot Areas, and drawn from the same VBOs
+ * with the same shader programs, so a long queue of snapshots of the same
+ * streams only fetches and uploads each cache entry once.
+ *
+ * The shader programs and VBOs belong to the context they were made in.
+ * If snapshots are drawn alongside Plot Areas, Qt::AA_ShareOpenGLContexts
+ * must be set before the application is created, so that the contexts
+ * share them. Snapshots are drawn on the GUI thread, whereas Plot Areas
+ * draw from the VBOs on the render thread while the GUI thread runs, so
+ * the basic render loop (QSG_RENDER_LOOP=basic) must be used as well.
+ * Otherwise, whichever of them starts drawing second draws nothing, and
+ * says why.
+ */
+class SnapshotRenderer : public QObject, protected QOpenGLFunctions
+{
+    Q_OBJECT
+    Q_PROPERTY(int msaaSamples READ getMsaaSamples WRITE setMsaaSamples)
+    Q_PROPERTY(int pending READ getPending NOTIFY queueChanged)
+    Q_PROPERTY(int rendered READ getRendered NOTIFY queueChanged)
+    Q_PROPERTY(qreal rendersPerSecond READ getRendersPerSecond NOTIFY queueChanged)
+
+public:
+    SnapshotRenderer(QObject* parent = nullptr);
+    ~SnapshotRenderer();
+
+    /* Queues a snapshot of STREAMS over the time domain from START to END,
+     * SIZE pixels large. The streams are drawn as they are set up now,
+     * with the domains of their axes; those without an axis are left out.
+     * Streams in a heatmap are drawn into one, under the rest, with the
+     * saturation of the Plot Area of the first of them. If PATH is not
+     * empty, the image is also saved there. Returns the ID that
+     * snapshotReady is emitted with.
+     */
+    int enqueue(const QList<Stream*>& streams, int64_t start, int64_t end,
+                const QSize& size, const QString& path = QString());
+
+    /* The same, for QML. DOMAIN is in the form used by the time domain of
+     * Mr. Plotter.
+     */
+    Q_INVOKABLE int enqueue(QList<QVariant> streams, QList<qreal> domain,
+                            int width, int height, QString path = QString());
+
+    /* Drops the snapshots that haven't been drawn yet. */
+    Q_INVOKABLE void clear();
+
+    /* The number of samples per pixel for multisample antialiasing. Must
+     * be 0 (no multisampling), 2, 4 or 8.
+     */
+    int getMsaaSamples() const;
+    void setMsaaSamples(int samples);
+
+    /* The number of snapshots in the queue. */
+    int getPending() const;
+
+    /* The number of snapshots drawn so far, and how many were drawn per
+     * second of time spent drawing them, including reading the images
+     * back. Time spent waiting for data isn't counted.
+     */
+    int getRendered() const;
+    qreal getRendersPerSecond() const;
+
+signals:
+    /* IMAGE is null if the snapshot couldn't be drawn. */
+    void snapshotReady(int id, QImage image);
+    void queueChanged();
+
+private slots:
+    void processQueue();
+
+private:
+    /* Requests the data for every stream in JOB. */
+    void fetch(struct snapshotjob& job);
+
+    /* Stores the DATA for the stream at INDEX in the snapshot with the
+     * given ID, if it is still queued.
+     */
+    void receive(int id, int index, const QList<QSharedPointer<CacheEntry>>& data);
+
+    /* Makes sure that the queue is processed once control returns to the
+     * event loop. Callbacks from the cache may happen within a request, so
+     * the queue is never processed directly from them.
+     */
+    void scheduleProcessing();
+
+    /* Makes the context current, creating it the first time. Returns
+     * false if snapshots can't be drawn.
+     */
+    bool makeCurrent();
+
+    QImage render(struct snapshotjob& job);
+
+    QList<struct snapshotjob> queue;
+    int nextid;
+    bool scheduled;
+
+    int samples;
+
+    QOpenGLContext* context;
+    QOffscreenSurface* surface;
+    bool usable;
+
+    /* Whether the context can run the programs that need OpenGL 3.3. */
+    bool gl33;
+
+    /* Kept from one snapshot to the next while the size doesn't change. */
+    QOpenGLFramebufferObject* fbo;
+    int fbosamples;
+
+    /* Where the heatmap is accumulated, made the first time one is drawn,
+     * and the format it is made in.
+     */
+    QOpenGLFramebufferObject* density;
+    GLenum densityformat;
+
+    /* glMultiDrawArrays, or null if the context doesn't have it. */
+    MultiDrawArraysFunc multiDrawArrays;
+
+    struct drawstats counts;
+    int rendered;
+    qint64 rendertime; // nanoseconds
+};
+
+#endif // SNAPSHOTRENDERER_H
@@ -1,6 +1,7 @@
 #include "axis.h"
 #include "axisarea.h"
 #include "datasource.h"
+#include "mrplotter.h"
 #include "plotarea.h"
 #include "stream.h"
 #include "utils.h"
@@ -30,6 +31,11 @@ Stream::Stream(const QUuid& u, DataSource* dataSource, QObject* parent):
     this->sourceset = true;
 }
 
+Stream::~Stream()
+{
+    this->setLiveTail(false);
+}
+
 void Stream::init()
 {
     this->timeOffset = 0;
@@ -42,9 +48,13 @@ void Stream::init()
     this->dataDensity = false;
     this->selected = false;
     this->alwaysConnect = false;
+    this->heatmap = false;
+    this->liveTail = false;
 
     this->axis = nullptr;
     this->plotarea = nullptr;
+
+    this->version = nextVersion();
 }
 
 bool Stream::toDrawable(struct drawable& d) const
@@ -55,15 +65,44 @@ bool Stream::toDrawable(struct drawable& d) const
     }
 
     d.data = this->data;
+    d.version = this->version;
+    d.axis = this->axis;
+    d.axisversion = this->axis->getVersion();
     d.timeOffset = this->timeOffset;
     this->axis->getDomain(&d.ymin, &d.ymax);
     d.color = this->color;
     d.dataDensity = this->dataDensity;
     d.selected = this->selected;
     d.alwaysConnect = this->alwaysConnect;
+    d.heatmap = this->heatmap;
     return true;
 }
 
+uint64_t Stream::getVersion() const
+{
+    return this->version;
+}
+
+void Stream::setData(const QList<QSharedPointer<CacheEntry>>& newdata)
+{
+    this->data = newdata;
+    this->version = nextVersion();
+}
+
+bool Stream::getDataDensity() const
+{
+    return this->dataDensity;
+}
+
+void Stream::setDataDensity(bool enable)
+{
+    if (enable != this->dataDensity)
+    {
+        this->dataDensity = enable;
+        this->version = nextVersion();
+    }
+}
+
 bool Stream::getSelected() const {
     return this->selected;
 }
@@ -71,6 +110,9 @@ bool Stream::getSelected() const {
 void Stream::setSelected(bool isSelected) {
     bool changed = (this->selected != isSelected);
     this->selected = isSelected;
+    if (changed) {
+        this->version = nextVersion();
+    }
     if (changed && this->plotarea != nullptr) {
         this->plotarea->update();
         emit this->selectedChanged();
@@ -84,12 +126,31 @@ bool Stream::getAlwaysConnect() const {
 void Stream::setAlwaysConnect(bool shouldAlwaysConnect) {
     bool changed = (this->alwaysConnect != shouldAlwaysConnect);
     this->alwaysConnect = shouldAlwaysConnect;
+    if (changed) {
+        this->version = nextVersion();
+    }
     if (changed && this->plotarea != nullptr) {
         this->plotarea->update();
         emit this->alwaysConnectChanged();
     }
 }
 
+bool Stream::getHeatmap() const {
+    return this->heatmap;
+}
+
+void Stream::setHeatmap(bool inHeatmap) {
+    bool changed = (this->heatmap != inHeatmap);
+    this->heatmap = inHeatmap;
+    if (changed) {
+        this->version = nextVersion();
+    }
+    if (changed && this->plotarea != nullptr) {
+        this->plotarea->update();
+        emit this->heatmapChanged();
+    }
+}
+
 bool Stream::setColor(float red, float green, float blue)
 {
     if (red < 0.0f || red > 1.0f || green < 0.0f || green > 1.0f ||
@@ -100,6 +161,7 @@ bool Stream::setColor(float red, float green, float blue)
     this->color.red = red;
     this->color.green = green;
     this->color.blue = blue;
+    this->version = nextVersion();
 
     if (this->axis != nullptr)
     {
@@ -131,6 +193,7 @@ QColor Stream::getColor()
 void Stream::setTimeOffset(int64_t offset)
 {
     this->timeOffset = offset;
+    this->version = nextVersion();
     emit this->timeOffsetChanged();
 }
 
@@ -153,8 +216,21 @@ QList<qreal> Stream::getTimeOffset()
 
 void Stream::setDataSource(DataSource* source)
 {
+    /* Tail the new stream before letting go of the old one, so that the
+     * data source isn't asked to stop and start again if it is the same.
+     */
+    DataSource* oldsource = this->source;
     this->sourceset = true;
     this->source = source;
+    if (this->liveTail)
+    {
+        this->tailInCache(true);
+        if (oldsource != nullptr && !this->uuid.isNull())
+        {
+            MrPlotter::cache.setLiveTail(oldsource, this->uuid, false);
+        }
+    }
+
     emit this->dataSourceChanged();
 }
 
@@ -165,7 +241,17 @@ DataSource* Stream::getDataSource()
 
 void Stream::setUUID(QString uuidstr)
 {
+    QUuid olduuid = this->uuid;
     this->uuid = QUuid(uuidstr);
+    if (this->liveTail)
+    {
+        this->tailInCache(true);
+        if (this->source != nullptr && !olduuid.isNull())
+        {
+            MrPlotter::cache.setLiveTail(this->source, olduuid, false);
+        }
+    }
+
     emit this->dataSourceChanged();
 }
 
@@ -174,3 +260,28 @@ QString Stream::getUUID()
     QString uuidstr = this->uuid.toString();
     return uuidstr.mid(1, uuidstr.size() - 2);
 }
+
+bool Stream::getLiveTail() const
+{
+    return this->liveTail;
+}
+
+void Stream::setLiveTail(bool enable)
+{
+    if (enable == this->liveTail)
+    {
+        return;
+    }
+
+    this->liveTail = enable;
+    this->tailInCache(enable);
+    emit this->liveTailChanged();
+}
+
+void Stream::tailInCache(bool enable)
+{
+    if (this->source != nullptr && !this->uuid.isNull())
+    {
+        MrPlotter::cache.setLiveTail(this->source, this->uuid, enable);
+    }
+}
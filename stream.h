@@ -11,6 +11,7 @@
 #include <QSharedPointer>
 #include <QString>
 #include <QUuid>
+#include <QVector>
 
 struct color
 {
@@ -21,9 +22,61 @@ struct color
 
 #define COLOR_TO_ARRAY(color) (&(color).red)
 
+/* Both Stream and Axis need declarations of each other. */
+class YAxis;
+
+class Stream;
+
+/* A snapshot of what the renderer needs to draw a stream. */
 struct drawable
 {
+    /* The cache entries of the stream. QList is implicitly shared, so this
+     * shares the stream's list until the stream replaces it.
+     */
     QList<QSharedPointer<CacheEntry>> data;
+
+    /* The version of the stream, and the axis and its version, as of the
+     * snapshot. Versions are unique across all objects (see nextVersion),
+     * so a stream or axis that replaced another at the same address never
+     * matches the snapshot.
+     */
+    uint64_t version;
+    const YAxis* axis;
+    uint64_t axisversion;
+
+    /* The rest is filled in by the renderer. */
+
+    /* The stream that this is a snapshot of. Only compared, never
+     * dereferenced.
+     */
+    const Stream* stream;
+
+    /* The entries drawn, all of which are prepared. This is DATA, unless
+     * some of those entries are still waiting to be uploaded.
+     */
+    QList<QSharedPointer<CacheEntry>> drawn;
+
+    /* The entries of DRAWN that are visible, and the range of points drawn
+     * for each of them. Whether each range is dense is decided before any
+     * of the visible entries are replaced by their decimations.
+     */
+    QList<QSharedPointer<CacheEntry>> visible;
+    QVector<struct pointrange> ranges;
+
+    /* True if some entries of DATA are still waiting to be uploaded. */
+    bool pending;
+
+    /* True if some entries of VISIBLE are waiting to be decimated. */
+    bool decimating;
+
+    /* True if DRAWN, or anything about how it is drawn, changed since it
+     * was last culled.
+     */
+    bool dirty;
+
+    /* A hash of everything drawn other than the time domain. */
+    uint signature;
+
     int64_t timeOffset;
     float ymin;
     float ymax;
@@ -31,38 +84,52 @@ struct drawable
     bool dataDensity;
     bool selected;
     bool alwaysConnect;
+    bool heatmap;
 };
 
-/* Both Stream and Axis need declarations of each other. */
-class YAxis;
-
 class PlotArea;
 
 class Stream : public QObject
 {
     Q_OBJECT
-    Q_PROPERTY(bool dataDensity MEMBER dataDensity)
+    Q_PROPERTY(bool dataDensity READ getDataDensity WRITE setDataDensity)
     Q_PROPERTY(bool selected READ getSelected WRITE setSelected NOTIFY selectedChanged)
     Q_PROPERTY(bool alwaysConnect READ getAlwaysConnect WRITE setAlwaysConnect NOTIFY alwaysConnectChanged)
+    Q_PROPERTY(bool heatmap READ getHeatmap WRITE setHeatmap NOTIFY heatmapChanged)
 
     Q_PROPERTY(QColor color READ getColor WRITE setColor NOTIFY colorChanged)
     Q_PROPERTY(QList<qreal> timeOffset READ getTimeOffset WRITE setTimeOffset NOTIFY timeOffsetChanged)
     Q_PROPERTY(DataSource* dataSource READ getDataSource WRITE setDataSource NOTIFY dataSourceChanged)
     Q_PROPERTY(QString uuid READ getUUID WRITE setUUID NOTIFY uuidChanged)
+    Q_PROPERTY(bool liveTail READ getLiveTail WRITE setLiveTail NOTIFY liveTailChanged)
 
 public:
     Stream(QObject* parent = nullptr);
     Stream(const QString& u, DataSource* dataSource, QObject* parent = nullptr);
     Stream(const QUuid& u, DataSource* dataSource, QObject* parent = nullptr);
+    ~Stream();
 
     bool toDrawable(struct drawable& d) const;
 
+    /* Returns a number that changes whenever anything about how this
+     * stream is drawn changes, other than its axis.
+     */
+    uint64_t getVersion() const;
+
+    void setData(const QList<QSharedPointer<CacheEntry>>& newdata);
+
+    bool getDataDensity() const;
+    void setDataDensity(bool enable);
+
     bool getSelected() const;
     void setSelected(bool isSelected);
 
     bool getAlwaysConnect() const;
     void setAlwaysConnect(bool shouldAlwaysConnect);
 
+    bool getHeatmap() const;
+    void setHeatmap(bool inHeatmap);
+
     Q_INVOKABLE bool setColor(float red, float green, float blue);
     Q_INVOKABLE bool setColor(QColor color);
     Q_INVOKABLE QColor getColor();
@@ -77,6 +144,9 @@ public:
     Q_INVOKABLE void setUUID(QString uuidstr);
     Q_INVOKABLE QString getUUID();
 
+    bool getLiveTail() const;
+    void setLiveTail(bool enable);
+
     QUuid uuid;
 
     /* The currently visible cache entries. */
@@ -105,6 +175,17 @@ public:
     /* True if the points of this stream should always be joined. */
     bool alwaysConnect;
 
+    /* True if this stream is one of the group drawn together as a density
+     * heatmap, rather than as a line of its own. Selected streams are
+     * always drawn as lines, over the heatmap.
+     */
+    bool heatmap;
+
+    /* True if new data for this stream should be appended to the cache as
+     * the data source pushes it, rather than polled for.
+     */
+    bool liveTail;
+
 signals:
     void selectedChanged();
     void colorChanged();
@@ -112,15 +193,24 @@ signals:
     void dataSourceChanged();
     void uuidChanged();
     void alwaysConnectChanged();
+    void heatmapChanged();
+    void liveTailChanged();
 
 private:
     void init();
 
+    /* Starts or stops tailing this stream's data in the cache, without
+     * changing the liveTail property.
+     */
+    void tailInCache(bool enable);
+
     /* The source to query to get data for this stream. */
     DataSource* source;
 
     /* True if the source has been set. */
     bool sourceset;
+
+    uint64_t version;
 };
 
 #endif // STREAM_H
@@ -0,0 +1,13 @@
+# Tests BTrDBDataSource against a mock BTrDB server that runs in the same
+# process, for both versions of the API.
+
+TEMPLATE = app
+TARGET = tst_btrdbdatasource
+
+QT += testlib
+CONFIG += testcase console mrplotter_btrdb
+CONFIG -= app_bundle
+
+include(../../mrplotter.pri)
+
+SOURCES += tst_btrdbdatasource.cpp
@@ -0,0 +1,444 @@
+#include "btrdbapi.h"
+#include "btrdbdatasource.h"
+#include "requester.h"
+
+#include <grpc++/grpc++.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QUuid>
+#include <QtTest>
+
+/* Streams that the mock server treats specially. */
+#define MOCK_EMPTY_UUID "{00000000-0000-0000-0000-000000000001}"
+#define MOCK_ERROR_UUID "{00000000-0000-0000-0000-000000000002}"
+#define MOCK_SLOW_UUID "{00000000-0000-0000-0000-000000000003}"
+#define MOCK_DATA_UUID "{00000000-0000-0000-0000-000000000004}"
+#define MOCK_UNCHANGED_UUID "{00000000-0000-0000-0000-000000000005}"
+
+/* The generations the two versions of the mock server report, so that
+ * tests can tell which one answered.
+ */
+#define MOCK_V4_GENERATION 40
+#define MOCK_V5_GENERATION 50
+
+/* The span of the data in every stream that has any. */
+#define MOCK_FIRST_TIME 100
+#define MOCK_LAST_TIME 900
+
+/* Windows per response, so that results arrive in several chunks. */
+#define MOCK_CHUNK_SIZE 3
+
+/* How long calls for the slow stream take, in milliseconds. */
+#define MOCK_SLOW_DELAY 10000
+
+std::string uuidBytes(const char* uuid)
+{
+    QByteArray bytes = QUuid(uuid).toRfc4122();
+    return std::string(bytes.constData(), bytes.size());
+}
+
+/* A BTrDB server with made-up data, for one version of the API. */
+template <typename API>
+class MockBTrDB : public API::BTrDB::Service
+{
+public:
+    MockBTrDB(uint64_t generation) : generation(generation), lastStart(0), lastEnd(0) {}
+
+    grpc::Status AlignedWindows(grpc::ServerContext* context, const typename API::AlignedWindowsParams* params,
+                                grpc::ServerWriter<typename API::AlignedWindowsResponse>* writer) override
+    {
+        {
+            QMutexLocker locker(&this->lock);
+            this->lastStart = params->start();
+            this->lastEnd = params->end();
+        }
+
+        if (!this->respond(context, params->uuid(), writer))
+        {
+            return grpc::Status::OK;
+        }
+
+        /* One window per pointwidth, with the window's index as its mean. */
+        int64_t pw = INT64_C(1) << params->pointwidth();
+        typename API::AlignedWindowsResponse response;
+        response.set_versionmajor(this->generation);
+        for (int64_t t = params->start(); t < params->end(); t += pw)
+        {
+            typename API::StatPoint* value = response.add_values();
+            value->set_time(t);
+            value->set_min(-1.0);
+            value->set_mean((double) ((t - params->start()) / pw));
+            value->set_max(1.0);
+            value->set_count(pw);
+            if (response.values_size() == MOCK_CHUNK_SIZE)
+            {
+                writer->Write(response);
+                response.clear_values();
+            }
+        }
+        if (response.values_size() != 0)
+        {
+            writer->Write(response);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Nearest(grpc::ServerContext* context, const typename API::NearestParams* params,
+                         typename API::NearestResponse* response) override
+    {
+        Q_UNUSED(context);
+        response->set_versionmajor(this->generation);
+        if (params->uuid() == uuidBytes(MOCK_EMPTY_UUID))
+        {
+            response->mutable_stat()->set_code(401);
+            response->mutable_stat()->set_msg("no such point");
+            return grpc::Status::OK;
+        }
+        response->mutable_value()->set_time(params->backward() ? MOCK_LAST_TIME : MOCK_FIRST_TIME);
+        response->mutable_value()->set_value(0.0);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Changes(grpc::ServerContext* context, const typename API::ChangesParams* params,
+                         grpc::ServerWriter<typename API::ChangesResponse>* writer) override
+    {
+        if (params->uuid() == uuidBytes(MOCK_UNCHANGED_UUID))
+        {
+            /* Just the generation, with no changed ranges. */
+            typename API::ChangesResponse response;
+            response.set_versionmajor(this->generation);
+            writer->Write(response);
+            return grpc::Status::OK;
+        }
+        if (!this->respond(context, params->uuid(), writer))
+        {
+            return grpc::Status::OK;
+        }
+
+        /* Two changed ranges, in separate responses. */
+        typename API::ChangesResponse response;
+        response.set_versionmajor(this->generation);
+        typename API::ChangedRange* range = response.add_ranges();
+        range->set_start(MOCK_FIRST_TIME);
+        range->set_end(MOCK_FIRST_TIME + 100);
+        writer->Write(response);
+
+        response.clear_ranges();
+        range = response.add_ranges();
+        range->set_start(MOCK_LAST_TIME - 100);
+        range->set_end(MOCK_LAST_TIME);
+        writer->Write(response);
+        return grpc::Status::OK;
+    }
+
+    void getLastRange(int64_t* start, int64_t* end)
+    {
+        QMutexLocker locker(&this->lock);
+        *start = this->lastStart;
+        *end = this->lastEnd;
+    }
+
+private:
+    /* Handles the special streams. Returns true if the call should go on
+     * to send data.
+     */
+    template <typename Response>
+    bool respond(grpc::ServerContext* context, const std::string& uuid, grpc::ServerWriter<Response>* writer)
+    {
+        if (uuid == uuidBytes(MOCK_SLOW_UUID))
+        {
+            /* Stall until the client gives up. */
+            QElapsedTimer timer;
+            timer.start();
+            while (!context->IsCancelled() && timer.elapsed() < MOCK_SLOW_DELAY)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return false;
+        }
+        if (uuid == uuidBytes(MOCK_ERROR_UUID))
+        {
+            Response response;
+            response.mutable_stat()->set_code(500);
+            response.mutable_stat()->set_msg("mock failure");
+            writer->Write(response);
+            return false;
+        }
+        if (uuid == uuidBytes(MOCK_EMPTY_UUID))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t generation;
+
+    QMutex lock;
+    int64_t lastStart;
+    int64_t lastEnd;
+};
+
+struct windows
+{
+    bool done;
+    std::vector<struct statpt> points;
+    uint64_t generation;
+};
+
+struct changes
+{
+    bool done;
+    std::vector<struct timerange> ranges;
+    uint64_t generation;
+};
+
+class TestBTrDBDataSource : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void alignedWindows();
+    void alignedWindowsV5();
+    void alignedWindowsEmpty();
+    void alignedWindowsError();
+    void brackets();
+    void changedRanges();
+    void changedRangesEmpty();
+    void changedRangesUnchanged();
+    void changedRangesError();
+    void timeout();
+    void invalidSettings();
+
+private:
+    void fetchWindows(const char* uuid, int64_t start, int64_t end, uint8_t pwe, struct windows& result);
+    void fetchChanges(const char* uuid, struct changes& result);
+
+    MockBTrDB<btrdbv4>* v4service;
+    MockBTrDB<btrdbv5>* v5service;
+    std::unique_ptr<grpc::Server> server;
+    QString endpoint;
+
+    BTrDBDataSource* source;
+};
+
+void TestBTrDBDataSource::initTestCase()
+{
+    this->v4service = new MockBTrDB<btrdbv4>(MOCK_V4_GENERATION);
+    this->v5service = new MockBTrDB<btrdbv5>(MOCK_V5_GENERATION);
+
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+    builder.RegisterService(this->v4service);
+    builder.RegisterService(this->v5service);
+    this->server = builder.BuildAndStart();
+    QVERIFY(this->server != nullptr);
+    QVERIFY(port != 0);
+
+    this->endpoint = QString("127.0.0.1:%1").arg(port);
+}
+
+void TestBTrDBDataSource::cleanupTestCase()
+{
+    this->server->Shutdown();
+    this->server.reset();
+    delete this->v4service;
+    delete this->v5service;
+}
+
+void TestBTrDBDataSource::init()
+{
+    this->source = new BTrDBDataSource;
+    this->source->setEndpoint(this->endpoint);
+    this->source->setTimeout(5000);
+}
+
+void TestBTrDBDataSource::cleanup()
+{
+    delete this->source;
+}
+
+void TestBTrDBDataSource::fetchWindows(const char* uuid, int64_t start, int64_t end, uint8_t pwe, struct windows& result)
+{
+    result.done = false;
+    result.generation = 0;
+
+    struct windows* r = &result;
+    this->source->alignedWindows(QUuid(uuid), start, end, pwe, [r](struct statpt* points, int len, uint64_t gen)
+    {
+        r->points.assign(points, points + len);
+        r->generation = gen;
+        r->done = true;
+    });
+    QTRY_VERIFY_WITH_TIMEOUT(result.done, 10000);
+}
+
+void TestBTrDBDataSource::fetchChanges(const char* uuid, struct changes& result)
+{
+    result.done = false;
+    result.generation = 0;
+
+    struct changes* r = &result;
+    this->source->changedRanges(QUuid(uuid), 1, 0, 4, [r](struct timerange* ranges, int len, uint64_t gen)
+    {
+        r->ranges.assign(ranges, ranges + len);
+        r->generation = gen;
+        r->done = true;
+    });
+    QTRY_VERIFY_WITH_TIMEOUT(result.done, 10000);
+}
+
+void TestBTrDBDataSource::alignedWindows()
+{
+    /* The end is inclusive after rounding down, so ten windows of 16 ns. */
+    struct windows result;
+    this->fetchWindows(MOCK_DATA_UUID, 0, 10 * 16 - 1, 4, result);
+
+    int64_t start;
+    int64_t end;
+    this->v4service->getLastRange(&start, &end);
+    QCOMPARE(start, (int64_t) 0);
+    QCOMPARE(end, (int64_t) 160);
+
+    QCOMPARE(result.generation, (uint64_t) MOCK_V4_GENERATION);
+    QCOMPARE((int) result.points.size(), 10);
+    for (int i = 0; i != 10; i++)
+    {
+        QCOMPARE(result.points[i].time, (int64_t) (i * 16));
+        QCOMPARE(result.points[i].mean, (double) i);
+        QCOMPARE(result.points[i].count, (uint64_t) 16);
+    }
+}
+
+void TestBTrDBDataSource::alignedWindowsV5()
+{
+    this->source->setApiVersion(5);
+
+    struct windows result;
+    this->fetchWindows(MOCK_DATA_UUID, 0, 4 * 16 - 1, 4, result);
+    QCOMPARE(result.generation, (uint64_t) MOCK_V5_GENERATION);
+    QCOMPARE((int) result.points.size(), 4);
+}
+
+void TestBTrDBDataSource::alignedWindowsEmpty()
+{
+    struct windows result;
+    this->fetchWindows(MOCK_EMPTY_UUID, 0, 160, 4, result);
+    QVERIFY(result.points.empty());
+    QCOMPARE(result.generation, GENERATION_MAX);
+}
+
+void TestBTrDBDataSource::alignedWindowsError()
+{
+    struct windows result;
+    this->fetchWindows(MOCK_ERROR_UUID, 0, 160, 4, result);
+    QVERIFY(result.points.empty());
+    QCOMPARE(result.generation, GENERATION_MAX);
+}
+
+void TestBTrDBDataSource::brackets()
+{
+    bool done = false;
+    QHash<QUuid, struct brackets> result;
+    QList<QUuid> uuids;
+    uuids.append(QUuid(MOCK_DATA_UUID));
+    uuids.append(QUuid(MOCK_EMPTY_UUID));
+    this->source->brackets(uuids, [&done, &result](QHash<QUuid, struct brackets> brkts)
+    {
+        result = brkts;
+        done = true;
+    });
+    QTRY_VERIFY_WITH_TIMEOUT(done, 10000);
+
+    /* Streams without data are left out. */
+    QCOMPARE(result.size(), 1);
+    QVERIFY(result.contains(QUuid(MOCK_DATA_UUID)));
+    QCOMPARE(result[QUuid(MOCK_DATA_UUID)].lowerbound, (int64_t) MOCK_FIRST_TIME);
+    QCOMPARE(result[QUuid(MOCK_DATA_UUID)].upperbound, (int64_t) MOCK_LAST_TIME);
+}
+
+void TestBTrDBDataSource::changedRanges()
+{
+    struct changes result;
+    this->fetchChanges(MOCK_DATA_UUID, result);
+
+    /* The server's ends are exclusive, and ours inclusive. */
+    QCOMPARE(result.generation, (uint64_t) MOCK_V4_GENERATION);
+    QCOMPARE((int) result.ranges.size(), 2);
+    QCOMPARE(result.ranges[0].start, (int64_t) MOCK_FIRST_TIME);
+    QCOMPARE(result.ranges[0].end, (int64_t) (MOCK_FIRST_TIME + 99));
+    QCOMPARE(result.ranges[1].start, (int64_t) (MOCK_LAST_TIME - 100));
+    QCOMPARE(result.ranges[1].end, (int64_t) (MOCK_LAST_TIME - 1));
+}
+
+void TestBTrDBDataSource::changedRangesEmpty()
+{
+    /* With no response at all, the stream is still as of the generation
+     * it was asked from.
+     */
+    struct changes result;
+    this->fetchChanges(MOCK_EMPTY_UUID, result);
+    QVERIFY(result.ranges.empty());
+    QCOMPARE(result.generation, (uint64_t) 1);
+}
+
+void TestBTrDBDataSource::changedRangesUnchanged()
+{
+    /* Streams without changes still get the server's generation. */
+    struct changes result;
+    this->fetchChanges(MOCK_UNCHANGED_UUID, result);
+    QVERIFY(result.ranges.empty());
+    QCOMPARE(result.generation, (uint64_t) MOCK_V4_GENERATION);
+}
+
+void TestBTrDBDataSource::changedRangesError()
+{
+    struct changes result;
+    this->fetchChanges(MOCK_ERROR_UUID, result);
+    QVERIFY(result.ranges.empty());
+    QCOMPARE(result.generation, GENERATION_MAX);
+}
+
+void TestBTrDBDataSource::timeout()
+{
+    this->source->setTimeout(200);
+
+    /* The call is abandoned at the deadline, rather than when the server
+     * gets around to answering.
+     */
+    QElapsedTimer timer;
+    timer.start();
+    struct windows result;
+    this->fetchWindows(MOCK_SLOW_UUID, 0, 160, 4, result);
+    QVERIFY(timer.elapsed() < MOCK_SLOW_DELAY / 2);
+    QVERIFY(result.points.empty());
+    QCOMPARE(result.generation, GENERATION_MAX);
+}
+
+void TestBTrDBDataSource::invalidSettings()
+{
+    QTest::ignoreMessage(QtWarningMsg, "Invalid BTrDB API version 3: must be 4 or 5");
+    this->source->setApiVersion(3);
+    QCOMPARE(this->source->getApiVersion(), BTRDB_DEFAULT_API_VERSION);
+
+    QTest::ignoreMessage(QtWarningMsg, "Invalid BTrDB timeout 0: must be positive");
+    this->source->setTimeout(0);
+    QCOMPARE(this->source->getTimeout(), 5000);
+}
+
+QTEST_GUILESS_MAIN(TestBTrDBDataSource)
+#include "tst_btrdbdatasource.moc"
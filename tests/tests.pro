@@ -0,0 +1,4 @@
+# Build with "qmake tests && make check".
+
+TEMPLATE = subdirs
+SUBDIRS += btrdbdatasource
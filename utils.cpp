@@ -1,8 +1,11 @@
+#include "cache.h"
 #include "utils.h"
 #include <cstdint>
 
+#include <QAtomicInteger>
 #include <QDebug>
 #include <QList>
+#include <QtAlgorithms>
 #include <QtGlobal>
 
 void splitTime(int64_t time, int64_t* millis, int64_t* nanos)
@@ -51,6 +54,41 @@ bool itvlOverlap(int64_t start1, int64_t end1, int64_t start2, int64_t end2)
     return (start1 >= start2 && start1 <= end2) || (start2 >= start1 && start2 <= end1);
 }
 
+int64_t safeSub(int64_t x, int64_t y)
+{
+    if (y > 0)
+    {
+        if ((uint64_t) y > (uint64_t) (x - INT64_MIN))
+        {
+            return INT64_MIN;
+        }
+    }
+    else
+    {
+        if ((uint64_t) (-y) > (uint64_t) (INT64_MAX - x))
+        {
+            return INT64_MAX;
+        }
+    }
+    return x - y;
+}
+
+uint8_t getPWExponent(uint64_t pointwidth)
+{
+    if (pointwidth == 0)
+    {
+        return 0;
+    }
+    uint8_t pwe = (uint8_t) (63 - qCountLeadingZeroBits(pointwidth));
+    return qMin(pwe, (uint8_t) (PWE_MAX - 1));
+}
+
+uint64_t nextVersion()
+{
+    static QAtomicInteger<quint64> counter(0);
+    return counter.fetchAndAddRelaxed(1) + 1;
+}
+
 LatencyBuffer::LatencyBuffer(const char* buffer_name, int buffer_size)
     : capacity(buffer_size), index(0), wrap_count(0), name(buffer_name)
 {
@@ -13,6 +13,19 @@ void fromJSList(QList<qreal> jslist, int64_t* low, int64_t* high);
 
 bool itvlOverlap(int64_t start1, int64_t end1, int64_t start2, int64_t end2);
 
+/* Returns X - Y, clamped to the range of int64_t. */
+int64_t safeSub(int64_t x, int64_t y);
+
+/* Computes the number x such that 2 ^ x <= POINTWIDTH < 2 ^ (x + 1). */
+uint8_t getPWExponent(uint64_t pointwidth);
+
+/* Returns a version number that has never been returned before, by any
+ * object. Objects that are versioned take a new one each time they change,
+ * so a snapshot can't mistake a new object at the same address for the old
+ * one, even if both changed the same number of times.
+ */
+uint64_t nextVersion();
+
 /*
  * Structures for measuring latency.
  */
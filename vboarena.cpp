@@ -0,0 +1,419 @@
+#include "vboarena.h"
+
+#include <cstring>
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QPair>
+#include <QVector>
+
+VBORange::VBORange(VBOArena* a, GLuint buffer, int off, int len) :
+    arena(a), vbo(buffer), offset(off), length(len), fenced(a->inserted)
+{
+}
+
+VBORange::~VBORange()
+{
+    this->arena->release(this);
+}
+
+GLuint VBORange::getBuffer() const
+{
+    return this->vbo;
+}
+
+int VBORange::getOffset() const
+{
+    return this->offset;
+}
+
+int VBORange::getLength() const
+{
+    return this->length;
+}
+
+VBOArena* VBORange::getArena() const
+{
+    return this->arena;
+}
+
+VBOArena::VBOArena(int pointsize) : ptsize(pointsize), fencing(false),
+    inserted(0), completed(0)
+{
+}
+
+QSharedPointer<VBORange> VBOArena::allocate(QOpenGLFunctions* funcs, int len)
+{
+    Q_ASSERT(len > 0);
+
+    GLuint vbo = 0;
+    int offset = 0;
+
+    /* Use the first free range that is big enough. */
+    for (auto i = this->buffers.begin(); i != this->buffers.end() && vbo == 0; i++)
+    {
+        struct arenabuffer& buf = *i;
+        if (buf.capacity - buf.used < len)
+        {
+            continue;
+        }
+
+        for (auto j = buf.freelist.begin(); j != buf.freelist.end(); j++)
+        {
+            if (*j >= len)
+            {
+                vbo = i.key();
+                offset = j.key();
+
+                int remaining = *j - len;
+                buf.freelist.erase(j);
+                if (remaining != 0)
+                {
+                    buf.freelist.insert(offset + len, remaining);
+                }
+                break;
+            }
+        }
+    }
+
+    if (vbo == 0)
+    {
+        /* No room, so make a new buffer. */
+        int capacity = qMax(len, VBO_ARENA_BUFFER_POINTS);
+        funcs->glGenBuffers(1, &vbo);
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        funcs->glBufferData(GL_ARRAY_BUFFER, capacity * this->ptsize, nullptr, GL_DYNAMIC_DRAW);
+        funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        struct arenabuffer& buf = this->buffers[vbo];
+        buf.capacity = capacity;
+        buf.used = 0;
+        if (capacity != len)
+        {
+            buf.freelist.insert(len, capacity - len);
+        }
+    }
+
+    VBORange* range = new VBORange(this, vbo, offset, len);
+
+    struct arenabuffer& buf = this->buffers[vbo];
+    buf.used += len;
+    buf.live.insert(offset, range);
+
+    return QSharedPointer<VBORange>(range);
+}
+
+void VBOArena::release(VBORange* range)
+{
+    Q_ASSERT(this->buffers.contains(range->vbo));
+
+    struct arenabuffer& buf = this->buffers[range->vbo];
+    buf.live.remove(range->offset);
+
+    /* Frames drawn so far may still read from the range, so it waits for
+     * the next fence before it can be reused.
+     */
+    if (this->fencing)
+    {
+        struct retiredrange rr;
+        rr.vbo = range->vbo;
+        rr.offset = range->offset;
+        rr.length = range->length;
+        rr.fence = this->inserted + 1;
+        this->retired.append(rr);
+        return;
+    }
+
+    buf.used -= range->length;
+    VBOArena::freeRange(buf, range->offset, range->length);
+}
+
+void VBOArena::freeRange(struct arenabuffer& buf, int offset, int len)
+{
+    /* Merge the range with its neighbours in the free list. */
+    auto next = buf.freelist.lowerBound(offset);
+    if (next != buf.freelist.end() && next.key() == offset + len)
+    {
+        len += *next;
+        next = buf.freelist.erase(next);
+    }
+
+    if (next != buf.freelist.begin())
+    {
+        auto prev = next - 1;
+        if (prev.key() + *prev == offset)
+        {
+            *prev += len;
+            return;
+        }
+    }
+
+    buf.freelist.insert(offset, len);
+}
+
+/* Returns true if fence sync objects are available in the current context. */
+static bool canFence(QOpenGLContext* ctx)
+{
+    if (ctx == nullptr)
+    {
+        return false;
+    }
+
+    QPair<int, int> version = ctx->format().version();
+    if (ctx->isOpenGLES())
+    {
+        return version >= qMakePair(3, 0);
+    }
+    return version >= qMakePair(3, 2) || ctx->hasExtension(QByteArrayLiteral("GL_ARB_sync"));
+}
+
+void VBOArena::collect(QOpenGLFunctions* funcs)
+{
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    bool fences = canFence(ctx);
+    QOpenGLExtraFunctions* extra = fences ? ctx->extraFunctions() : nullptr;
+    if (fences)
+    {
+        this->pollFences(extra);
+    }
+
+    /* Reuse the released ranges that the GPU is done with. Without fences
+     * there's no telling, so they are all reused.
+     */
+    for (int r = 0; r < this->retired.size();)
+    {
+        const struct retiredrange& rr = this->retired[r];
+        if (!fences || rr.fence <= this->completed)
+        {
+            struct arenabuffer& buf = this->buffers[rr.vbo];
+            buf.used -= rr.length;
+            VBOArena::freeRange(buf, rr.offset, rr.length);
+            this->retired.remove(r);
+        }
+        else
+        {
+            r++;
+        }
+    }
+    this->fencing = fences;
+
+    QVector<GLuint> empty;
+    GLuint fragmented = 0;
+
+    for (auto i = this->buffers.begin(); i != this->buffers.end(); i++)
+    {
+        /* Keep one buffer around, even if it's empty, to avoid
+         * reallocating it over and over.
+         */
+        if (i->used == 0 && this->buffers.size() - empty.size() > 1)
+        {
+            empty.append(i.key());
+        }
+        else if (i->freelist.size() > VBO_ARENA_MAX_FRAGMENTS && fragmented == 0)
+        {
+            fragmented = i.key();
+        }
+    }
+
+    if (empty.size() != 0)
+    {
+        funcs->glDeleteBuffers(empty.size(), empty.data());
+        for (auto j = empty.begin(); j != empty.end(); j++)
+        {
+            this->buffers.remove(*j);
+        }
+    }
+
+    /* Compact at most one buffer per frame, to bound the time it takes. */
+    if (fragmented != 0)
+    {
+        this->compact(funcs, fragmented);
+    }
+
+    /* Everything up to here, including the last frame, is before this
+     * fence.
+     */
+    if (fences)
+    {
+        GLsync fence = extra->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->fences.append(qMakePair(++this->inserted, fence));
+    }
+}
+
+void VBOArena::pollFences(QOpenGLExtraFunctions* extra)
+{
+    while (!this->fences.isEmpty())
+    {
+        GLenum result = extra->glClientWaitSync(this->fences.first().second, 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+        {
+            break;
+        }
+        extra->glDeleteSync(this->fences.first().second);
+        this->completed = this->fences.first().first;
+        this->fences.removeFirst();
+    }
+}
+
+bool VBOArena::inFlight(QOpenGLExtraFunctions* extra, const VBORange* range)
+{
+    if (!this->fencing)
+    {
+        return true;
+    }
+
+    /* A range isn't drawn in the frame it is allocated in until all of the
+     * uploads for that frame are done.
+     */
+    if (range->fenced == this->inserted)
+    {
+        return false;
+    }
+
+    this->pollFences(extra);
+    return this->completed != this->inserted;
+}
+
+int VBOArena::bufferCount() const
+{
+    return this->buffers.size();
+}
+
+/* Returns true if glCopyBufferSubData is available in the current context. */
+static bool canCopyBuffers(QOpenGLContext* ctx)
+{
+    if (ctx == nullptr)
+    {
+        return false;
+    }
+
+    QPair<int, int> version = ctx->format().version();
+    if (ctx->isOpenGLES())
+    {
+        return version >= qMakePair(3, 0);
+    }
+    return version >= qMakePair(3, 1) || ctx->hasExtension(QByteArrayLiteral("GL_ARB_copy_buffer"));
+}
+
+/* Returns true if glMapBufferRange is available in the current context. */
+static bool canMapBuffers(QOpenGLContext* ctx)
+{
+    if (ctx == nullptr)
+    {
+        return false;
+    }
+
+    QPair<int, int> version = ctx->format().version();
+    if (ctx->isOpenGLES())
+    {
+        return version >= qMakePair(3, 0);
+    }
+    return version >= qMakePair(3, 0) || ctx->hasExtension(QByteArrayLiteral("GL_ARB_map_buffer_range"));
+}
+
+void VBOArena::upload(QOpenGLFunctions* funcs, const VBORange* range, int offset, const void* data, int len)
+{
+    Q_ASSERT(offset >= 0 && offset + len <= range->length);
+
+    GLintptr start = (GLintptr) (range->offset + offset) * this->ptsize;
+    GLsizeiptr size = (GLsizeiptr) len * this->ptsize;
+
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, range->vbo);
+
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    if (canMapBuffers(ctx))
+    {
+        /* The whole mapped range is overwritten, so the driver need not
+         * preserve what was there. If the GPU can't be reading it, there is
+         * nothing to wait for either.
+         */
+        QOpenGLExtraFunctions* extra = ctx->extraFunctions();
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        if (!this->inFlight(extra, range))
+        {
+            access |= GL_MAP_UNSYNCHRONIZED_BIT;
+        }
+        void* mapped = extra->glMapBufferRange(GL_ARRAY_BUFFER, start, size, access);
+        if (mapped != nullptr)
+        {
+            memcpy(mapped, data, size);
+            if (extra->glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE)
+            {
+                funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+                return;
+            }
+
+            /* The contents of the buffer were lost, so copy them again. */
+            qWarning("Lost the contents of a mapped VBO");
+        }
+    }
+
+    funcs->glBufferSubData(GL_ARRAY_BUFFER, start, size, data);
+    funcs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void VBOArena::compact(QOpenGLFunctions* funcs, GLuint vbo)
+{
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    if (!canCopyBuffers(ctx))
+    {
+        /* Without copying on the GPU, we'd have to upload everything in
+         * the buffer again, so put up with the fragmentation instead.
+         */
+        return;
+    }
+    QOpenGLExtraFunctions* extra = ctx->extraFunctions();
+
+    struct arenabuffer& buf = this->buffers[vbo];
+
+    GLuint newvbo;
+    funcs->glGenBuffers(1, &newvbo);
+    extra->glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+    extra->glBindBuffer(GL_COPY_WRITE_BUFFER, newvbo);
+    extra->glBufferData(GL_COPY_WRITE_BUFFER, buf.capacity * this->ptsize, nullptr, GL_DYNAMIC_DRAW);
+
+    /* Move the live ranges to the start of the new buffer, in order. The
+     * released ones are left behind in the old buffer, which is only freed
+     * once the GPU is done with it.
+     */
+    struct arenabuffer compacted;
+    compacted.capacity = buf.capacity;
+    for (int r = 0; r < this->retired.size();)
+    {
+        if (this->retired[r].vbo == vbo)
+        {
+            buf.used -= this->retired[r].length;
+            this->retired.remove(r);
+        }
+        else
+        {
+            r++;
+        }
+    }
+    compacted.used = buf.used;
+
+    int dest = 0;
+    for (auto i = buf.live.begin(); i != buf.live.end(); i++)
+    {
+        VBORange* range = *i;
+        extra->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                   range->offset * this->ptsize, dest * this->ptsize,
+                                   range->length * this->ptsize);
+        range->vbo = newvbo;
+        range->offset = dest;
+        range->fenced = this->inserted - 1; // the copy is still pending
+        compacted.live.insert(dest, range);
+        dest += range->length;
+    }
+    if (dest != compacted.capacity)
+    {
+        compacted.freelist.insert(dest, compacted.capacity - dest);
+    }
+
+    extra->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    extra->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    this->buffers.remove(vbo);
+    this->buffers.insert(newvbo, compacted);
+    funcs->glDeleteBuffers(1, &vbo);
+}
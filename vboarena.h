@@ -0,0 +1,154 @@
+#ifndef VBOARENA_H
+#define VBOARENA_H
+
+#include <QHash>
+#include <QMap>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFunctions>
+#include <QPair>
+#include <QSharedPointer>
+#include <QVector>
+
+/* The number of points that each buffer in the arena has room for, unless
+ * a single allocation needs more. At 40 bytes per point, this is 10 MiB,
+ * at the 16 bytes of a data density point, 4 MiB, and at the 12 bytes of
+ * a raw point, 3 MiB.
+ */
+#define VBO_ARENA_BUFFER_POINTS (1 << 18)
+
+/* A buffer is compacted once its free space is split into more than this
+ * many ranges.
+ */
+#define VBO_ARENA_MAX_FRAGMENTS 64
+
+class VBOArena;
+
+/* A range of points in one of the buffers of a VBO Arena. The range is
+ * returned to the arena once the last reference to it is dropped. The
+ * buffer and offset may change when the arena is compacted, so they must
+ * be read each time the range is drawn.
+ */
+class VBORange
+{
+    friend class VBOArena;
+
+public:
+    ~VBORange();
+
+    GLuint getBuffer() const;
+    int getOffset() const;
+    int getLength() const;
+    VBOArena* getArena() const;
+
+private:
+    VBORange(VBOArena* a, GLuint buffer, int off, int len);
+
+    VBOArena* arena;
+    GLuint vbo;
+    int offset;
+    const int length;
+
+    /* The number of fences the arena had inserted when this range was
+     * allocated or last moved.
+     */
+    quint64 fenced;
+};
+
+struct arenabuffer
+{
+    int capacity;
+    int used;
+
+    /* Maps the offset of each free range to its length. Adjacent free
+     * ranges are always merged.
+     */
+    QMap<int, int> freelist;
+
+    /* Maps the offset of each allocated range to the range. */
+    QMap<int, VBORange*> live;
+};
+
+/* A range that has been released, but may still be read by commands that
+ * the GPU hasn't finished yet. It is returned to the free list once FENCE
+ * has signaled.
+ */
+struct retiredrange
+{
+    GLuint vbo;
+    int offset;
+    int length;
+    quint64 fence;
+};
+
+/* Sub-allocates ranges of points from a few large OpenGL buffers, so that
+ * Cache Entries need not each have a buffer of their own.
+ *
+ * Ranges are allocated first-fit from a free list kept for each buffer.
+ * Buffers are only created, deleted, or compacted while a GL context is
+ * current, i.e. in ALLOCATE and COLLECT.
+ *
+ * Where the context has fences, COLLECT inserts one each frame, and a
+ * released range only goes back on the free list once the fence after it
+ * has signaled. A newly allocated range is then never read by the GPU
+ * until it is drawn, so it can be uploaded to without synchronizing.
+ */
+class VBOArena
+{
+    friend class VBORange;
+
+public:
+    /* POINTSIZE is the size, in bytes, of each point in the buffers. */
+    VBOArena(int pointsize);
+
+    /* Allocates a range with room for LEN points. The contents of the
+     * range are undefined.
+     */
+    QSharedPointer<VBORange> allocate(QOpenGLFunctions* funcs, int len);
+
+    /* Copies LEN points from DATA into RANGE, starting OFFSET points into
+     * the range. The buffer is mapped, rather than copied into, where the
+     * context allows it, which saves a copy with many drivers. The mapping
+     * is unsynchronized if the GPU can't be using the range, i.e. it was
+     * allocated since the last fence, or every fence has signaled.
+     */
+    void upload(QOpenGLFunctions* funcs, const VBORange* range, int offset, const void* data, int len);
+
+    /* Deletes buffers that are no longer used, and compacts a buffer if
+     * its free space has become too fragmented. Should be called once per
+     * frame, before anything is drawn.
+     */
+    void collect(QOpenGLFunctions* funcs);
+
+    /* Returns the number of buffers in the arena. */
+    int bufferCount() const;
+
+private:
+    void release(VBORange* range);
+    void compact(QOpenGLFunctions* funcs, GLuint vbo);
+
+    /* Returns LEN points at OFFSET in BUF to its free list. */
+    static void freeRange(struct arenabuffer& buf, int offset, int len);
+
+    /* Deletes the fences that have signaled, oldest first. */
+    void pollFences(QOpenGLExtraFunctions* extra);
+
+    /* True if the GPU may still be using RANGE. */
+    bool inFlight(QOpenGLExtraFunctions* extra, const VBORange* range);
+
+    const int ptsize;
+    QHash<GLuint, struct arenabuffer> buffers;
+
+    /* Whether the context had fences the last time COLLECT was called. */
+    bool fencing;
+
+    /* The fences that haven't signaled yet, oldest first, with their
+     * numbers. Fences are numbered from 1, in the order inserted.
+     */
+    QVector<QPair<quint64, GLsync>> fences;
+    quint64 inserted;
+    quint64 completed; // the newest fence known to have signaled
+
+    QVector<struct retiredrange> retired;
+};
+
+#endif // VBOARENA_H